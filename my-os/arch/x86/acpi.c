@@ -1,115 +1,197 @@
 #include <asm/acpi.h>
 #include <asm/apic.h>
+#include <asm/hpet.h>
 #include <asm/idt.h>
+#include <asm/numa.h>
 #include <asm/page.h>
+#include <asm/smp.h>
 
+#include <kernel/mm.h>
 #include <kernel/printk.h>
+#include <my-os/kernel.h>
 #include <my-os/string.h>
 
 struct RSDTDescriptor *rsdt;
-struct address_structure {
-    u8 address_space_id; // 0 - system memory, 1 - system I/O
-    u8 register_bit_width;
-    u8 register_bit_offset;
-    u8 reserved;
-    u64 base_addr;
-} __attribute__((packed));
-
-struct HPET {
-    struct SDTHeader header;
-    u8 hardware_rev_id;
-    u8 comparator_count : 5;
-    u8 counter_size : 1;
-    u8 reserved : 1;
-    u8 legacy_replacement : 1;
-    u16 pci_vendor_id;
-    struct address_structure address;
-    u8 hpet_number;
-    u16 minimum_tick;
-    u8 page_protection;
-} __attribute__((packed));
-
-#define HPET_REG_GENERAL_CAP_ID 0x00
-#define HPET_REG_GENERAL_CNF 0x10
-#define HPET_REG_MAIN_CNT_VALUE 0xf0
-
-#define HPET_REG_N_TIMER_CNF_CAP(n) (0x100 + 0x20 * n)
-#define HPET_REG_N_TIMER_COMP_VAL(n) (0x108 + 0x20 * n)
-#define HPET_REG_N_TIMER_FSB_INTER(n) (0x110 + 0x20 * n)
-
-struct HPET_general_cap_id_reg {
-    u8 rev_id;
-    u8 num_tim_cap : 5;
-    u8 counter_size_cap : 1;
-    u8 reserved : 1;
-    u8 leg_rt_cap : 1;
-    u16 vendor_id;
-    u32 counter_clk_preiod;
-} __attribute__((packed));
-
-struct HPET_timer_conf_cap_reg {
-    u16 reserved0 : 1;
-    u16 tn_int_type_cnf : 1;
-    u16 tn_int_enb_cnf : 1;
-    u16 tn_type_cnf : 1;
-    u16 tn_per_int_cap : 1;
-    u16 tn_size_cap : 1;
-    u16 tn_val_set_cnf : 1;
-    u16 tn_reserved : 1;
-    u16 tn_32mode_cnf : 1;
-    u16 tn_int_route_cnf : 5;
-    u16 tn_fsb_en_cnf : 1;
-    u16 tn_fsb_int_del_cap : 1;
-    u16 reserved1;
-    u32 tn_int_route_cap;
-} __attribute__((packed));
-
-void hpet_init(struct HPET *hpet) {
-    printk("addr %p\n", hpet->address.base_addr);
-
-    void *base_addr = __va(hpet->address.base_addr);
-
-    u64 *reg;
-    reg = base_addr + HPET_REG_GENERAL_CAP_ID;
-    struct HPET_general_cap_id_reg cap_reg =
-        *(struct HPET_general_cap_id_reg *)reg;
-
-    u32 COUNTER_CLK_PERIOD = cap_reg.counter_clk_preiod;
-    printk("counter clk period %d\n", COUNTER_CLK_PERIOD);
-
-    reg = base_addr + HPET_REG_N_TIMER_CNF_CAP(0);
-    struct HPET_timer_conf_cap_reg cnf_reg =
-        *(struct HPET_timer_conf_cap_reg *)reg;
-
-    cnf_reg.tn_int_enb_cnf = 1;
-    cnf_reg.tn_type_cnf = 1;
-    cnf_reg.tn_val_set_cnf = 1;
-    cnf_reg.tn_int_route_cnf = cnf_reg.tn_int_route_cap;
-    *reg = *(u64 *)&cnf_reg;
-
-    reg = base_addr + HPET_REG_N_TIMER_COMP_VAL(0);
-    u32 freq = 1e15 / COUNTER_CLK_PERIOD;
-    printk("freq %d\n", freq);
-    *reg = freq / 1000;
-
-    reg = base_addr + HPET_REG_GENERAL_CNF;
-#define ENABLE_CNF_BIT 0
-#define LEG_RT_CNF_BIT 1
-    *reg = 1 << LEG_RT_CNF_BIT | 1 << ENABLE_CNF_BIT;
+
+/* online capable entries are hot-plug slots, only enabled cpus are booted */
+static void acpi_register_lapic(u32 apicid, u32 flags) {
+    if (!(flags & MADT_LAPIC_ENABLED))
+        return;
+    smp_register_cpu(apicid);
+}
+
+static void acpi_parse_madt(struct MADT *madt) {
+    u8 *entry = madt->entries;
+    u8 *end = (u8 *)madt + madt->header.length;
+
+    while (entry + sizeof(struct MADT_entry_header) <= end) {
+        struct MADT_entry_header *header = (void *)entry;
+        if (header->length < sizeof(struct MADT_entry_header))
+            break;
+
+        if (header->type == MADT_TYPE_LAPIC) {
+            struct MADT_lapic *lapic = (void *)entry;
+            acpi_register_lapic(lapic->apic_id, lapic->flags);
+        } else if (header->type == MADT_TYPE_X2APIC) {
+            struct MADT_x2apic *x2apic = (void *)entry;
+            acpi_register_lapic(x2apic->x2apic_id, x2apic->flags);
+        }
+        entry += header->length;
+    }
+    printk("madt: present cpus %#lx\n", cpu_present_mask);
+}
+
+static int acpi_map(phys_addr_t addr, size_t size) {
+    phys_addr_t end = round_up(addr + size, PTE_SIZE);
+
+    if (init_memory_mapping(round_down(addr, PTE_SIZE), end) <
+        end >> PTE_SHIFT)
+        return -1;
+    return 0;
+}
+
+/*
+ * The tables live outside the ram the direct map covers, map the header
+ * first to learn the length, then the whole table. NULL if either can
+ * not be mapped.
+ */
+static void *acpi_map_table(phys_addr_t addr) {
+    struct SDTHeader *header;
+
+    if (acpi_map(addr, sizeof(*header)))
+        return NULL;
+    header = __va(addr);
+    if (acpi_map(addr, header->length))
+        return NULL;
+    return header;
+}
+
+#define MAX_PXM_DOMAINS 256
+
+static int pxm_to_node_map[MAX_PXM_DOMAINS];
+static int nr_pxm_nodes;
+
+/* node ids are handed out in the order the domains show up */
+static int acpi_map_pxm_to_node(u32 pxm) {
+    if (pxm >= MAX_PXM_DOMAINS)
+        return NUMA_NO_NODE;
+    if (pxm_to_node_map[pxm] == NUMA_NO_NODE) {
+        if (nr_pxm_nodes >= MAX_NUMNODES) {
+            printk("srat: proximity domain %u over the node limit\n", pxm);
+            return NUMA_NO_NODE;
+        }
+        pxm_to_node_map[pxm] = nr_pxm_nodes++;
+    }
+    return pxm_to_node_map[pxm];
+}
+
+static void acpi_parse_srat(struct SRAT *srat) {
+    u8 *entry = srat->entries;
+    u8 *end = (u8 *)srat + srat->header.length;
+
+    while (entry + sizeof(struct SRAT_entry_header) <= end) {
+        struct SRAT_entry_header *header = (void *)entry;
+        if (header->length < sizeof(struct SRAT_entry_header))
+            break;
+
+        if (header->type == SRAT_TYPE_CPU_AFFINITY) {
+            struct SRAT_cpu_affinity *cpu = (void *)entry;
+            u32 pxm = cpu->proximity_domain_lo |
+                      cpu->proximity_domain_hi[0] << 8 |
+                      cpu->proximity_domain_hi[1] << 16 |
+                      cpu->proximity_domain_hi[2] << 24;
+            if (cpu->flags & SRAT_ENABLED)
+                set_apicid_to_node(cpu->apic_id, acpi_map_pxm_to_node(pxm));
+        } else if (header->type == SRAT_TYPE_X2APIC_CPU_AFFINITY) {
+            struct SRAT_x2apic_cpu_affinity *cpu = (void *)entry;
+            if (cpu->flags & SRAT_ENABLED)
+                set_apicid_to_node(cpu->x2apic_id,
+                                   acpi_map_pxm_to_node(cpu->proximity_domain));
+        } else if (header->type == SRAT_TYPE_MEMORY_AFFINITY) {
+            struct SRAT_mem_affinity *mem = (void *)entry;
+            if (mem->flags & SRAT_ENABLED && mem->length) {
+                int nid = acpi_map_pxm_to_node(mem->proximity_domain);
+                numa_add_memblk(nid, mem->base_address,
+                                mem->base_address + mem->length);
+                if (mem->flags & SRAT_MEM_HOT_PLUGGABLE)
+                    printk("srat: [mem %#x-%#x] hot-pluggable\n",
+                           mem->base_address,
+                           mem->base_address + mem->length - 1);
+            }
+        }
+        entry += header->length;
+    }
+}
+
+static void acpi_parse_slit(struct SLIT *slit) {
+    u64 n = slit->locality_count;
+
+    if (sizeof(*slit) + n * n > slit->header.length)
+        return;
+    for (u32 i = 0; i < n; i++) {
+        for (u32 j = 0; j < n; j++) {
+            if (i >= MAX_PXM_DOMAINS || j >= MAX_PXM_DOMAINS)
+                continue;
+            int from = pxm_to_node_map[i];
+            int to = pxm_to_node_map[j];
+            if (from != NUMA_NO_NODE && to != NUMA_NO_NODE)
+                numa_set_distance(from, to, slit->entry[i * n + j]);
+        }
+    }
+}
+
+/*
+ * Runs before the direct map is built, the tables are reached through
+ * the early page fault mappings. The slit is read after the srat, its
+ * domains only mean something once the srat numbered them.
+ */
+int acpi_numa_init(void) {
+    struct RSDTDescriptor *root;
+    struct SLIT *slit = NULL;
+    bool srat = false;
+
+    for (int i = 0; i < MAX_PXM_DOMAINS; i++)
+        pxm_to_node_map[i] = NUMA_NO_NODE;
+    nr_pxm_nodes = 0;
+
+    if (!rsdt)
+        return -1;
+    root = __va(rsdt);
+    int entries = (root->header.length - sizeof(root->header)) / 4;
+    for (int i = 0; i < entries; i++) {
+        struct SDTHeader *sdt = __va(root->other_sdt[i]);
+        if (!memcmp(sdt->signature, "SRAT", 4)) {
+            acpi_parse_srat((struct SRAT *)sdt);
+            srat = true;
+        } else if (!memcmp(sdt->signature, "SLIT", 4)) {
+            slit = (struct SLIT *)sdt;
+        }
+    }
+    if (!srat)
+        return -1;
+    if (slit)
+        acpi_parse_slit(slit);
+    return 0;
 }
 
 void acpi_init() {
     printk("rsdt addr %p\n", rsdt);
-    rsdt = __va(rsdt);
+    rsdt = acpi_map_table((phys_addr_t)rsdt);
     printk("rsdt va addr %p\n", rsdt);
+    if (!rsdt)
+        return;
     int entries = (rsdt->header.length - sizeof(rsdt->header)) / 4;
     char buf[5] = {0};
     for (int i = 0; i < entries; i++) {
-        struct SDTHeader *sdt = __va(rsdt->other_sdt[i]);
+        struct SDTHeader *sdt = acpi_map_table(rsdt->other_sdt[i]);
+        if (!sdt)
+            continue;
         memcpy(buf, sdt->signature, 4);
         printk("sdt %s\n", buf);
         if (!memcmp(sdt->signature, "HPET", 4)) {
             hpet_init((struct HPET *)sdt);
+        } else if (!memcmp(sdt->signature, "APIC", 4)) {
+            acpi_parse_madt((struct MADT *)sdt);
         }
     }
 }
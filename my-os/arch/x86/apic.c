@@ -1,21 +1,35 @@
 #include <asm/apic.h>
+#include <asm/irq.h>
 #include <asm/msr.h>
 #include <asm/page.h>
 #include <asm/processor.h>
 
+#include <asm/smp.h>
+#include <asm/tsc.h>
+
 #include <kernel/printk.h>
+#include <my-os/clockchips.h>
+#include <my-os/clocksource.h>
+#include <my-os/compiler.h>
+#include <my-os/percpu.h>
+#include <my-os/spinlock.h>
 #include <my-os/types.h>
 
-#define CPUID_FEAT_EDX_APIC 0x9
-#define CPUID_FEAT_EDX_X2APIC 0x21
+#define CPUID_FEAT_EDX_APIC 9
+#define CPUID_FEAT_ECX_X2APIC 21
 
 #define MSR_IA32_APICBASE 0x0000001b
 #define MSR_IA32_APICBASE_BSP (1 << 8)
+#define MSR_IA32_APICBASE_X2APIC (1 << 10)
 #define MSR_IA32_APICBASE_ENABLE (1 << 11)
-/* #define MSR_IA32_X2APIC_ENABLE (1 << 10) */
 #define MSR_IA32_APICBASE_BASE (~(0xfffUL))
 
-#define MSR_X2APIC_SIVR 0x0000080f
+/* x2apic registers are msrs at 0x800 + the xapic offset / 16 */
+#define APIC_BASE_MSR 0x00000800
+#define MSR_X2APIC_ICR (APIC_BASE_MSR + (ICR_LOW_REG_OFFSET >> 4))
+
+/* set on the boot cpu before any apic access, the aps follow it */
+static bool x2apic_mode;
 
 struct IOAPIC_map {
     phys_addr_t addr;
@@ -27,14 +41,25 @@ struct IOAPIC_map {
 bool check_apic() {
     unsigned int eax, ebx, ecx, edx;
     cpuid(1, &eax, &ebx, &ecx, &edx);
-    return edx & 1 << CPUID_FEAT_EDX_APIC & 1 << CPUID_FEAT_EDX_APIC;
+    return edx & 1 << CPUID_FEAT_EDX_APIC;
+}
+
+static bool check_x2apic(void) {
+    return cpuid_ecx(1) & 1 << CPUID_FEAT_ECX_X2APIC;
 }
 
+/* going from disabled straight to x2apic is invalid, pass through xapic */
 u64 enable_apic() {
     u64 val;
     rdmsrl(MSR_IA32_APICBASE, val);
-    val |= MSR_IA32_APICBASE_ENABLE;
-    wrmsrl(MSR_IA32_APICBASE, val);
+    if (!(val & MSR_IA32_APICBASE_ENABLE)) {
+        val |= MSR_IA32_APICBASE_ENABLE;
+        wrmsrl(MSR_IA32_APICBASE, val);
+    }
+    if (x2apic_mode && !(val & MSR_IA32_APICBASE_X2APIC)) {
+        val |= MSR_IA32_APICBASE_X2APIC;
+        wrmsrl(MSR_IA32_APICBASE, val);
+    }
     return val;
 }
 
@@ -86,8 +111,154 @@ void ioapic_init(void) {
 
     // enable keyboard
     wrioapicl(IOAPIC_RTE_KEYBOARD, 0x21);
-    // enable hpet
-    wrioapicl(IOAPIC_RTE_HPET, 0x22);
+    // enable ide primary/secondary channel
+    wrioapicl(IOAPIC_RTE_IDE0, 0x2e);
+    wrioapicl(IOAPIC_RTE_IDE1, 0x2f);
+}
+
+static inline u32 apic_read(u32 reg) {
+    if (x2apic_mode)
+        return __rdmsr(APIC_BASE_MSR + (reg >> 4));
+    return *(volatile u32 *)__va(LAPIC_DEFAULT_BASE + reg);
+}
+
+static inline void apic_write(u32 reg, u32 value) {
+    if (x2apic_mode)
+        wrmsr(APIC_BASE_MSR + (reg >> 4), value, 0);
+    else
+        *(volatile u32 *)__va(LAPIC_DEFAULT_BASE + reg) = value;
+}
+
+#define CPUID_FEAT_ECX_TSC_DEADLINE 24
+#define MSR_IA32_TSC_DEADLINE 0x000006e0
+
+#define LAPIC_CAL_NSEC (10 * NSEC_PER_MSEC)
+#define LAPIC_TIMER_DEFAULT_FREQ (100000ULL * HZ)
+/* fewer counts than this may be over before the write lands */
+#define LAPIC_TIMER_MIN_DELTA 0xf
+/* tsc cycles, far enough that the ns conversion can not overflow */
+#define LAPIC_DEADLINE_MAX_DELTA (1ULL << 48)
+
+static DEFINE_PER_CPU(struct clock_event_device, lapic_events);
+
+/*
+ * Count the lapic timer of this cpu against the clocksource for
+ * LAPIC_CAL_NSEC. Each cpu measures its own, the bus clock feeding it
+ * is not guaranteed to be the same everywhere.
+ */
+static u64 calibrate_apic_timer(void) {
+    unsigned long flags;
+    ktime_t start, now;
+
+    apic_write(TIMER_DIV_CONF_REG_OFFSET, APIC_TIMER_DIV_16);
+    apic_write(LVT_TIMER_REG_OFFSET, APIC_LVT_MASKED | LOCAL_TIMER_VECTOR);
+
+    if (!clocksource_current()) {
+        printk("apic timer: no clocksource, using default frequency\n");
+        return LAPIC_TIMER_DEFAULT_FREQ;
+    }
+
+    local_irq_save(flags);
+    apic_write(TIMER_INIT_COUNT_REG_OFFSET, 0xffffffff);
+    start = ktime_get();
+    while ((now = ktime_get()) - start < LAPIC_CAL_NSEC)
+        cpu_relax();
+    u32 elapsed = 0xffffffff - apic_read(TIMER_CUR_COUNT_REG_OFFSET);
+    apic_write(TIMER_INIT_COUNT_REG_OFFSET, 0);
+    local_irq_restore(flags);
+
+    return (u64)elapsed * NSEC_PER_SEC / (now - start);
+}
+
+static int lapic_next_event(u64 delta,
+                            struct clock_event_device *dev __always_unused) {
+    apic_write(TIMER_INIT_COUNT_REG_OFFSET, delta);
+    return 0;
+}
+
+static int lapic_next_deadline(u64 delta,
+                               struct clock_event_device *dev __always_unused) {
+    wrmsrl(MSR_IA32_TSC_DEADLINE, rdtsc() + delta);
+    return 0;
+}
+
+static irqreturn_t lapic_timer_interrupt(int irq __always_unused,
+                                         void *dev_id __always_unused) {
+    struct clock_event_device *dev = this_cpu_ptr(&lapic_events);
+
+    if (dev->event_handler)
+        dev->event_handler(dev);
+    return IRQ_HANDLED;
+}
+
+static struct irq_action lapic_timer_action = {
+    .name = "local-timer",
+    .handler = lapic_timer_interrupt,
+};
+
+void local_apic_setup(void) {
+    enable_apic();
+    apic_write(SIVR_REG_OFFSET, APIC_SIVR_ENABLE | SPURIOUS_APIC_VECTOR);
+}
+
+static bool lapic_has_tsc_deadline(void) {
+    return tsc_khz && cpuid_ecx(1) & 1 << CPUID_FEAT_ECX_TSC_DEADLINE;
+}
+
+/*
+ * Register the lapic timer of this cpu as its event device, in
+ * tsc-deadline mode if the cpu has it, else one-shot with its own
+ * calibration. Runs on every cpu with interrupts disabled.
+ */
+void local_apic_timer_setup(void) {
+    int cpu = smp_processor_id();
+    struct clock_event_device *dev = this_cpu_ptr(&lapic_events);
+
+    dev->features = CLOCK_EVT_FEAT_ONESHOT;
+    dev->rating = 100;
+    dev->cpu = cpu;
+
+    if (lapic_has_tsc_deadline()) {
+        apic_write(LVT_TIMER_REG_OFFSET,
+                   APIC_LVT_TIMER_TSCDEADLINE | LOCAL_TIMER_VECTOR);
+        /* in xapic mode the msr write is not ordered after the lvt write */
+        asm volatile("mfence" : : : "memory");
+
+        dev->name = "lapic-deadline";
+        dev->set_next_event = lapic_next_deadline;
+        clockevents_config_and_register(dev, tsc_khz * 1000,
+                                        LAPIC_TIMER_MIN_DELTA,
+                                        LAPIC_DEADLINE_MAX_DELTA);
+        return;
+    }
+
+    u64 freq = calibrate_apic_timer();
+    apic_write(TIMER_DIV_CONF_REG_OFFSET, APIC_TIMER_DIV_16);
+    apic_write(LVT_TIMER_REG_OFFSET, LOCAL_TIMER_VECTOR);
+
+    dev->name = "lapic";
+    dev->set_next_event = lapic_next_event;
+    clockevents_config_and_register(dev, freq, LAPIC_TIMER_MIN_DELTA,
+                                    0xffffffff);
+}
+
+void apic_send_ipi(u32 apicid, u32 icr) {
+    unsigned long flags;
+
+    if (x2apic_mode) {
+        /* one write, but not serializing: order earlier stores first */
+        asm volatile("mfence" : : : "memory");
+        wrmsrl(MSR_X2APIC_ICR, (u64)apicid << 32 | icr);
+        return;
+    }
+
+    /* an irq sending its own ipi must not come between the two icr writes */
+    local_irq_save(flags);
+    apic_write(ICR_HIGH_REG_OFFSET, apicid << 24);
+    apic_write(ICR_LOW_REG_OFFSET, icr);
+    while (apic_read(ICR_LOW_REG_OFFSET) & APIC_ICR_BUSY)
+        cpu_relax();
+    local_irq_restore(flags);
 }
 
 void local_apic_init(void) {
@@ -96,17 +267,25 @@ void local_apic_init(void) {
         printk("apic available\n");
     }
 
-    printk("apic base %p\n", enable_apic() & MSR_IA32_APICBASE_BASE);
-    /* u64 sivr; */
-    /* rdmsrl(MSR_X2APIC_SIVR, sivr); */
-    /* printk("%#x\n", sivr); */
-    /* sivr |=  */
-    /* wrmsrl(MSR_X2APIC_SIVR, sivr); */
+    /* msr access to the apic, xapic mmio is the fallback */
+    x2apic_mode = check_x2apic();
+    printk("apic base %p, %s mode\n", enable_apic() & MSR_IA32_APICBASE_BASE,
+           x2apic_mode ? "x2apic" : "xapic");
 
+    local_apic_setup();
     ioapic_init();
+
+    irq_set_handler(LOCAL_TIMER_IRQ, handle_simple_irq, "local-timer");
+    setup_irq(LOCAL_TIMER_IRQ, &lapic_timer_action);
+
+    local_apic_timer_setup();
 }
 
-void apic_eoi(void) {
-    u32 *eoi = __va(LAPIC_DEFAULT_BASE + EOI_REG_OFFSET);
-    *eoi = 0;
+/* the x2apic id is a full 32 bits */
+u32 read_apic_id(void) {
+    if (x2apic_mode)
+        return apic_read(ID_REG_OFFSET);
+    return apic_read(ID_REG_OFFSET) >> 24;
 }
+
+void apic_eoi(void) { apic_write(EOI_REG_OFFSET, 0); }
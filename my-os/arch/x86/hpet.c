@@ -1,35 +1,85 @@
+#include <asm/hpet.h>
+#include <asm/page.h>
+
+#include <kernel/mm.h>
+#include <kernel/printk.h>
+#include <my-os/clocksource.h>
+#include <my-os/compiler.h>
 #include <my-os/types.h>
 
-struct address_structure {
-    u8 address_space_id; // 0 - system memory, 1 - system I/O
-    u8 register_bit_width;
-    u8 register_bit_offset;
-    u8 reserved;
-    u64 address;
-} __attribute__((packed));
+#define HPET_REG_GENERAL_CAP_ID 0x00
+#define HPET_REG_GENERAL_CNF 0x10
+#define HPET_REG_MAIN_CNT_VALUE 0xf0
 
-struct description_table_header {
-    char signature[4]; // 'HPET' in case of HPET table
-    u32 length;
-    u8 revision;
-    u8 checksum;
-    char oemid[6];
-    u64 oem_tableid;
-    u32 oem_revision;
-    u32 creator_id;
-    u32 creator_revision;
-} __attribute__((packed));
+#define HPET_REG_N_TIMER_CNF_CAP(n) (0x100 + 0x20 * n)
+#define HPET_REG_N_TIMER_COMP_VAL(n) (0x108 + 0x20 * n)
+#define HPET_REG_N_TIMER_FSB_INTER(n) (0x110 + 0x20 * n)
 
-struct hpet {
-    struct description_table_header header;
-    u8 hardware_rev_id;
-    u8 comparator_count : 5;
-    u8 counter_size : 1;
+#define ENABLE_CNF_BIT 0
+
+struct HPET_general_cap_id_reg {
+    u8 rev_id;
+    u8 num_tim_cap : 5;
+    u8 counter_size_cap : 1;
     u8 reserved : 1;
-    u8 legacy_replacement : 1;
-    u16 pci_vendor_id;
-    struct address_structure address;
-    u8 hpet_number;
-    u16 minimum_tick;
-    u8 page_protection;
+    u8 leg_rt_cap : 1;
+    u16 vendor_id;
+    u32 counter_clk_preiod;
 } __attribute__((packed));
+
+static void *hpet_base;
+static u64 hpet_freq;
+
+static inline u64 hpet_readq(u32 reg) {
+    return *(volatile u64 *)(hpet_base + reg);
+}
+
+static inline void hpet_writeq(u32 reg, u64 value) {
+    *(volatile u64 *)(hpet_base + reg) = value;
+}
+
+u64 hpet_read_main_counter(void) {
+    return hpet_readq(HPET_REG_MAIN_CNT_VALUE);
+}
+
+/* 0 if there is no hpet */
+u64 hpet_frequency(void) { return hpet_freq; }
+
+static u64 hpet_read_counter(struct clocksource *cs __always_unused) {
+    return hpet_read_main_counter();
+}
+
+static struct clocksource hpet_clocksource = {
+    .name = "hpet",
+    .read = hpet_read_counter,
+    .rating = 250,
+};
+
+/*
+ * Start the main counter and register it as clocksource. The comparators
+ * stay unused, the lapic timers are the event devices; the counter also
+ * calibrates the tsc.
+ */
+void hpet_init(struct HPET *hpet) {
+    printk("hpet addr %p\n", hpet->address.base_addr);
+
+    if (init_memory_mapping(hpet->address.base_addr,
+                            hpet->address.base_addr + PTE_SIZE) <
+        (hpet->address.base_addr + PTE_SIZE) >> PTE_SHIFT) {
+        printk("hpet: registers not mapped\n");
+        return;
+    }
+    hpet_base = __va(hpet->address.base_addr);
+
+    u64 cap = hpet_readq(HPET_REG_GENERAL_CAP_ID);
+    struct HPET_general_cap_id_reg *cap_reg = (void *)&cap;
+
+    hpet_freq = 1000000000000000ULL / cap_reg->counter_clk_preiod;
+    hpet_clocksource.mask = cap_reg->counter_size_cap ? ~0ULL : 0xffffffff;
+
+    hpet_writeq(HPET_REG_GENERAL_CNF, 0);
+    hpet_writeq(HPET_REG_MAIN_CNT_VALUE, 0);
+    hpet_writeq(HPET_REG_GENERAL_CNF, 1 << ENABLE_CNF_BIT);
+
+    clocksource_register_hz(&hpet_clocksource, hpet_freq);
+}
@@ -120,6 +120,9 @@ void early_init_idt() {
 /*     idt_e->reserved = 0; */
 /* } */
 extern char irq_entries_start[IRQ_VECTORS][IRQ_ENTRIES_START_SIZE];
+/* secondary cpus share the boot cpu's idt */
+void load_current_idt(void) { load_idt(&idt_ptr); }
+
 void idt_setup(void) {
     for (int i = FIRST_EXTERNAL_VECTOR; i < NR_VECTORS; ++i) {
         set_intr_gate(i, (void *)irq_entries_start[i - FIRST_EXTERNAL_VECTOR]);
@@ -27,5 +27,119 @@ struct RSDTDescriptor {
     u32 other_sdt[0];
 };
 
+struct MADT {
+    struct SDTHeader header;
+    u32 lapic_addr;
+    u32 flags;
+    u8 entries[0];
+} __attribute__((packed));
+
+#define MADT_TYPE_LAPIC 0
+#define MADT_TYPE_X2APIC 9
+
+#define MADT_LAPIC_ENABLED (1 << 0)
+#define MADT_LAPIC_ONLINE_CAPABLE (1 << 1)
+
+struct MADT_entry_header {
+    u8 type;
+    u8 length;
+} __attribute__((packed));
+
+struct MADT_lapic {
+    struct MADT_entry_header header;
+    u8 processor_id;
+    u8 apic_id;
+    u32 flags;
+} __attribute__((packed));
+
+struct MADT_x2apic {
+    struct MADT_entry_header header;
+    u16 reserved;
+    u32 x2apic_id;
+    u32 flags;
+    u32 processor_uid;
+} __attribute__((packed));
+
+struct address_structure {
+    u8 address_space_id; // 0 - system memory, 1 - system I/O
+    u8 register_bit_width;
+    u8 register_bit_offset;
+    u8 reserved;
+    u64 base_addr;
+} __attribute__((packed));
+
+struct HPET {
+    struct SDTHeader header;
+    u8 hardware_rev_id;
+    u8 comparator_count : 5;
+    u8 counter_size : 1;
+    u8 reserved : 1;
+    u8 legacy_replacement : 1;
+    u16 pci_vendor_id;
+    struct address_structure address;
+    u8 hpet_number;
+    u16 minimum_tick;
+    u8 page_protection;
+} __attribute__((packed));
+
+struct SRAT {
+    struct SDTHeader header;
+    u32 table_revision;
+    u64 reserved;
+    u8 entries[0];
+} __attribute__((packed));
+
+#define SRAT_TYPE_CPU_AFFINITY 0
+#define SRAT_TYPE_MEMORY_AFFINITY 1
+#define SRAT_TYPE_X2APIC_CPU_AFFINITY 2
+
+#define SRAT_ENABLED (1 << 0)
+#define SRAT_MEM_HOT_PLUGGABLE (1 << 1)
+
+struct SRAT_entry_header {
+    u8 type;
+    u8 length;
+} __attribute__((packed));
+
+struct SRAT_cpu_affinity {
+    struct SRAT_entry_header header;
+    u8 proximity_domain_lo;
+    u8 apic_id;
+    u32 flags;
+    u8 local_sapic_eid;
+    u8 proximity_domain_hi[3];
+    u32 clock_domain;
+} __attribute__((packed));
+
+struct SRAT_mem_affinity {
+    struct SRAT_entry_header header;
+    u32 proximity_domain;
+    u16 reserved;
+    u64 base_address;
+    u64 length;
+    u32 reserved1;
+    u32 flags;
+    u64 reserved2;
+} __attribute__((packed));
+
+struct SRAT_x2apic_cpu_affinity {
+    struct SRAT_entry_header header;
+    u16 reserved;
+    u32 proximity_domain;
+    u32 x2apic_id;
+    u32 flags;
+    u32 clock_domain;
+    u32 reserved2;
+} __attribute__((packed));
+
+/* entry[i * locality_count + j] is the distance from domain i to j */
+struct SLIT {
+    struct SDTHeader header;
+    u64 locality_count;
+    u8 entry[0];
+} __attribute__((packed));
+
 extern struct RSDTDescriptor *rsdt;
 void acpi_init();
+/* srat and slit into the numa layout, -1 without a usable srat */
+int acpi_numa_init(void);
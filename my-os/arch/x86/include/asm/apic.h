@@ -13,13 +13,41 @@
 #define IOAPIC_RTE_END_INDEX 0x40
 
 #define IOAPIC_RTE_KEYBOARD (IOAPIC_RTE_BASE_INDEX + 2)
-#define IOAPIC_RTE_HPET (IOAPIC_RTE_BASE_INDEX + 4)
+#define IOAPIC_RTE_IDE0 (IOAPIC_RTE_BASE_INDEX + 2 * 14)
+#define IOAPIC_RTE_IDE1 (IOAPIC_RTE_BASE_INDEX + 2 * 15)
 
+#define ID_REG_OFFSET 0x20
 #define EOI_REG_OFFSET 0xb0
+#define SIVR_REG_OFFSET 0xf0
+#define ICR_LOW_REG_OFFSET 0x300
+#define ICR_HIGH_REG_OFFSET 0x310
+#define LVT_TIMER_REG_OFFSET 0x320
+#define TIMER_INIT_COUNT_REG_OFFSET 0x380
+#define TIMER_CUR_COUNT_REG_OFFSET 0x390
+#define TIMER_DIV_CONF_REG_OFFSET 0x3e0
+
+#define APIC_SIVR_ENABLE (1 << 8)
+
+#define APIC_ICR_DM_FIXED 0x00000
+#define APIC_ICR_DM_INIT 0x00500
+#define APIC_ICR_DM_STARTUP 0x00600
+#define APIC_ICR_BUSY 0x01000
+#define APIC_ICR_LEVEL_ASSERT 0x04000
+
+#define APIC_LVT_MASKED (1 << 16)
+#define APIC_LVT_TIMER_PERIODIC (1 << 17)
+#define APIC_LVT_TIMER_TSCDEADLINE (2 << 17)
+#define APIC_TIMER_DIV_16 0x3
 
 
 void local_apic_init(void);
+void local_apic_setup(void);
+void local_apic_timer_setup(void);
+
+void apic_send_ipi(u32 apicid, u32 icr);
 
 void apic_eoi(void);
 
+u32 read_apic_id(void);
+
 #endif /* X86_ASM_APIC_H */
@@ -0,0 +1,23 @@
+#ifndef X86_ASM_CMPXCHG_H
+#define X86_ASM_CMPXCHG_H
+
+#include <my-os/types.h>
+
+/*
+ * Compare the two adjacent words at ptr with (old1, old2) and, if both
+ * match, replace them with (new1, new2). ptr must be 16 byte aligned.
+ */
+static inline bool cmpxchg_double(void *ptr, unsigned long old1,
+                                  unsigned long old2, unsigned long new1,
+                                  unsigned long new2) {
+    bool ret;
+    asm volatile("lock; cmpxchg16b %1\n\t"
+                 "sete %0"
+                 : "=qm"(ret), "+m"(*(volatile unsigned long(*)[2])ptr),
+                   "+a"(old1), "+d"(old2)
+                 : "b"(new1), "c"(new2)
+                 : "memory");
+    return ret;
+}
+
+#endif /* X86_ASM_CMPXCHG_H */
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <asm/percpu.h>
+
+struct task_struct;
+
+DECLARE_PER_CPU(struct task_struct *, current_task);
+
+static inline struct task_struct *get_current(void) {
+    return this_cpu_read(current_task);
+}
+
+#define current get_current()
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <asm/acpi.h>
+
+void hpet_init(struct HPET *hpet);
+u64 hpet_read_main_counter(void);
+u64 hpet_frequency(void);
@@ -39,6 +39,7 @@ struct pt_regs {
 };
 
 void idt_setup(void);
+void load_current_idt(void);
 #endif
 
 #define R15 0 * 8
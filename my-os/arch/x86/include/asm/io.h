@@ -44,4 +44,7 @@ BUILDIO(l, , int)
 #define outsw outsw
 #define outsl outsl
 
+/* a write to the POST port takes roughly a microsecond */
+static inline void io_delay(void) { outb(0, 0x80); }
+
 #endif /* _X86_ASM_IO_H */
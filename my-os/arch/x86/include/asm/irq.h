@@ -7,6 +7,15 @@
 
 #define NR_IRQS 256
 
+/* system vectors, handled through the irq of the same offset */
+#define SPURIOUS_APIC_VECTOR 0xff
+#define LOCAL_TIMER_VECTOR 0xec
+#define LOCAL_TIMER_IRQ (LOCAL_TIMER_VECTOR - FIRST_EXTERNAL_VECTOR)
+#define RESCHEDULE_VECTOR 0xfd
+#define RESCHEDULE_IRQ (RESCHEDULE_VECTOR - FIRST_EXTERNAL_VECTOR)
+#define CALL_FUNCTION_VECTOR 0xfb
+#define CALL_FUNCTION_IRQ (CALL_FUNCTION_VECTOR - FIRST_EXTERNAL_VECTOR)
+
 #ifndef __ASSEMBLY__
 
 #include <my-os/types.h>
@@ -66,4 +75,28 @@ static inline void irq_enable(void) {
     asm volatile("sti" : : : "memory");
 }
 
+static inline unsigned long arch_local_save_flags(void) {
+    unsigned long flags;
+    asm volatile("pushf; pop %0" : "=rm"(flags) : : "memory");
+    return flags;
+}
+
+#define X86_EFLAGS_IF 0x00000200
+
+static inline bool irqs_disabled(void) {
+    return !(arch_local_save_flags() & X86_EFLAGS_IF);
+}
+
+#define local_irq_save(flags)                                                  \
+    do {                                                                       \
+        (flags) = arch_local_save_flags();                                     \
+        irq_disable();                                                         \
+    } while (0)
+
+#define local_irq_restore(flags)                                               \
+    do {                                                                       \
+        if ((flags) & X86_EFLAGS_IF)                                           \
+            irq_enable();                                                      \
+    } while (0)
+
 #endif
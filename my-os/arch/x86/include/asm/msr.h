@@ -15,6 +15,18 @@ static inline void __wrmsr(u32 msr, u32 low, u32 high) {
     asm volatile("wrmsr" : : "c"(msr), "a"(low), "d"(high) : "memory");
 }
 
+static inline u64 rdtsc(void) {
+    u32 low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return low | (u64)high << 32;
+}
+
+/* rdtsc that is not executed ahead of earlier loads */
+static inline u64 rdtsc_ordered(void) {
+    asm volatile("lfence" : : : "memory");
+    return rdtsc();
+}
+
 #define rdmsr(msr, val1, val2)                                                 \
     do {                                                                       \
         u64 __val = __rdmsr((msr));                                            \
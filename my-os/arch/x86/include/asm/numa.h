@@ -0,0 +1,12 @@
+#pragma once
+
+#include <my-os/numa.h>
+#include <my-os/types.h>
+
+/* filled from the srat, or one node holding everything without it */
+int numa_add_memblk(int nid, u64 start, u64 end);
+void numa_set_distance(int from, int to, int distance);
+void set_apicid_to_node(u32 apicid, int nid);
+
+/* before the direct map is built, the tables are reached by early faults */
+void numa_init(void);
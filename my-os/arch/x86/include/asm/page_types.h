@@ -21,6 +21,11 @@ enum pg_level {
 #endif
 
 #define MAX_PHYSMEM_BITS 46
+/* 128M of physical memory per mem_section */
+#define SECTION_SIZE_BITS 27
+/* reach of isa dma and of 32-bit bus masters */
+#define MAX_DMA_PFN ((16UL << 20) >> PTE_SHIFT)
+#define MAX_DMA32_PFN (1UL << (32 - PTE_SHIFT))
 #define MAXMEM (1ULL << MAX_PHYSMEM_BITS)
 
 #define __PAGE_OFFSET_BASE_L4 0xffff888000000000UL
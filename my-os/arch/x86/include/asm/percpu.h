@@ -0,0 +1,55 @@
+#pragma once
+
+#include <asm/msr.h>
+#include <my-os/types.h>
+
+#define MSR_GS_BASE 0xc0000101
+
+#define PER_CPU_SECTION ".data..percpu"
+
+#define DEFINE_PER_CPU(type, name)                                             \
+    __attribute__((section(PER_CPU_SECTION), used)) __typeof__(type) name
+
+#define DECLARE_PER_CPU(type, name)                                            \
+    extern __attribute__((section(PER_CPU_SECTION))) __typeof__(type) name
+
+extern unsigned long __per_cpu_offset[];
+
+#define __percpu_str_1(x) #x
+#define __percpu_str(x) __percpu_str_1(x)
+
+/*
+ * GS_BASE holds the offset of the cpu's area from the linked copy, so the
+ * link address of a per-cpu variable is its %gs displacement. @var must
+ * name the variable itself, the kernel is linked in the top 2G and the
+ * address fits the displacement, which -mcmodel=large would not use.
+ */
+#define this_cpu_read(var)                                                     \
+    ({                                                                         \
+        __typeof__(var) __ret;                                                 \
+        asm volatile("mov %%gs:" __percpu_str(var) ", %0"                      \
+                     : "=r"(__ret)                                             \
+                     :                                                         \
+                     : "memory");                                              \
+        __ret;                                                                 \
+    })
+
+#define __this_cpu_op(op, var, val)                                            \
+    do {                                                                       \
+        __typeof__(var) __val = (val);                                         \
+        asm volatile(op " %0, %%gs:" __percpu_str(var)                         \
+                     :                                                         \
+                     : "r"(__val)                                              \
+                     : "memory", "cc");                                        \
+    } while (0)
+
+#define this_cpu_write(var, val) __this_cpu_op("mov", var, val)
+#define this_cpu_add(var, val) __this_cpu_op("add", var, val)
+#define this_cpu_sub(var, val) __this_cpu_op("sub", var, val)
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+#define this_cpu_dec(var) this_cpu_sub(var, 1)
+
+/* point %gs of the calling cpu at the area of @cpu */
+static inline void load_percpu_segment(int cpu) {
+    wrmsrl(MSR_GS_BASE, __per_cpu_offset[cpu]);
+}
@@ -1,3 +1,60 @@
 #pragma once
 
+#include <asm/percpu.h>
+#include <my-os/types.h>
+
+#define NR_CPUS 64
+
+extern u64 cpu_online_mask;
+extern u64 cpu_present_mask;
+
+/*
+ * cpus are numbered densely, the boot cpu is 0 and the others follow in
+ * madt order; apic ids may be sparse and larger than NR_CPUS
+ */
+extern u32 x86_cpu_to_apicid[NR_CPUS];
+
+static inline u32 cpu_physical_id(int cpu) { return x86_cpu_to_apicid[cpu]; }
+
+u32 read_apic_id(void);
+
+/* each area keeps its own logical cpu number */
+DECLARE_PER_CPU(int, cpu_number);
+
+static inline int smp_processor_id(void) { return this_cpu_read(cpu_number); }
+
+static inline bool cpu_online(int cpu) {
+    return cpu_online_mask & (1ULL << cpu);
+}
+
+static inline void set_cpu_online(int cpu, bool online) {
+    if (online)
+        __sync_fetch_and_or(&cpu_online_mask, 1ULL << cpu);
+    else
+        __sync_fetch_and_and(&cpu_online_mask, ~(1ULL << cpu));
+}
+
+static inline bool cpu_present(int cpu) {
+    return cpu_present_mask & (1ULL << cpu);
+}
+
+static inline void set_cpu_present(int cpu, bool present) {
+    if (present)
+        __sync_fetch_and_or(&cpu_present_mask, 1ULL << cpu);
+    else
+        __sync_fetch_and_and(&cpu_present_mask, ~(1ULL << cpu));
+}
+
+#define for_each_present_cpu(cpu)                                              \
+    for ((cpu) = 0; (cpu) < NR_CPUS; (cpu)++)                                  \
+        if (cpu_present(cpu))
+
+#define for_each_online_cpu(cpu)                                               \
+    for ((cpu) = 0; (cpu) < NR_CPUS; (cpu)++)                                  \
+        if (cpu_online(cpu))
+
+void smp_prepare_boot_cpu(void);
+int smp_register_cpu(u32 apicid);
 void smp_init(void);
+void smp_send_reschedule(int cpu);
+void arch_send_call_function_ipi(int cpu);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <asm/page_types.h>
+#include <asm/processor.h>
+
+#include <my-os/mm_types.h>
+#include <my-os/types.h>
+
+#define TLB_FLUSH_ALL (~0UL)
+
+static inline void __flush_tlb_one(unsigned long addr) {
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+/* no mapping is global, a cr3 reload drops every entry */
+static inline void __flush_tlb_local(void) { write_cr3(__read_cr3()); }
+
+/*
+ * Invalidations collected while changing page tables, sent as one
+ * shootdown by tlb_batch_flush(). The range grows to cover every add.
+ */
+struct tlb_batch {
+    struct mm_struct *mm;
+    unsigned long start, end;
+};
+
+#define TLB_BATCH_INIT                                                         \
+    { .mm = NULL, .start = TLB_FLUSH_ALL, .end = 0 }
+
+void tlb_batch_add(struct tlb_batch *batch, struct mm_struct *mm,
+                   unsigned long start, unsigned long end);
+void tlb_batch_flush(struct tlb_batch *batch);
+
+void flush_tlb_mm_range(struct mm_struct *mm, unsigned long start,
+                        unsigned long end);
+void flush_tlb_kernel_range(unsigned long start, unsigned long end);
+void flush_tlb_all(void);
+void print_tlb_stats(void);
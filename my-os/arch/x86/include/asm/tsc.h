@@ -0,0 +1,7 @@
+#pragma once
+
+#include <my-os/types.h>
+
+extern u64 tsc_khz;
+
+void tsc_init(void);
@@ -11,6 +11,8 @@
 
 extern unsigned long vmemmap_base;
 extern size_t end_pfn;
+/* the first pfn above each zone */
+extern unsigned long max_zone_pfn[];
 
 void early_alloc_pgt_buf(void);
 void init_mem_mapping(void);
@@ -19,6 +21,10 @@ void *alloc_low_pages(size_t num);
 void *extend_brk(size_t size, size_t align);
 
 unsigned long init_memory_mapping(unsigned long start, unsigned long end);
+void zone_sizes_init(void);
+
+/* back the page structs of vmemmap [start, end), 2M pages where possible */
+int vmemmap_populate_hugepages(unsigned long start, unsigned long end);
 
 void mem_init(void);
 
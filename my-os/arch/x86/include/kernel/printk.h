@@ -15,6 +15,7 @@ void set_vga_base(void *addr);
 int printk(const char *fmt, ...);
 int vprintk(const char *fmt, va_list args);
 int vsprintf(char * buf, const char * fmt, va_list args);
+void panic(const char *fmt, ...) __attribute__((noreturn));
 void print_banner();
 
 
@@ -5,6 +5,7 @@
 #include <asm/page.h>
 #include <kernel/printk.h>
 #include <my-os/kernel.h>
+#include <my-os/preempt.h>
 
 struct irq_desc irq_desc[NR_IRQS] = {
     [0 ... NR_IRQS - 1] = {.handle_irq = handle_bad_irq}};
@@ -27,6 +28,10 @@ void init_IRQ(void) {
     for (int i = 0; i < NR_LEGACY_IRQS; i++) {
         vector_irq[0x20 + i] = irq_to_desc(i);
     }
+
+    vector_irq[LOCAL_TIMER_VECTOR] = irq_to_desc(LOCAL_TIMER_IRQ);
+    vector_irq[RESCHEDULE_VECTOR] = irq_to_desc(RESCHEDULE_IRQ);
+    vector_irq[CALL_FUNCTION_VECTOR] = irq_to_desc(CALL_FUNCTION_IRQ);
 }
 
 void setup_irq(int irq, struct irq_action *new) {
@@ -87,10 +92,12 @@ void do_IRQ(struct pt_regs *regs) {
     unsigned vector = ~regs->orig_ax;
 
     struct irq_desc *desc = vector_irq[vector];
+    irq_enter();
     if (desc) {
         desc->handle_irq(desc);
     } else {
         apic_eoi();
         printk("vector number %d no irq handler \n", vector);
     }
+    irq_exit();
 }
@@ -19,4 +19,15 @@ int vprintk(const char *fmt, va_list args) {
     return i;
 }
 
+/* nothing sensible is left to do, stop this cpu with interrupts off */
+void panic(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    printk("panic: ");
+    vprintk(fmt, args);
+    va_end(args);
+    for (;;)
+        asm volatile("cli; hlt");
+}
+
 extern void print_banner() { printk("my-os\n"); }
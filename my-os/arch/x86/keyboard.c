@@ -6,6 +6,7 @@
 
 #include <kernel/printk.h>
 #include <my-os/slub_alloc.h>
+#include <my-os/spinlock.h>
 #include <my-os/types.h>
 
 struct pt_regs;
@@ -173,17 +174,25 @@ struct keyboard_t {
     bool shift_l;
 } keyboard;
 
+/* the irq handler fills the ring, get_scancode() empties it */
+static DEFINE_SPINLOCK(keyboard_lock);
+
 bool is_keyboard_init = false;
 
 irqreturn_t do_keyboard(int irq, void *dev_id) {
     u8 x = inb(0x60);
 
     if (is_keyboard_init) {
-        if (keyboard.head == keyboard.buf + keyboard.buf_size) {
-            keyboard.head = keyboard.buf;
+        spin_lock(&keyboard_lock);
+        // drop the key if the ring is full
+        if (keyboard.count < keyboard.buf_size) {
+            if (keyboard.head == keyboard.buf + keyboard.buf_size) {
+                keyboard.head = keyboard.buf;
+            }
+            *keyboard.head++ = x;
+            ++keyboard.count;
         }
-        *keyboard.head++ = x;
-        ++keyboard.count;
+        spin_unlock(&keyboard_lock);
     }
     return IRQ_NONE;
 }
@@ -210,20 +219,23 @@ void keyboard_init(void) {
 }
 
 unsigned char get_scancode() {
-    if (!keyboard.count)
-        return 0;
+    unsigned long flags;
+    unsigned char ret = 0;
 
-    if (keyboard.tail == keyboard.buf + keyboard.buf_size) {
-        keyboard.tail = keyboard.buf;
+    spin_lock_irqsave(&keyboard_lock, flags);
+    if (keyboard.count) {
+        if (keyboard.tail == keyboard.buf + keyboard.buf_size) {
+            keyboard.tail = keyboard.buf;
+        }
+        ret = *keyboard.tail;
+        --keyboard.count;
+        ++keyboard.tail;
     }
-    unsigned char ret = *keyboard.tail;
-    --keyboard.count;
-    ++keyboard.tail;
+    spin_unlock_irqrestore(&keyboard_lock, flags);
     return ret;
 }
 
 int get_charcode(char *ch) {
-    /* irq_disable(); */
     int retval = 0;
     if (!ch) {
         retval = -1;
@@ -252,6 +264,5 @@ int get_charcode(char *ch) {
         goto ret;
     }
  ret:
-    /* irq_enable(); */
     return retval;
 }
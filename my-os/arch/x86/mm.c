@@ -1,4 +1,5 @@
 #include <asm/apic.h>
+#include <asm/multiboot2/api.h>
 #include <asm/pgtable.h>
 #include <asm/processor.h>
 #include <asm/sections.h>
@@ -11,6 +12,7 @@
 #include <my-os/log2.h>
 #include <my-os/memblock.h>
 #include <my-os/mm_types.h>
+#include <my-os/mmzone.h>
 #include <my-os/string.h>
 
 struct mm_struct init_mm = {.top_page = early_pml4t};
@@ -26,26 +28,45 @@ static unsigned long pgt_buf_top;
 #define __VMEMMAP_BASE_L4 0xffffea0000000000UL
 unsigned long vmemmap_base = __VMEMMAP_BASE_L4;
 
+/* set once the buddy hands out page table pages */
+static bool after_bootmem;
+
+/* NULL once the fixed .brk of the image is used up */
 void *extend_brk(size_t size, size_t align) {
     size_t mask = align - 1;
+    phys_addr_t start = (_brk_end + mask) & ~mask;
     void *ret;
 
-    _brk_end = (_brk_end + mask) & ~mask;
-
-    ret = (void *)_brk_end;
-    _brk_end += size;
+    if (start + size > (phys_addr_t)_brk_limit) {
+        printk("brk: %ld bytes wanted, %ld left\n", size,
+               (phys_addr_t)_brk_limit - start);
+        return NULL;
+    }
+    _brk_end = start + size;
 
+    ret = (void *)start;
     bzero(ret, size);
     return ret;
 }
 
+/* zeroed page table pages, NULL when there are none left */
 void *alloc_low_pages(size_t num) {
 
     unsigned long pfn;
 
+    if (after_bootmem) {
+        phys_addr_t addr = _alloc_pages(get_order(num * PTE_SIZE));
+        if (!addr)
+            return NULL;
+        bzero(__va(addr), num * PTE_SIZE);
+        return __va(addr);
+    }
+
     if ((pgt_buf_end + num) > pgt_buf_top) {
-        phys_addr_t brk = __pa(extend_brk(PTE_SIZE * num, PTE_SIZE));
-        pfn = brk >> PTE_SHIFT;
+        void *brk = extend_brk(PTE_SIZE * num, PTE_SIZE);
+        if (!brk)
+            return NULL;
+        pfn = __pa(brk) >> PTE_SHIFT;
     } else {
         pfn = pgt_buf_end;
         pgt_buf_end += num;
@@ -74,6 +95,24 @@ void early_alloc_pgt_buf(void) {
     pgt_buf_top = pgt_buf_start + (tables >> PTE_SHIFT);
 }
 
+/* pages mapped in the direct map at each level and the tables behind them */
+static unsigned long direct_pages_count[PG_LEVEL_NUM];
+static unsigned long direct_pgt_pages;
+
+static void *alloc_pgt_page(void) {
+    void *page = alloc_low_pages(1);
+
+    if (page)
+        direct_pgt_pages++;
+    return page;
+}
+
+/* a walker below stopped short of its part of [paddr, paddr_end) */
+static bool mapped_short(phys_addr_t paddr_last, phys_addr_t paddr_next,
+                         phys_addr_t paddr_end) {
+    return paddr_last < min(paddr_next, paddr_end);
+}
+
 static void set_pte(pte_t *pte, pte_t value) { *pte = value; }
 
 static void set_pte_init(pte_t *pde, phys_addr_t addr) {
@@ -83,26 +122,28 @@ static void set_pte_init(pte_t *pde, phys_addr_t addr) {
 static phys_addr_t phys_pt_init(pte_t *pte_page, phys_addr_t paddr_start,
                                 phys_addr_t paddr_end) {
     unsigned long paddr_last = paddr_end;
-    unsigned long paddr_next = paddr_start;
+    unsigned long paddr_next;
+    unsigned long paddr = paddr_start;
     int i = pte_index((unsigned long)__va(paddr_start));
 
     pte_t *pte;
 
-    for (; i < PTRS_PER_PDE; i++) {
+    for (; i < PTRS_PER_PTE; i++, paddr = paddr_next) {
         pte = pte_page + i;
 
-        if (paddr_next >= paddr_end) {
+        if (paddr >= paddr_end) {
             break;
         }
 
+        paddr_next = (paddr & PTE_MASK) + PTE_SIZE;
+        paddr_last = paddr_next;
+
         if (*pte) {
             continue;
         }
 
-        set_pte_init(pte, paddr_next);
-        paddr_last = (paddr_next & PTE_MASK) + PTE_SIZE;
-
-        paddr_next = paddr_last;
+        set_pte_init(pte, paddr & PTE_MASK);
+        direct_pages_count[PG_LEVEL_4K]++;
     }
     return paddr_last;
 }
@@ -117,7 +158,7 @@ static phys_addr_t phys_pdt_init(pde_t *pde_page, phys_addr_t paddr_start,
                                  phys_addr_t paddr_end,
                                  unsigned long page_size_mask) {
     unsigned long paddr_last = paddr_end;
-    unsigned long paddr_next = paddr_start;
+    unsigned long paddr_next;
     unsigned long paddr = paddr_start;
     int i = pde_index((unsigned long)__va(paddr_start));
 
@@ -127,32 +168,34 @@ static phys_addr_t phys_pdt_init(pde_t *pde_page, phys_addr_t paddr_start,
         pde = pde_page + i;
         pte_t *pte;
 
-        if (paddr_next >= paddr_end) {
+        if (paddr >= paddr_end) {
             break;
         }
 
-        paddr_next = (paddr_next & PDE_MASK) + PDE_SIZE;
+        paddr_next = (paddr & PDE_MASK) + PDE_SIZE;
 
         if (*pde) {
             if (!(*pde & _PAGE_PSE)) {
                 pte = (pte_t *)pde_page_vaddr(*pde);
-                phys_pt_init(pte, paddr_start, paddr_end);
+                paddr_last = phys_pt_init(pte, paddr, paddr_end);
                 continue;
             }
 
-            if (page_size_mask & (1 << PG_LEVEL_2M)) {
-                paddr_last = paddr_next;
-                continue;
-            }
+            /* a large page covers the range already, never split it */
+            paddr_last = paddr_next;
+            continue;
         }
 
         if (page_size_mask & (1 << PG_LEVEL_2M)) {
             pte_t pte = ((paddr & PDE_MASK) | _PAGE_PSE | _PAGE_KERNEL);
             set_pde(pde, pte);
+            direct_pages_count[PG_LEVEL_2M]++;
             paddr_last = paddr_next;
         } else {
-            pte = alloc_low_pages(1);
-            paddr_last = phys_pt_init(pte, paddr_start, paddr_end);
+            pte = alloc_pgt_page();
+            if (!pte)
+                return paddr;
+            paddr_last = phys_pt_init(pte, paddr, paddr_end);
             set_pde_init(pde, pte);
         }
     }
@@ -169,7 +212,7 @@ static phys_addr_t phys_pdpt_init(pdpte_t *pdpte_page, phys_addr_t paddr_start,
                                   phys_addr_t paddr_end,
                                   unsigned long page_size_mask) {
     unsigned long paddr_last = paddr_end;
-    unsigned long paddr_next = paddr_start;
+    unsigned long paddr_next;
     unsigned long paddr = paddr_start;
     int i = pdpte_index((unsigned long)__va(paddr_start));
     pdpte_t *pdpte;
@@ -178,34 +221,39 @@ static phys_addr_t phys_pdpt_init(pdpte_t *pdpte_page, phys_addr_t paddr_start,
         pdpte = pdpte_page + i;
         pde_t *pde = NULL;
 
-        if (paddr_next >= paddr_end) {
+        if (paddr >= paddr_end) {
             break;
         }
 
-        paddr_next = (paddr_next & PDPTE_MASK) + PDPTE_SIZE;
+        paddr_next = (paddr & PDPTE_MASK) + PDPTE_SIZE;
 
         if (*pdpte) {
             if (!(*pdpte & _PAGE_PSE)) {
                 pde = (pde_t *)pdpte_page_vaddr(*pdpte);
-                phys_pdt_init(pde, paddr_start, paddr_end, page_size_mask);
+                paddr_last =
+                    phys_pdt_init(pde, paddr, paddr_end, page_size_mask);
+                if (mapped_short(paddr_last, paddr_next, paddr_end))
+                    return paddr_last;
                 continue;
             }
 
-            if (page_size_mask & (1 << PG_LEVEL_1G)) {
-                paddr_last = paddr_next;
-                continue;
-            }
+            paddr_last = paddr_next;
+            continue;
         }
 
         if (page_size_mask & (1 << PG_LEVEL_1G)) {
             pde_t pde = ((paddr & PDPTE_MASK) | _PAGE_PSE | _PAGE_KERNEL);
             set_pdpte(pdpte, pde);
+            direct_pages_count[PG_LEVEL_1G]++;
             paddr_last = paddr_next;
         } else {
-            pde = alloc_low_pages(1);
-            paddr_last =
-                phys_pdt_init(pde, paddr_start, paddr_end, page_size_mask);
+            pde = alloc_pgt_page();
+            if (!pde)
+                return paddr;
+            paddr_last = phys_pdt_init(pde, paddr, paddr_end, page_size_mask);
             set_pdpte_init(pdpte, pde);
+            if (mapped_short(paddr_last, paddr_next, paddr_end))
+                return paddr_last;
         }
     }
 
@@ -218,33 +266,43 @@ static void set_pml4e_init(pml4e_t *pml4e, pdpte_t *pdpte) {
     set_pml4e(pml4e, (__pa(pdpte) | _PAGE_RW | _PAGE_PRESENT));
 }
 
+/*
+ * The walkers only fill entries that were not present and never split or
+ * rewrite one, and x86 caches no not-present translation, so no cpu needs
+ * a flush. Whatever clears or changes a present entry has to send it
+ * through tlb_batch_add() and tlb_batch_flush().
+ */
 phys_addr_t kernel_physical_mapping_init(phys_addr_t paddr_start,
                                          phys_addr_t paddr_end,
                                          unsigned long page_size_mask) {
 
-    unsigned long paddr_last;
-    unsigned long paddr_next = paddr_start;
+    unsigned long paddr_last = paddr_end;
+    unsigned long paddr_next;
+    unsigned long paddr = paddr_start;
     int i = pml4e_index((unsigned long)__va(paddr_start));
     pml4e_t *pml4e;
 
-    for (; paddr_next < paddr_end; i++) {
+    for (; paddr < paddr_end; i++, paddr = paddr_next) {
         pml4e = init_mm.top_page + i;
         pdpte_t *pdpte;
-        paddr_next = (paddr_next & PML4E_MASK) + PML4E_SIZE;
+        paddr_next = (paddr & PML4E_MASK) + PML4E_SIZE;
 
         if (*pml4e) {
             pdpte = (pdpte_t *)pml4e_page_vaddr(*pml4e);
             paddr_last =
-                phys_pdpt_init(pdpte, paddr_start, paddr_end, page_size_mask);
+                phys_pdpt_init(pdpte, paddr, paddr_end, page_size_mask);
+            if (mapped_short(paddr_last, paddr_next, paddr_end))
+                return paddr_last;
             continue;
         }
-        pdpte = alloc_low_pages(1);
-        paddr_last =
-            phys_pdpt_init(pdpte, paddr_start, paddr_end, page_size_mask);
+        pdpte = alloc_pgt_page();
+        if (!pdpte)
+            return paddr;
+        paddr_last = phys_pdpt_init(pdpte, paddr, paddr_end, page_size_mask);
 
         set_pml4e_init(pml4e, pdpte);
-
-        pml4e++;
+        if (mapped_short(paddr_last, paddr_next, paddr_end))
+            return paddr_last;
     }
 
     return paddr_last;
@@ -262,6 +320,19 @@ struct map_range {
 
 static int page_size_mask;
 
+#define X86_FEATURE_GBPAGES_BIT 26
+
+/*
+ * Long mode always has 2M pages, 1G pages are optional and announced by
+ * pdpe1gb in cpuid 0x80000001 edx.
+ */
+static void probe_page_size_mask(void) {
+    page_size_mask = 1 << PG_LEVEL_2M;
+
+    if (cpuid_edx(0x80000001) & (1 << X86_FEATURE_GBPAGES_BIT))
+        page_size_mask |= 1 << PG_LEVEL_1G;
+}
+
 static int save_mr(struct map_range *mr, int nr_range, unsigned long start_pfn,
                    unsigned long end_pfn, unsigned long page_size_mask) {
     if (start_pfn < end_pfn) {
@@ -367,6 +438,10 @@ static int split_mem_range(struct map_range *mr, int nr_range,
     return nr_range;
 }
 
+/*
+ * Returns the pfn the mapping reaches, short of @end when the page table
+ * pages ran out.
+ */
 unsigned long init_memory_mapping(unsigned long start, unsigned long end) {
     struct map_range mr[NR_RANGE_MR];
     unsigned long ret = 0;
@@ -378,11 +453,15 @@ unsigned long init_memory_mapping(unsigned long start, unsigned long end) {
     nr_range = split_mem_range(mr, 0, start, end);
 
     for (i = 0; i < nr_range; i++) {
-        mr[i].page_size_mask = 1 << PG_LEVEL_2M;
         printk("map range: start = %#x, end = %#x, mask = %#x\n", mr[i].start,
                mr[i].end, mr[i].page_size_mask);
         ret = kernel_physical_mapping_init(mr[i].start, mr[i].end,
                                            mr[i].page_size_mask);
+        if (ret < mr[i].end) {
+            printk("init_memory_mapping: out of page table pages at %#x\n",
+                   ret);
+            break;
+        }
     }
 
     /* add_pfn_range_mapped(start >> PAGE_SHIFT, ret >> PAGE_SHIFT); */
@@ -390,7 +469,36 @@ unsigned long init_memory_mapping(unsigned long start, unsigned long end) {
     return ret >> PTE_SHIFT;
 }
 
+static void print_direct_map(void) {
+    printk("DirectMap4k: %ld kB, DirectMap2M: %ld kB, DirectMap1G: %ld kB, "
+           "%ld page table pages\n",
+           direct_pages_count[PG_LEVEL_4K] << (PTE_SHIFT - 10),
+           direct_pages_count[PG_LEVEL_2M] << (PDE_SHIFT - 10),
+           direct_pages_count[PG_LEVEL_1G] << (PDPTE_SHIFT - 10),
+           direct_pgt_pages);
+}
+
+unsigned long max_zone_pfn[MAX_NR_ZONES];
+
+/*
+ * ISA dma reaches 16M, 32-bit bus masters the ram below 4G. Normal is
+ * left open at the top, hot-added memory lands there.
+ */
+void zone_sizes_init(void) {
+    max_zone_pfn[ZONE_DMA] = min(MAX_DMA_PFN, end_pfn);
+    max_zone_pfn[ZONE_DMA32] =
+        max(min(multiboot2_end_of_low_ram_pfn(), MAX_DMA32_PFN),
+            max_zone_pfn[ZONE_DMA]);
+    max_zone_pfn[ZONE_NORMAL] = end_pfn;
+
+    printk("zones: DMA < pfn %#x, DMA32 < pfn %#x, Normal < pfn %#x\n",
+           max_zone_pfn[ZONE_DMA], max_zone_pfn[ZONE_DMA32],
+           max_zone_pfn[ZONE_NORMAL]);
+}
+
 void init_mem_mapping(void) {
+    probe_page_size_mask();
+
     init_memory_mapping(0, 0x100000);
 
     // fix mem io apic
@@ -402,6 +510,8 @@ void init_mem_mapping(void) {
 
     memblock_mem_mapping();
     write_cr3(__pa(init_mm.top_page));
+
+    print_direct_map();
 }
 
 void *vmemmap_alloc_block(size_t size) {
@@ -410,7 +520,9 @@ void *vmemmap_alloc_block(size_t size) {
         return NULL;
     }
     void *vaddr = __va(addr);
-    memset(vaddr, 0, size);
+    size_t alloc_size = PAGE_SIZE << get_order(size);
+    for (size_t off = 0; off < alloc_size; off += PAGE_SIZE)
+        clear_page(vaddr + off);
     return vaddr;
 }
 
@@ -463,7 +575,7 @@ pte_t *vmemmap_ptd_populate(pde_t *pde, unsigned long addr) {
 }
 
 int vmemmap_populate_basepages(unsigned long start, unsigned long end) {
-    unsigned long addr = start;
+    unsigned long addr = round_down(start, PAGE_SIZE);
     pml4e_t *pml4d;
     pdpte_t *pdptd;
     pde_t *pded;
@@ -496,16 +608,59 @@ int vmemmap_populate_basepages(unsigned long start, unsigned long end) {
     return 0;
 }
 
-void init_mapping_mempage(phys_addr_t start, phys_addr_t end) {
-    struct page *start_page = pfn_to_page(start >> PAGE_SHIFT);
-    struct page *end_page = pfn_to_page(end >> PAGE_SHIFT);
-    printk("vmemmap %p-%p\n", start_page, end_page);
+/*
+ * Back each 2M of the struct page array with one order-9 block behind a
+ * pse pde. Partial 2M at the edges, and any 2M the buddy can not supply,
+ * fall back to basepages.
+ */
+int vmemmap_populate_hugepages(unsigned long start, unsigned long end) {
+    unsigned long addr = start;
+    unsigned long next;
+    unsigned long huge = 0, base = 0;
+    pml4e_t *pml4d;
+    pdpte_t *pdptd;
+    pde_t *pded;
 
-    vmemmap_populate_basepages((unsigned long)start_page,
-                               (unsigned long)end_page);
+    for (; addr < end; addr = next) {
+        next = (addr & PDE_MASK) + PDE_SIZE;
+        if (next > end)
+            next = end;
+
+        pml4d = vmemmap_pml4d_populate(addr);
+        if (!pml4d) {
+            return -1;
+        }
+        pdptd = vmemmap_pdptd_populate(pml4d, addr);
+        if (!pdptd) {
+            return -1;
+        }
+        pded = pde_offset(pdptd, addr);
+        if (*pded & _PAGE_PSE) {
+            continue;
+        }
+
+        if (!*pded && !(addr & ~PDE_MASK) && !(next & ~PDE_MASK)) {
+            void *p = vmemmap_alloc_block(PDE_SIZE);
+            if (p) {
+                set_pde(pded, __pa(p) | _PAGE_PSE | _PAGE_KERNEL);
+                huge++;
+                continue;
+            }
+        }
+
+        if (vmemmap_populate_basepages(addr, next)) {
+            return -1;
+        }
+        base += (round_up(next, PAGE_SIZE) - round_down(addr, PAGE_SIZE)) >>
+                PAGE_SHIFT;
+    }
+    printk("vmemmap: %ld 2M pages, %ld 4k pages\n", huge, base);
+    return 0;
 }
 
 void mem_init() {
+    /* the brk is fixed, later mappings take their tables from the buddy */
+    after_bootmem = true;
 
     init_mm.start_code = (unsigned long)_text;
     init_mm.end_code = (unsigned long)_etext;
@@ -513,5 +668,5 @@ void mem_init() {
     init_mm.end_data = (unsigned long)_edata;
     init_mm.start_brk = (unsigned long)_brk_base;
 
-    init_mapping_mempage((phys_addr_t)KERNEL_LMA_END, end_pfn << PAGE_SHIFT);
+    sparse_init();
 }
@@ -0,0 +1,132 @@
+#include <asm/acpi.h>
+#include <asm/numa.h>
+#include <asm/page_types.h>
+#include <asm/smp.h>
+
+#include <kernel/printk.h>
+
+#include <my-os/kernel.h>
+#include <my-os/mmzone.h>
+#include <my-os/string.h>
+
+struct numa_memblk {
+    u64 start;
+    u64 end;
+    int nid;
+};
+
+#define NR_NODE_MEMBLKS (MAX_NUMNODES * 2)
+
+static struct numa_memblk numa_memblks[NR_NODE_MEMBLKS];
+static int nr_numa_memblks;
+
+static u8 numa_distance[MAX_NUMNODES][MAX_NUMNODES];
+
+/* apic ids may be sparse, so the srat cpu entries are kept as pairs */
+static struct {
+    u32 apicid;
+    int nid;
+} apicid_nodes[NR_CPUS];
+static int nr_apicid_nodes;
+
+struct pglist_data node_data[MAX_NUMNODES];
+u64 node_online_mask;
+
+DEFINE_PER_CPU(int, numa_node);
+
+int numa_add_memblk(int nid, u64 start, u64 end) {
+    if (nid < 0 || nid >= MAX_NUMNODES || start >= end)
+        return -1;
+    if (nr_numa_memblks >= NR_NODE_MEMBLKS) {
+        printk("numa: too many memory ranges, [mem %#x-%#x] ignored\n", start,
+               end - 1);
+        return -1;
+    }
+    numa_memblks[nr_numa_memblks++] = (struct numa_memblk){start, end, nid};
+    return 0;
+}
+
+void numa_set_distance(int from, int to, int distance) {
+    if (from < 0 || from >= MAX_NUMNODES || to < 0 || to >= MAX_NUMNODES)
+        return;
+    /* below LOCAL_DISTANCE is reserved, only a node to itself is local */
+    if (distance < LOCAL_DISTANCE || distance > 0xff ||
+        (from == to) != (distance == LOCAL_DISTANCE))
+        return;
+    numa_distance[from][to] = distance;
+}
+
+void set_apicid_to_node(u32 apicid, int nid) {
+    if (nr_apicid_nodes == NR_CPUS) {
+        printk("numa: apic id %u beyond %d cpus, ignored\n", apicid, NR_CPUS);
+        return;
+    }
+    apicid_nodes[nr_apicid_nodes].apicid = apicid;
+    apicid_nodes[nr_apicid_nodes].nid = nid;
+    nr_apicid_nodes++;
+}
+
+int node_distance(int from, int to) {
+    if (numa_distance[from][to])
+        return numa_distance[from][to];
+    return from == to ? LOCAL_DISTANCE : REMOTE_DISTANCE;
+}
+
+/* cpus the srat misses go to the first node */
+int cpu_to_node(int cpu) {
+    for (int i = 0; i < nr_apicid_nodes; i++) {
+        if (apicid_nodes[i].apicid == cpu_physical_id(cpu) &&
+            apicid_nodes[i].nid != NUMA_NO_NODE)
+            return apicid_nodes[i].nid;
+    }
+    return numa_memblks[0].nid;
+}
+
+int phys_to_nid(phys_addr_t addr, phys_addr_t *end) {
+    phys_addr_t next = -1;
+
+    for (int i = 0; i < nr_numa_memblks; i++) {
+        struct numa_memblk *mb = &numa_memblks[i];
+        if (addr >= mb->start && addr < mb->end) {
+            *end = mb->end;
+            return mb->nid;
+        }
+        if (mb->start > addr)
+            next = min(next, (phys_addr_t)mb->start);
+    }
+    /* memory the srat does not describe goes to the first node */
+    *end = next;
+    return numa_memblks[0].nid;
+}
+
+static void numa_reset(void) {
+    nr_numa_memblks = 0;
+    node_online_mask = 0;
+    memset(numa_distance, 0, sizeof(numa_distance));
+    nr_apicid_nodes = 0;
+}
+
+void numa_init(void) {
+    numa_reset();
+    if (acpi_numa_init() || !nr_numa_memblks) {
+        printk("numa: no srat, faking a single node\n");
+        numa_reset();
+        numa_add_memblk(0, 0, MAXMEM);
+    }
+
+    for (int i = 0; i < nr_numa_memblks; i++) {
+        struct numa_memblk *mb = &numa_memblks[i];
+        set_node_online(mb->nid);
+        printk("numa: node %d [mem %#x-%#x]\n", mb->nid, mb->start,
+               mb->end - 1);
+    }
+
+    int from, to;
+    for_each_online_node(from) {
+        printk("numa: node %d distances:", from);
+        for_each_online_node(to) {
+            printk(" %d", node_distance(from, to));
+        }
+        printk("\n");
+    }
+}
@@ -1,10 +1,15 @@
 #include <asm/apic.h>
+#include <asm/idt.h>
+#include <asm/irq.h>
+#include <asm/io.h>
 #include <asm/msr.h>
 #include <asm/page.h>
 #include <asm/processor.h>
 #include <asm/smp.h>
 
 #include <kernel/printk.h>
+#include <my-os/numa.h>
+#include <my-os/percpu.h>
 #include <my-os/slub_alloc.h>
 #include <my-os/string.h>
 #include <my-os/task.h>
@@ -15,13 +20,156 @@ extern char smp_boot_end[];
 
 #define SMP_BOOT_BASE 0x9f000
 
+/* ms to wait for an ap to come online after its startup ipi */
+#define SMP_BOOT_TIMEOUT 1000
+
+u64 cpu_online_mask;
+u64 cpu_present_mask;
+
+u32 x86_cpu_to_apicid[NR_CPUS];
+static int nr_cpu_ids = 1;
+
 struct real_mode_data {
     u32 text_start;
     u32 pgd;
 };
 
 extern struct real_mode_data real_mode_data;
-void smp_boot();
+
+extern phys_addr_t initial_stack;
+extern phys_addr_t initial_code;
+
+void fpu_init();
+
+/* idle task and cpu of the ap being booted, handed over to start_secondary */
+static struct task_struct *volatile smp_boot_idle;
+static volatile int smp_boot_cpu;
+
+static void udelay(unsigned long us) {
+    while (us--)
+        io_delay();
+}
+
+static void mdelay(unsigned long ms) { udelay(ms * 1000); }
+
+static void start_secondary(void) {
+    struct task_struct *idle = smp_boot_idle;
+    int cpu = smp_boot_cpu;
+
+    /* first, smp_processor_id() and current come from the per-cpu area */
+    load_percpu_segment(cpu);
+    local_apic_setup();
+
+    load_current_idt();
+    fpu_init();
+
+    init_idle(idle, cpu);
+    local_apic_timer_setup();
+
+    set_cpu_online(cpu, true);
+    printk("cpu %d online\n", cpu);
+
+    irq_enable();
+    cpu_idle();
+}
+
+static struct task_struct *smp_alloc_idle(void) {
+    struct task_struct *idle = kmalloc(sizeof(union thread_union), SLUB_NONE);
+    if (!idle)
+        return NULL;
+
+    bzero(idle, sizeof(struct task_struct));
+    idle->mm = &init_mm;
+    idle->name = "idle";
+    idle->se.weight = nice(0);
+    list_add(&idle->tasks, &init_task->tasks);
+    return idle;
+}
+
+/* the apic id of the calling cpu from cpuid, the apic need not be set up */
+static u32 cpuid_apic_id(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (cpuid_eax(0) >= 0xb) {
+        cpuid_count(0xb, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx)
+            return edx;
+    }
+    return cpuid_ebx(1) >> 24;
+}
+
+/* the cpu we booted on is cpu 0, whatever its apic id */
+void smp_prepare_boot_cpu(void) {
+    x86_cpu_to_apicid[0] = cpuid_apic_id();
+    set_cpu_present(0, true);
+}
+
+/*
+ * Give the cpu with @apicid the next logical number and mark it present.
+ * The boot cpu and ids seen before keep theirs. -1 once NR_CPUS are in
+ * use.
+ */
+int smp_register_cpu(u32 apicid) {
+    int cpu;
+
+    for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+        if (x86_cpu_to_apicid[cpu] == apicid)
+            return cpu;
+    }
+    if (nr_cpu_ids == NR_CPUS) {
+        printk("smp: no cpu number left for apic id %u, not booted\n",
+               apicid);
+        return -1;
+    }
+
+    cpu = nr_cpu_ids++;
+    x86_cpu_to_apicid[cpu] = apicid;
+    per_cpu(numa_node, cpu) = cpu_to_node(cpu);
+    set_cpu_present(cpu, true);
+    return cpu;
+}
+
+static int do_boot_cpu(int cpu) {
+    u32 apicid = cpu_physical_id(cpu);
+    struct task_struct *idle = smp_alloc_idle();
+    if (!idle) {
+        printk("smp: no idle task for cpu %d\n", cpu);
+        return -1;
+    }
+
+    smp_boot_idle = idle;
+    smp_boot_cpu = cpu;
+    initial_stack = task_top_of_stack(idle);
+    initial_code = (phys_addr_t)start_secondary;
+
+    apic_send_ipi(apicid, APIC_ICR_DM_INIT | APIC_ICR_LEVEL_ASSERT);
+    mdelay(10);
+
+    for (int i = 0; i < 2; i++) {
+        apic_send_ipi(apicid, APIC_ICR_DM_STARTUP | APIC_ICR_LEVEL_ASSERT |
+                                  (SMP_BOOT_BASE >> PAGE_SHIFT));
+        udelay(200);
+    }
+
+    for (int i = 0; i < SMP_BOOT_TIMEOUT && !cpu_online(cpu); i++)
+        mdelay(1);
+
+    if (!cpu_online(cpu)) {
+        printk("smp: cpu %d (apic id %u) not responding\n", cpu, apicid);
+        return -1;
+    }
+    return 0;
+}
+
+void smp_send_reschedule(int cpu) {
+    apic_send_ipi(cpu_physical_id(cpu), APIC_ICR_DM_FIXED | RESCHEDULE_VECTOR);
+}
+
+void arch_send_call_function_ipi(int cpu) {
+    apic_send_ipi(cpu_physical_id(cpu),
+                  APIC_ICR_DM_FIXED | CALL_FUNCTION_VECTOR);
+}
+
 void smp_init(void) {
     unsigned int eax, ebx, ecx, edx;
     int count = 0;
@@ -50,39 +198,23 @@ void smp_init(void) {
     // TODO: assert init_mm.top_page < 32bit
     // 临时设置 低地址映射
     init_mm.top_page[0] = ((pml4e_t *)__va(early_pml4t))[0];
-    
+
     printk("top page %p\n", init_mm.top_page);
 
     real_mode_data.text_start = SMP_BOOT_BASE;
-    real_mode_data.pgd = (phys_addr_t)init_mm.top_page;
+    real_mode_data.pgd = __pa(init_mm.top_page);
 
     void *smp_boot_base = __va(real_mode_data.text_start);
     memcpy(smp_boot_base, smp_boot_start, code_size);
 
-#define ICR_OFFSET 0x300
-    u32 *icr = __va(LAPIC_DEFAULT_BASE + ICR_OFFSET);
-    printk("icr addr %p\n", icr);
-
-    union thread_union *ap_thread_union =
-        kmalloc(sizeof(union thread_union), SLUB_NONE);
-    if (!ap_thread_union) {
-
-        return;
+    /* the boot stub and entry are shared, so bring the aps up one by one */
+    int boot_cpu = smp_processor_id();
+    int cpu;
+    for_each_present_cpu(cpu) {
+        if (cpu == boot_cpu)
+            continue;
+        do_boot_cpu(cpu);
     }
-    extern phys_addr_t initial_stack;
-    extern phys_addr_t initial_code;
-    printk("stack %p, code %p\n", initial_stack, initial_code);
-    initial_stack = (phys_addr_t)ap_thread_union + THREAD_SIZE;
-    initial_code = (phys_addr_t)smp_boot;
-    printk("stack %p, code %p\n", initial_stack, initial_code);
-
-    printk("smp boot start ...\n");
-    *icr = 0xc4500;
-    *icr = 0xc469f;
-    *icr = 0xc469f;
-}
 
-void smp_boot() {
-    for (;;)
-        ;
+    printk("smp: online cpus %#lx\n", cpu_online_mask);
 }
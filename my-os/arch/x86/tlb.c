@@ -0,0 +1,93 @@
+#include <asm/irq.h>
+#include <asm/tlbflush.h>
+
+#include <kernel/printk.h>
+#include <my-os/kernel.h>
+#include <my-os/percpu.h>
+#include <my-os/smp.h>
+
+/* above this many pages one cr3 reload is cheaper than an invlpg each */
+static unsigned long tlb_single_page_flush_ceiling = 33;
+
+struct flush_tlb_info {
+    struct mm_struct *mm;
+    unsigned long start, end;
+};
+
+static DEFINE_PER_CPU(u64, tlb_shootdowns);
+static DEFINE_PER_CPU(u64, tlb_page_flushes);
+static DEFINE_PER_CPU(u64, tlb_full_flushes);
+
+/* runs on every cpu the flush goes to, interrupts disabled */
+static void flush_tlb_func(void *data) {
+    struct flush_tlb_info *info = data;
+
+    if (info->end == TLB_FLUSH_ALL ||
+        (info->end - info->start) >> PAGE_SHIFT >
+            tlb_single_page_flush_ceiling) {
+        __flush_tlb_local();
+        this_cpu_inc(tlb_full_flushes);
+        return;
+    }
+
+    for (unsigned long addr = info->start; addr < info->end;
+         addr += PAGE_SIZE)
+        __flush_tlb_one(addr);
+    this_cpu_add(tlb_page_flushes, (info->end - info->start) >> PAGE_SHIFT);
+}
+
+/*
+ * Flush [@start, @end) of @mm here and on every other cpu, waiting for
+ * them. Every task runs on init_mm for now, so all online cpus may
+ * cache its entries; a per-mm cpu mask can narrow this once address
+ * spaces are switched.
+ */
+void flush_tlb_mm_range(struct mm_struct *mm, unsigned long start,
+                        unsigned long end) {
+    struct flush_tlb_info info = {
+        .mm = mm,
+        .start = start & PAGE_MASK,
+        .end = end == TLB_FLUSH_ALL ? end : ALIGN(end, PAGE_SIZE),
+    };
+
+    this_cpu_inc(tlb_shootdowns);
+    /* the local flush and the shootdown without a migration in between */
+    on_each_cpu(flush_tlb_func, &info, true);
+}
+
+void flush_tlb_kernel_range(unsigned long start, unsigned long end) {
+    flush_tlb_mm_range(&init_mm, start, end);
+}
+
+void flush_tlb_all(void) {
+    flush_tlb_mm_range(&init_mm, 0, TLB_FLUSH_ALL);
+}
+
+void tlb_batch_add(struct tlb_batch *batch, struct mm_struct *mm,
+                   unsigned long start, unsigned long end) {
+    if (batch->mm && batch->mm != mm)
+        tlb_batch_flush(batch);
+
+    batch->mm = mm;
+    batch->start = min(batch->start, start);
+    batch->end = max(batch->end, end);
+}
+
+void tlb_batch_flush(struct tlb_batch *batch) {
+    if (!batch->mm)
+        return;
+
+    flush_tlb_mm_range(batch->mm, batch->start, batch->end);
+    *batch = (struct tlb_batch)TLB_BATCH_INIT;
+}
+
+void print_tlb_stats(void) {
+    int cpu;
+
+    for_each_online_cpu(cpu) {
+        printk("tlb cpu%d: %ld shootdowns sent, %ld pages flushed, %ld full "
+               "flushes\n",
+               cpu, per_cpu(tlb_shootdowns, cpu), per_cpu(tlb_page_flushes, cpu),
+               per_cpu(tlb_full_flushes, cpu));
+    }
+}
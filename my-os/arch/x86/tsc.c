@@ -0,0 +1,117 @@
+#include <asm/hpet.h>
+#include <asm/msr.h>
+#include <asm/processor.h>
+#include <asm/tsc.h>
+
+#include <kernel/printk.h>
+#include <my-os/clocksource.h>
+#include <my-os/compiler.h>
+#include <my-os/spinlock.h>
+#include <my-os/tick.h>
+
+#define CPUID_FEAT_EDX_TSC 4
+#define CPUID_APM_EDX_INVARIANT_TSC 8
+
+/* hpet ticks to measure the tsc over, 10 ms at the usual 14.318 MHz */
+#define TSC_CAL_HPET_CYCLES 143182
+#define TSC_CAL_ROUNDS 3
+/* retries to get a tsc/hpet pair not split by an smi or irq */
+#define TSC_REF_RETRIES 5
+
+u64 tsc_khz;
+
+/* sched_clock() = tsc * cyc2ns_mult + cyc2ns_offset, 0 mult until calibrated */
+static u64 cyc2ns_mult;
+static u64 cyc2ns_offset;
+
+u64 sched_clock(void) {
+    if (!cyc2ns_mult)
+        return jiffies_64 * TICK_NSEC;
+    return mul_frac32(rdtsc(), cyc2ns_mult) + cyc2ns_offset;
+}
+
+/*
+ * Read the hpet counter between two tsc reads and keep the tightest of a
+ * few tries, the tsc value is the middle of the window.
+ */
+static u64 tsc_read_hpet_ref(u64 *hpet) {
+    u64 best = ~0ULL, tsc = 0;
+
+    for (int i = 0; i < TSC_REF_RETRIES; i++) {
+        u64 t1 = rdtsc_ordered();
+        u64 h = hpet_read_main_counter();
+        u64 t2 = rdtsc_ordered();
+
+        if (t2 - t1 < best) {
+            best = t2 - t1;
+            tsc = t1 + (t2 - t1) / 2;
+            *hpet = h;
+        }
+    }
+    return tsc;
+}
+
+/* one pass over TSC_CAL_HPET_CYCLES, in tsc Hz */
+static u64 tsc_calibrate_hpet(u64 hpet_freq) {
+    u64 h1, h2;
+    u64 t1 = tsc_read_hpet_ref(&h1);
+
+    /* u32 differences, the counter may be 32 bits wide */
+    while ((u32)(hpet_read_main_counter() - h1) < TSC_CAL_HPET_CYCLES)
+        cpu_relax();
+
+    u64 t2 = tsc_read_hpet_ref(&h2);
+    return (t2 - t1) * hpet_freq / (u32)(h2 - h1);
+}
+
+static u64 tsc_read(struct clocksource *cs __always_unused) {
+    return rdtsc_ordered();
+}
+
+static struct clocksource tsc_clocksource = {
+    .name = "tsc",
+    .read = tsc_read,
+    .mask = ~0ULL,
+    .rating = 300,
+};
+
+/*
+ * Calibrate the tsc against the hpet main counter. sched_clock() uses it
+ * from then on; it replaces the hpet as clocksource if it is invariant.
+ */
+void tsc_init(void) {
+    u64 hpet_freq = hpet_frequency();
+    u64 f[TSC_CAL_ROUNDS];
+
+    if (!(cpuid_edx(1) & 1 << CPUID_FEAT_EDX_TSC)) {
+        printk("tsc: not available\n");
+        return;
+    }
+    if (!hpet_freq) {
+        printk("tsc: no hpet to calibrate against\n");
+        return;
+    }
+
+    /* an irq inside a pass only makes it longer, keep the median pass */
+    for (int i = 0; i < TSC_CAL_ROUNDS; i++) {
+        u64 v = tsc_calibrate_hpet(hpet_freq);
+        int j = i;
+        for (; j > 0 && f[j - 1] > v; j--)
+            f[j] = f[j - 1];
+        f[j] = v;
+    }
+    u64 freq = f[TSC_CAL_ROUNDS / 2];
+
+    tsc_khz = freq / 1000;
+    printk("tsc: %ld.%03ld MHz\n", tsc_khz / 1000, tsc_khz % 1000);
+
+    u64 mult = div_frac32(NSEC_PER_SEC, freq);
+    cyc2ns_offset = sched_clock() - mul_frac32(rdtsc(), mult);
+    cyc2ns_mult = mult;
+
+    if (cpuid_eax(0x80000000) >= 0x80000007 &&
+        cpuid_edx(0x80000007) & 1 << CPUID_APM_EDX_INVARIANT_TSC)
+        clocksource_register_hz(&tsc_clocksource, freq);
+    else
+        printk("tsc: not invariant, kept for sched_clock only\n");
+}
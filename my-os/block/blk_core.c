@@ -0,0 +1,287 @@
+#include <asm/irq.h>
+#include <kernel/printk.h>
+
+#include <my-os/blkdev.h>
+#include <my-os/completion.h>
+#include <my-os/slub_alloc.h>
+#include <my-os/string.h>
+
+static LIST_HEAD(blk_devices);
+
+void blk_init_queue(struct request_queue *q, request_fn_proc *rfn,
+                    void *queuedata) {
+    spin_lock_init(&q->lock);
+    INIT_LIST_HEAD(&q->queue_head);
+    q->active = NULL;
+    q->head_pos = 0;
+    q->request_fn = rfn;
+    q->queuedata = queuedata;
+    q->nr_requests = 0;
+    q->nr_dispatched = 0;
+    q->nr_merges = 0;
+    q->nr_splits = 0;
+    q->nr_errors = 0;
+}
+
+void blk_rq_init(struct request *rq, struct block_device *bdev, int dir,
+                 u64 sector, u32 nr_sectors, void *buffer) {
+    INIT_LIST_HEAD(&rq->queuelist);
+    rq->bdev = bdev;
+    rq->dir = dir;
+    rq->sector = sector;
+    rq->nr_sectors = nr_sectors;
+    rq->buffer = buffer;
+    rq->error = 0;
+    rq->end_io = NULL;
+    rq->end_io_data = NULL;
+    rq->hw_sectors = nr_sectors;
+    rq->next_merged = NULL;
+    rq->merge_tail = rq;
+    rq->parent = NULL;
+    rq->pending = 0;
+}
+
+static void blk_complete_request(struct request *rq, int error) {
+    rq->error = error;
+    if (error)
+        ++rq->bdev->queue->nr_errors;
+    if (rq->end_io)
+        rq->end_io(rq, error);
+}
+
+/* Complete @rq and every request merged behind it. */
+static void blk_complete_chain(struct request *rq, int error) {
+    while (rq) {
+        struct request *next = rq->next_merged;
+        blk_complete_request(rq, error);
+        rq = next;
+    }
+}
+
+/*
+ * Append the chain of @back to the chain of @front if it starts right
+ * where @front ends and the result still fits one hardware command.
+ */
+static bool blk_try_merge(struct request *front, struct request *back) {
+    if (front->bdev != back->bdev || front->dir != back->dir)
+        return false;
+    if (front->sector + front->hw_sectors != back->sector)
+        return false;
+    if (front->hw_sectors + back->hw_sectors > front->bdev->max_sectors)
+        return false;
+
+    front->merge_tail->next_merged = back;
+    front->merge_tail = back->merge_tail;
+    front->hw_sectors += back->hw_sectors;
+    return true;
+}
+
+/*
+ * Insert @rq into the sector sorted queue, merging it into the request
+ * in front of it, behind it, or both when it fills the gap between them.
+ * The caller holds q->lock.
+ */
+static void elv_add_request(struct request_queue *q, struct request *rq) {
+    struct request *pos, *prev = NULL, *next = NULL;
+
+    list_for_each_entry(pos, &q->queue_head, queuelist) {
+        if (pos->sector > rq->sector) {
+            next = pos;
+            break;
+        }
+        prev = pos;
+    }
+
+    if (prev && blk_try_merge(prev, rq)) {
+        ++q->nr_merges;
+        if (next && blk_try_merge(prev, next)) {
+            list_del(&next->queuelist);
+            ++q->nr_merges;
+        }
+        return;
+    }
+
+    if (next && blk_try_merge(rq, next)) {
+        ++q->nr_merges;
+        list_add_tail(&rq->queuelist, &next->queuelist);
+        list_del(&next->queuelist);
+        return;
+    }
+
+    list_add_tail(&rq->queuelist, next ? &next->queuelist : &q->queue_head);
+}
+
+/*
+ * C-LOOK: keep sweeping towards higher sectors from where the last
+ * command ended and jump back to the lowest one at the end of the disk.
+ */
+static struct request *elv_next_request(struct request_queue *q) {
+    struct request *rq;
+
+    list_for_each_entry(rq, &q->queue_head, queuelist) {
+        if (rq->sector >= q->head_pos)
+            return rq;
+    }
+    return list_first_entry(&q->queue_head, struct request, queuelist);
+}
+
+/* Start the next queued request if the hardware is idle. */
+static void blk_run_queue(struct request_queue *q) {
+    unsigned long flags;
+
+    for (;;) {
+        spin_lock_irqsave(&q->lock, flags);
+        if (q->active || list_empty(&q->queue_head)) {
+            spin_unlock_irqrestore(&q->lock, flags);
+            return;
+        }
+
+        struct request *rq = elv_next_request(q);
+        list_del(&rq->queuelist);
+        q->active = rq;
+        q->head_pos = rq->sector + rq->hw_sectors;
+        ++q->nr_dispatched;
+
+        int error = q->request_fn(q, rq);
+        if (error)
+            q->active = NULL;
+        spin_unlock_irqrestore(&q->lock, flags);
+
+        if (!error)
+            return;
+        blk_complete_chain(rq, error);
+    }
+}
+
+/* A piece of a split request is done, the last one completes the parent. */
+static void blk_end_split(struct request *rq, int error) {
+    struct request *parent = rq->parent;
+
+    kfree(rq);
+    if (error)
+        parent->error = error;
+    if (!__sync_sub_and_fetch(&parent->pending, 1) && parent->end_io)
+        parent->end_io(parent, parent->error);
+}
+
+static void blk_split_request(struct request *rq) {
+    struct block_device *bdev = rq->bdev;
+    u32 max = bdev->max_sectors;
+    u32 nr = (rq->nr_sectors + max - 1) / max;
+
+    ++bdev->queue->nr_splits;
+    rq->error = 0;
+    rq->pending = nr;
+    for (u32 i = 0; i < nr; i++) {
+        struct request *child = kmalloc(sizeof(struct request), SLUB_NONE);
+        if (!child) {
+            rq->error = -1;
+            if (!__sync_sub_and_fetch(&rq->pending, nr - i) && rq->end_io)
+                rq->end_io(rq, rq->error);
+            return;
+        }
+        blk_rq_init(child, bdev, rq->dir, rq->sector + (u64)i * max,
+                    min(max, rq->nr_sectors - i * max),
+                    rq->buffer + ((size_t)i * max << SECTOR_SHIFT));
+        child->parent = rq;
+        child->end_io = blk_end_split;
+        submit_request(child);
+    }
+}
+
+/*
+ * Queue @rq and return, rq->end_io is called once the transfer is done,
+ * usually from the device's irq handler.
+ */
+void submit_request(struct request *rq) {
+    struct request_queue *q = rq->bdev->queue;
+    unsigned long flags;
+
+    if (!rq->nr_sectors ||
+        rq->sector + rq->nr_sectors > rq->bdev->nr_sectors) {
+        printk("blk: %s bad request sector %ld count %d\n", rq->bdev->name,
+               rq->sector, rq->nr_sectors);
+        blk_complete_request(rq, -1);
+        return;
+    }
+
+    if (rq->nr_sectors > rq->bdev->max_sectors) {
+        blk_split_request(rq);
+        return;
+    }
+
+    spin_lock_irqsave(&q->lock, flags);
+    ++q->nr_requests;
+    elv_add_request(q, rq);
+    spin_unlock_irqrestore(&q->lock, flags);
+
+    blk_run_queue(q);
+}
+
+/*
+ * Called by the driver when the active request has finished, completes
+ * everything that was merged into it as well.
+ */
+void blk_end_request(struct request *rq, int error) {
+    struct request_queue *q = rq->bdev->queue;
+    unsigned long flags;
+
+    spin_lock_irqsave(&q->lock, flags);
+    q->active = NULL;
+    spin_unlock_irqrestore(&q->lock, flags);
+
+    blk_complete_chain(rq, error);
+    blk_run_queue(q);
+}
+
+static void blk_end_sync_rq(struct request *rq, int error) {
+    (void)error;
+    complete(rq->end_io_data);
+}
+
+/* Submit @rq and sleep until it has completed. */
+int blk_execute_rq(struct request *rq) {
+    struct completion wait;
+
+    init_completion(&wait);
+    rq->end_io = blk_end_sync_rq;
+    rq->end_io_data = &wait;
+    submit_request(rq);
+    wait_for_completion(&wait);
+    return rq->error;
+}
+
+int blk_read(struct block_device *bdev, u64 sector, u32 nr_sectors,
+             void *buffer) {
+    struct request rq;
+    blk_rq_init(&rq, bdev, REQ_READ, sector, nr_sectors, buffer);
+    return blk_execute_rq(&rq);
+}
+
+int blk_write(struct block_device *bdev, u64 sector, u32 nr_sectors,
+              void *buffer) {
+    struct request rq;
+    blk_rq_init(&rq, bdev, REQ_WRITE, sector, nr_sectors, buffer);
+    return blk_execute_rq(&rq);
+}
+
+void print_blk_stats(struct request_queue *q) {
+    printk("blk: requests %ld dispatched %ld merges %ld splits %ld errors "
+           "%ld\n",
+           q->nr_requests, q->nr_dispatched, q->nr_merges, q->nr_splits,
+           q->nr_errors);
+}
+
+void register_blkdev(struct block_device *bdev) {
+    list_add_tail(&bdev->list, &blk_devices);
+    printk("blk: %s %ld sectors\n", bdev->name, bdev->nr_sectors);
+}
+
+struct block_device *lookup_bdev(const char *name) {
+    struct block_device *bdev;
+    list_for_each_entry(bdev, &blk_devices, list) {
+        if (!strcmp(bdev->name, name))
+            return bdev;
+    }
+    return NULL;
+}
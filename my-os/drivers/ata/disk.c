@@ -1,7 +1,15 @@
 #include <asm/idt.h>
 #include <asm/io.h>
+#include <asm/irq.h>
+#include <asm/page.h>
+#include <kernel/mm.h>
 #include <kernel/printk.h>
 
+#include <my-os/blkdev.h>
+#include <my-os/buddy_alloc.h>
+#include <my-os/buffer_head.h>
+#include <my-os/compiler.h>
+#include <my-os/kernel.h>
 #include <my-os/pci.h>
 #include <my-os/string.h>
 
@@ -68,6 +76,30 @@
 #define ATA_REG_ALTSTATUS 0x0c
 #define ATA_REG_DEVADDRESS 0x0d
 
+// Bus Master IDE registers (BAR4, 8 ports per channel):
+#define ATA_REG_BMCOMMAND 0x0e
+#define ATA_REG_BMSTATUS 0x10
+#define ATA_REG_BMPRDT 0x12
+
+#define ATA_BM_CMD_START 0x01
+#define ATA_BM_CMD_READ 0x08 // device -> memory
+
+#define ATA_BM_SR_ACTIVE 0x01
+#define ATA_BM_SR_ERR 0x02
+#define ATA_BM_SR_IRQ 0x04
+
+// Physical Region Descriptor, one contiguous piece of the transfer.
+struct prd_entry {
+    u32 addr;
+    u16 count; // 0 means 64KiB
+    u16 flags;
+} __attribute__((packed));
+
+#define PRD_EOT 0x8000
+#define PRD_BOUNDARY 0x10000
+#define PRD_ORDER 1 // 1024 entries, 32MiB of 64KiB pieces plus slack.
+#define PRD_ENTRIES ((PAGE_SIZE << PRD_ORDER) / sizeof(struct prd_entry))
+
 // Channels:
 #define ATA_PRIMARY 0x00
 #define ATA_SECONDARY 0x01
@@ -81,9 +113,23 @@ struct channel {
     u16 ctrl;  // Control Base
     u16 bmide; // Bus Master IDE
     u8 nIEN;   // nIEN (No Interrupt);
+    struct prd_entry *prdt;
+    volatile u8 irq_invoked;
+    u8 bm_status; // Bus Master status latched by the irq handler
+
+    // One command at a time per channel, both drives share the queue.
+    struct request_queue queue;
+    struct request *rq; // In flight, advanced by the irq handler.
+    struct request *seg; // PIO: merged request being transferred,
+    u8 *buf;             // position in its buffer
+    u32 seg_left;        // and sectors left of it.
+    u32 left;            // Sectors of rq not transferred yet.
+    u8 drive;           // ide_devices index of rq.
+    bool dma;
+    bool flushing;      // Write done, waiting for the cache flush.
+    u8 flush_cmd;
 } channels[2];
 
-static u8 ide_irq_invoked = 0;
 static u8 atapi_packet[12] = {0xA8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 struct ide_device {
@@ -92,15 +138,19 @@ struct ide_device {
     u8 drive;    // 0 (Master Drive) or 1 (Slave Drive).
     u16 type;    // 0: ATA, 1:ATAPI.
     struct identify_device_data ident_device_data;
+    struct block_device bdev; // ATA only.
 } ide_devices[4];
 
+u8 ide_print_error(u32 drive, u8 err);
+static int ide_request_fn(struct request_queue *q, struct request *rq);
+
 void ide_write(u8 channel, u8 reg, u8 data) {
     if (reg < 0x08)
         outb(data, channels[channel].base + reg - 0x00);
     else if (reg < 0x0c)
         outb(data, channels[channel].base + reg - 0x06);
     else if (reg < 0x0e)
-        outb(data, channels[channel].ctrl + reg - 0x0a);
+        outb(data, channels[channel].ctrl + reg - 0x0c);
     else if (reg < 0x16)
         outb(data, channels[channel].bmide + reg - 0x0e);
 }
@@ -112,7 +162,7 @@ u8 ide_read(u8 channel, u8 reg) {
     else if (reg < 0x0c)
         result = inb(channels[channel].base + reg - 0x06);
     else if (reg < 0x0e)
-        result = inb(channels[channel].ctrl + reg - 0x0a);
+        result = inb(channels[channel].ctrl + reg - 0x0c);
     else
         result = inb(channels[channel].bmide + reg - 0x0e);
     return result;
@@ -124,7 +174,7 @@ void ide_read_buffer(u8 channel, u8 reg, void *buffer, u32 quads) {
     else if (reg < 0x0c)
         insl(channels[channel].base + reg - 0x06, buffer, quads);
     else if (reg < 0x0e)
-        insl(channels[channel].ctrl + reg - 0x0a, buffer, quads);
+        insl(channels[channel].ctrl + reg - 0x0c, buffer, quads);
     else if (reg < 0x16)
         insl(channels[channel].bmide + reg - 0x0e, buffer, quads);
 }
@@ -141,6 +191,25 @@ void ide_init(struct pci_device *ide_device) {
     channels[ATA_PRIMARY].bmide = 0;
     channels[ATA_SECONDARY].bmide = 0;
 
+    // BAR4 is the Bus Master IDE I/O block, primary first then secondary.
+    u32 bar4 = ide_device->config.bar4;
+    if ((bar4 & 1) && (bar4 & ~3)) {
+        for (int i = 0; i < 2; i++) {
+            // the PRDT base register is 32 bits wide.
+            struct page *page = __alloc_pages(GFP_DMA32, PRD_ORDER);
+            if (!page)
+                break;
+            channels[i].prdt = __va(page_to_pfn(page) << PAGE_SHIFT);
+            channels[i].bmide = (bar4 & ~3) + i * 8;
+        }
+        pci_set_master(ide_device);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        channels[i].rq = NULL;
+        blk_init_queue(&channels[i].queue, ide_request_fn, &channels[i]);
+    }
+
     // 2- Disable IRQs:
     ide_write(ATA_PRIMARY, ATA_REG_CONTROL, 2);
     ide_write(ATA_SECONDARY, ATA_REG_CONTROL, 2);
@@ -230,6 +299,27 @@ void ide_init(struct pci_device *ide_device) {
             printk(" logical sector per physical sector %d\n",
                    ident_data->PhysicalLogicalSectorSize
                        .LogicalSectorsPerPhysicalSector);
+
+            if (ide_devices[i].type == IDE_ATA) {
+                struct block_device *bdev = &ide_devices[i].bdev;
+                u8 channel = ide_devices[i].channel;
+                bdev->name = (const char *[]){
+                    "hda", "hdb", "hdc", "hdd"}[channel * 2 +
+                                                ide_devices[i].drive];
+                if (ident_data->CommandSetSupport.BigLba) {
+                    bdev->nr_sectors = ident_data->Max48BitLBA[0] |
+                                       (u64)ident_data->Max48BitLBA[1] << 32;
+                    bdev->max_sectors = 65536;
+                } else {
+                    bdev->nr_sectors = ident_data->Capabilities.LbaSupported
+                                           ? ident_data->UserAddressableSectors
+                                           : ident_data->CurrentSectorCapacity;
+                    bdev->max_sectors = 256;
+                }
+                bdev->queue = &channels[channel].queue;
+                bdev->private_data = (void *)(unsigned long)i;
+                register_blkdev(bdev);
+            }
         }
     // 5- Enable IRQs:
     ide_write(ATA_PRIMARY, ATA_REG_CONTROL, 0);
@@ -278,10 +368,184 @@ u8 ide_polling(u8 channel, bool advanced_check) {
     return 0; // No Error.
 }
 
+// Sleep until the channel raised its irq, see ide_interrupt.
+static void ide_wait_irq(u8 channel) {
+    unsigned long flags;
+    local_irq_save(flags);
+    while (!channels[channel].irq_invoked)
+        asm volatile("sti; hlt; cli" : : : "memory");
+    channels[channel].irq_invoked = 0;
+    local_irq_restore(flags);
+}
+
+// Buffer for the next PIO sector, stepping through the merged requests.
+static void *ide_pio_next(struct channel *chan) {
+    if (!chan->seg_left) {
+        chan->seg = chan->seg->next_merged;
+        chan->buf = chan->seg->buffer;
+        chan->seg_left = chan->seg->nr_sectors;
+    }
+    void *buf = chan->buf;
+    chan->buf += SECTOR_SIZE;
+    --chan->seg_left;
+    return buf;
+}
+
+static void ide_end_request(u8 channel, u8 err) {
+    struct channel *chan = &channels[channel];
+    struct request *rq = chan->rq;
+
+    if (chan->dma) // An error may end the command before the engine.
+        ide_write(channel, ATA_REG_BMCOMMAND,
+                  ide_read(channel, ATA_REG_BMCOMMAND) & ~ATA_BM_CMD_START);
+    chan->rq = NULL;
+    blk_end_request(rq, err ? ide_print_error(chan->drive, err) : 0);
+}
+
+/*
+ * Advance the request in flight on @channel, called from its irq. PIO
+ * moves one sector per interrupt, DMA interrupts once at the end, and
+ * writes get one more interrupt for the cache flush.
+ */
+static void ide_ata_intr(u8 channel) {
+    struct channel *chan = &channels[channel];
+    u8 state = ide_read(channel, ATA_REG_STATUS); // Acknowledges INTRQ.
+    u32 words = 256;
+    u8 err = 0;
+
+    if (state & ATA_SR_ERR) {
+        err = 2;
+    } else if (state & ATA_SR_DF) {
+        err = 1;
+    } else if (chan->flushing) {
+        // Cache flushed, the request is done.
+    } else if (chan->dma) {
+        if (!(chan->bm_status & ATA_BM_SR_IRQ))
+            return; // Not the end of our transfer.
+        if (chan->bm_status & ATA_BM_SR_ERR)
+            err = 2;
+    } else if (chan->rq->dir == ATA_READ) {
+        if (!(state & ATA_SR_DRQ)) {
+            err = 3;
+        } else {
+            insw(chan->base, ide_pio_next(chan), words);
+            if (--chan->left)
+                return;
+        }
+    } else if (--chan->left) {
+        outsw(chan->base, ide_pio_next(chan), words);
+        return;
+    }
+
+    if (!err && !chan->flushing && chan->rq->dir == ATA_WRITE) {
+        chan->flushing = true;
+        ide_write(channel, ATA_REG_COMMAND, chan->flush_cmd);
+        return;
+    }
+    ide_end_request(channel, err);
+}
+
+static irqreturn_t ide_interrupt(int irq __always_unused, void *dev_id) {
+    struct channel *chan = dev_id;
+    u8 channel = chan - channels;
+
+    if (chan->bmide) {
+        u8 bm_status = ide_read(channel, ATA_REG_BMSTATUS);
+        if (bm_status & ATA_BM_SR_IRQ) {
+            ide_write(channel, ATA_REG_BMCOMMAND,
+                      ide_read(channel, ATA_REG_BMCOMMAND) &
+                          ~ATA_BM_CMD_START);
+            chan->bm_status = bm_status;
+        }
+        // write 1 to clear irq and error.
+        ide_write(channel, ATA_REG_BMSTATUS, bm_status);
+    }
+    if (chan->rq) {
+        ide_ata_intr(channel);
+        return IRQ_HANDLED;
+    }
+    // reading status acknowledges INTRQ on the device side.
+    ide_read(channel, ATA_REG_STATUS);
+    chan->irq_invoked = 1;
+    return IRQ_HANDLED;
+}
+
+static struct irq_action ide_actions[2] = {
+    {.name = "ide0", .handler = ide_interrupt, .dev_id = &channels[0]},
+    {.name = "ide1", .handler = ide_interrupt, .dev_id = &channels[1]},
+};
+
+/*
+ * Describe the buffers of @rq and the requests merged into it in the
+ * channel's PRD table. Each buffer is walked page by page so that it need
+ * not be physically contiguous; adjacent pages, also across requests, are
+ * merged and entries are cut at 64KiB boundaries as the controller
+ * requires. Returns nonzero if a buffer can't be used for DMA (odd address,
+ * above 4GiB or too fragmented), the caller falls back to PIO.
+ */
+static int ide_dma_setup(u8 channel, struct request *rq) {
+    struct channel *chan = &channels[channel];
+    struct prd_entry *prd = chan->prdt;
+    struct request *seg;
+    u32 start = 0, len = 0;
+    size_t n = 0;
+
+    if (!chan->bmide)
+        return -1;
+
+    rq_for_each_merged(seg, rq) {
+        unsigned long vaddr = (unsigned long)seg->buffer;
+        u32 bytes = seg->nr_sectors << SECTOR_SHIFT;
+
+        if (vaddr & 1)
+            return -1;
+
+        while (bytes) {
+            u64 phys = __pa(vaddr);
+            u32 size = min(bytes, (u32)(PAGE_SIZE - (vaddr & ~PAGE_MASK)));
+            size =
+                min(size, (u32)(PRD_BOUNDARY - (phys & (PRD_BOUNDARY - 1))));
+
+            if (phys + size > 0x100000000ULL)
+                return -1;
+
+            if (len && start + len == phys && (phys & (PRD_BOUNDARY - 1))) {
+                len += size;
+            } else {
+                if (len) {
+                    if (n == PRD_ENTRIES)
+                        return -1;
+                    prd[n++] = (struct prd_entry){start, (u16)len, 0};
+                }
+                start = phys;
+                len = size;
+            }
+            vaddr += size;
+            bytes -= size;
+        }
+    }
+    if (n == PRD_ENTRIES)
+        return -1;
+    prd[n++] = (struct prd_entry){start, (u16)len, 0};
+    prd[n - 1].flags = PRD_EOT;
+
+    outl(__pa(prd), chan->bmide + ATA_REG_BMPRDT - 0x0e);
+    ide_write(channel, ATA_REG_BMCOMMAND,
+              rq->dir == ATA_READ ? ATA_BM_CMD_READ : 0);
+    ide_write(channel, ATA_REG_BMSTATUS, ATA_BM_SR_IRQ | ATA_BM_SR_ERR);
+    return 0;
+}
+
 enum ata_access_mode { CHS_MODE, LBA28_MODE, LBA48_MODE };
 
-unsigned char ide_ata_access(u8 direction, u8 drive, u32 lba, u8 numsects,
-                             void *addr) {
+/*
+ * Issue @rq to @drive and return, the transfer is finished by ide_ata_intr.
+ * Called from the channel queue with interrupts disabled.
+ */
+static u8 ide_ata_start(u8 drive, struct request *rq) {
+    u8 direction = rq->dir;
+    u64 lba = rq->sector;
+    u32 numsects = rq->hw_sectors; // 256 (LBA28) and 65536 (LBA48) write 0.
     enum ata_access_mode access_mode;
     bool dma;
     u8 cmd;
@@ -291,10 +555,14 @@ unsigned char ide_ata_access(u8 direction, u8 drive, u32 lba, u8 numsects,
     u32 bus = channels[channel]
                   .base; // The Bus Base, like [0x1F0] which is also data port.
     u32 words = 256; // Approximatly all ATA-Drives has sector-size of 512-byte.
-    u16 cyl, i;
+    struct channel *chan = &channels[channel];
+    u16 cyl;
     u8 head, sect, err;
-    ide_write(channel, ATA_REG_CONTROL,
-              channels[channel].nIEN = (ide_irq_invoked = 0x0) + 0x02);
+
+    // (0) Both DMA and PIO complete through the IDE irq.
+    dma = ide_devices[drive].ident_device_data.Capabilities.DmaSupported &&
+          !ide_dma_setup(channel, rq);
+    ide_write(channel, ATA_REG_CONTROL, chan->nIEN = 0x00);
 
     // (I) Select one from LBA28, LBA48 or CHS;
     if (ide_devices[drive]
@@ -306,10 +574,8 @@ unsigned char ide_ata_access(u8 direction, u8 drive, u32 lba, u8 numsects,
         lba_io[1] = (lba & 0x0000ff00) >> 8;
         lba_io[2] = (lba & 0x00ff0000) >> 16;
         lba_io[3] = (lba & 0xff000000) >> 24;
-        lba_io[4] = 0; // We said that we lba is integer, so 32-bit are enough
-                       // to access 2TB.
-        lba_io[5] = 0; // We said that we lba is integer, so 32-bit are enough
-                       // to access 2TB.
+        lba_io[4] = (lba >> 32) & 0xff;
+        lba_io[5] = (lba >> 40) & 0xff;
         head = 0;      // Lower 4-bits of HDDEVSEL are not used here.
     } else if (ide_devices[drive]
                    .ident_device_data.Capabilities
@@ -336,9 +602,6 @@ unsigned char ide_ata_access(u8 direction, u8 drive, u32 lba, u8 numsects,
                (63); // Head number is written to HDDEVSEL lower 4-bits.
     }
 
-    // (II) See if Drive Supports DMA or not;
-    dma = 0; // Supports or doesn't, we don't support !!!
-
     // (III) Wait if the drive is busy;
     while (ide_read(channel, ATA_REG_STATUS) & ATA_SR_BSY)
         ; // Wait if Busy.
@@ -353,12 +616,12 @@ unsigned char ide_ata_access(u8 direction, u8 drive, u32 lba, u8 numsects,
 
     // (V) Write Parameters;
     if (access_mode == LBA48_MODE) {
-        ide_write(channel, ATA_REG_SECCOUNT1, 0);
+        ide_write(channel, ATA_REG_SECCOUNT1, (numsects >> 8) & 0xff);
         ide_write(channel, ATA_REG_LBA3, lba_io[3]);
         ide_write(channel, ATA_REG_LBA4, lba_io[4]);
         ide_write(channel, ATA_REG_LBA5, lba_io[5]);
     }
-    ide_write(channel, ATA_REG_SECCOUNT0, numsects);
+    ide_write(channel, ATA_REG_SECCOUNT0, numsects & 0xff);
     ide_write(channel, ATA_REG_LBA0, lba_io[0]);
     ide_write(channel, ATA_REG_LBA1, lba_io[1]);
     ide_write(channel, ATA_REG_LBA2, lba_io[2]);
@@ -397,37 +660,40 @@ unsigned char ide_ata_access(u8 direction, u8 drive, u32 lba, u8 numsects,
         cmd = ATA_CMD_WRITE_DMA;
     if (access_mode == LBA48_MODE && dma == 1 && direction == 1)
         cmd = ATA_CMD_WRITE_DMA_EXT;
+    chan->rq = rq;
+    chan->drive = drive;
+    chan->seg = rq;
+    chan->buf = rq->buffer;
+    chan->seg_left = rq->nr_sectors;
+    chan->left = numsects;
+    chan->dma = dma;
+    chan->bm_status = 0;
+    chan->flushing = false;
+    chan->flush_cmd = (u8[]){ATA_CMD_CACHE_FLUSH, ATA_CMD_CACHE_FLUSH,
+                             ATA_CMD_CACHE_FLUSH_EXT}[access_mode];
     ide_write(channel, ATA_REG_COMMAND, cmd); // Send the Command.
 
-    if (dma)
-        if (direction == 0) {
-            // DMA Read.
-        }
-        else {
-            // DMA Write.
-        }
-    else if (direction == 0)
-        // PIO Read.
-        for (i = 0; i < numsects; i++) {
-            if ((err = ide_polling(channel, 1)))
-                return err; // Polling, then set error and exit if there is.
-            insw(bus, addr, words);
-            addr += (words * 2);
+    if (dma) {
+        // DMA Read/Write, the PRD table has the direction already.
+        ide_write(channel, ATA_REG_BMCOMMAND,
+                  ide_read(channel, ATA_REG_BMCOMMAND) | ATA_BM_CMD_START);
+    } else if (direction == ATA_WRITE) {
+        // PIO Write, the first sector goes now, the rest from the irq.
+        if ((err = ide_polling(channel, 1))) {
+            chan->rq = NULL;
+            return err;
         }
-    else {
-        // PIO Write.
-        for (i = 0; i < numsects; i++) {
-            ide_polling(channel, 0); // Polling.
-            outsw(bus, addr, words);
-            addr += (words * 2);
-        }
-        ide_write(channel, ATA_REG_COMMAND,
-                  (char[]){ATA_CMD_CACHE_FLUSH, ATA_CMD_CACHE_FLUSH,
-                           ATA_CMD_CACHE_FLUSH_EXT}[access_mode]);
-        ide_polling(channel, 0); // Polling.
+        outsw(bus, ide_pio_next(chan), words);
     }
 
-    return 0; // Easy, ... Isn't it?
+    return 0;
+}
+
+static int ide_request_fn(struct request_queue *q, struct request *rq) {
+    (void)q;
+    u8 drive = (u8)(unsigned long)rq->bdev->private_data;
+    u8 err = ide_ata_start(drive, rq);
+    return err ? ide_print_error(drive, err) : 0;
 }
 
 u8 ide_print_error(u32 drive, u8 err) {
@@ -487,13 +753,6 @@ u8 ide_print_error(u32 drive, u8 err) {
     return err;
 }
 
-void ide_wait_irq() {
-    while (!ide_irq_invoked)
-        ;
-    ide_irq_invoked = 0;
-}
-
-void ide_irq() { ide_irq_invoked = 1; }
 
 unsigned char ide_atapi_read(u8 drive, u32 lba, unsigned char numsects,
                              void *addr) {
@@ -504,8 +763,8 @@ unsigned char ide_atapi_read(u8 drive, u32 lba, unsigned char numsects,
                           // Drives has a sector size of 2048 bytes.
     u8 err;
     // Enable IRQs:
-    ide_write(channel, ATA_REG_CONTROL,
-              channels[channel].nIEN = ide_irq_invoked = 0x0);
+    channels[channel].irq_invoked = 0;
+    ide_write(channel, ATA_REG_CONTROL, channels[channel].nIEN = 0x0);
     // (I): Setup SCSI Packet:
     // ------------------------------------------------------------------
     atapi_packet[0] = ATAPI_CMD_READ;
@@ -560,7 +819,7 @@ unsigned char ide_atapi_read(u8 drive, u32 lba, unsigned char numsects,
                             // (IX): Recieving Data:
     // ------------------------------------------------------------------
     for (int i = 0; i < numsects; i++) {
-        ide_wait_irq(); // Wait for an IRQ.
+        ide_wait_irq(channel); // Wait for an IRQ.
         if ((err = ide_polling(channel, 1)))
             return err; // Polling and return if error.
 
@@ -569,7 +828,7 @@ unsigned char ide_atapi_read(u8 drive, u32 lba, unsigned char numsects,
     }
     // (X): Waiting for an IRQ:
     // ------------------------------------------------------------------
-    ide_wait_irq();
+    ide_wait_irq(channel);
 
     // (XI): Waiting for BSY & DRQ to clear:
     // ------------------------------------------------------------------
@@ -579,7 +838,7 @@ unsigned char ide_atapi_read(u8 drive, u32 lba, unsigned char numsects,
     return 0; // Easy, ... Isn't it?
 }
 
-void ide_read_sectors(u8 drive, u8 numsects, u32 lba, void *addr) {
+int ide_read_sectors(u8 drive, u32 numsects, u64 lba, void *addr) {
 
     u8 err = 0;
     // 1: Check if the drive presents:
@@ -589,27 +848,27 @@ void ide_read_sectors(u8 drive, u8 numsects, u32 lba, void *addr) {
 
     // 2: Check if inputs are valid:
     // ==================================
-    else if (((lba + numsects) >
-              ide_devices[drive].ident_device_data.CurrentSectorCapacity) &&
+    else if (((lba + numsects) > ide_devices[drive].bdev.nr_sectors) &&
              (ide_devices[drive].type == IDE_ATA))
         err = 0x2; // Seeking to invalid position.
 
     // 3: Read in PIO Mode through Polling & IRQs:
     // ============================================
     else {
+        // ATA goes through the request queue and sleeps, the irq handler
+        // has already printed the error it returns.
         if (ide_devices[drive].type == IDE_ATA)
-            err = ide_ata_access(ATA_READ, drive, lba, numsects, addr);
+            return blk_read(&ide_devices[drive].bdev, lba, numsects, addr);
         else if (ide_devices[drive].type == IDE_ATAPI)
             for (size_t i = 0; i < numsects; i++)
                 err = ide_atapi_read(drive, lba + i, 1, addr + (i * 2048));
-        err = ide_print_error(drive, err);
     }
+    return ide_print_error(drive, err);
 }
 /* package[0] is an entry of array, this entry specifies the Error Code, you can
  */
 /* replace that. */
-void ide_write_sectors(unsigned char drive, unsigned char numsects,
-                       unsigned int lba, void *addr) {
+int ide_write_sectors(u8 drive, u32 numsects, u64 lba, void *addr) {
 
     u8 err = 0;
     // 1: Check if the drive presents:
@@ -618,24 +877,25 @@ void ide_write_sectors(unsigned char drive, unsigned char numsects,
         err = 0x1; // Drive Not Found!
     // 2: Check if inputs are valid:
     // ==================================
-    else if (((lba + numsects) >
-              ide_devices[drive].ident_device_data.CurrentSectorCapacity) &&
+    else if (((lba + numsects) > ide_devices[drive].bdev.nr_sectors) &&
              (ide_devices[drive].type == IDE_ATA))
         err = 0x2; // Seeking to invalid position.
     // 3: Read in PIO Mode through Polling & IRQs:
     // ============================================
     else {
         if (ide_devices[drive].type == IDE_ATA)
-            err = ide_ata_access(ATA_WRITE, drive, lba, numsects, addr);
+            return blk_write(&ide_devices[drive].bdev, lba, numsects, addr);
         else if (ide_devices[drive].type == IDE_ATAPI)
             err = 4; // Write-Protected.
-        err = ide_print_error(drive, err);
     }
+    return ide_print_error(drive, err);
 }
-extern void int2f(void);
 void ata_init() {
-    /* irq_set_handler(0x2f, int2f); */
     struct pci_device *pci_device = get_pci_device(1, 1);
+    if (!pci_device) {
+        printk("no ide controller\n");
+        return;
+    }
 
     printk("bus %d device %d function %d\n", pci_device->bus,
            pci_device->device, pci_device->function);
@@ -649,16 +909,23 @@ void ata_init() {
         printk("bar %d = %#x\n", i, *bar++);
     }
 
+    irq_set_handler(14, handle_simple_irq, "ide");
+    setup_irq(14, &ide_actions[ATA_PRIMARY]);
+    irq_set_handler(15, handle_simple_irq, "ide");
+    setup_irq(15, &ide_actions[ATA_SECONDARY]);
+
     ide_init(pci_device);
 
-    char buf[513] = {0};
-    ide_read_sectors(0, 1, 0, buf);
+    struct block_device *bdev = lookup_bdev("hda");
+    struct buffer_head *bh = bdev ? bread(bdev, 0, SECTOR_SIZE) : NULL;
+    if (!bh)
+        return;
+    u8 *buf = bh->b_data;
     for (int i = 0; i < 5; ++i) {
         for (int j = 0; j < 10; ++j) {
-            printk("%x ", (u8)buf[i * 10 + j]);
+            printk("%x ", buf[i * 10 + j]);
         }
         printk("\n");
     }
+    brelse(bh);
 }
-
-void do_ata(struct pt_regs *regs) {}
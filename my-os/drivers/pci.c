@@ -3,11 +3,14 @@
 #include <my-os/kernel.h>
 #include <my-os/list.h>
 #include <my-os/pci.h>
+#include <my-os/rwlock.h>
 #include <my-os/slub_alloc.h>
 #include <my-os/string.h>
 #include <my-os/types.h>
 
 LIST_HEAD(pci_devices);
+/* written only while the buses are scanned, drivers look devices up */
+static DEFINE_RWLOCK(pci_devices_lock);
 
 #define PCI_CONFIG_ADDRESS 0xcf8
 #define PCI_CONFIG_DATA 0xcfc
@@ -51,28 +54,40 @@ void pci_config_read(u8 bus, u8 device, u8 function, void *dst, size_t size) {
 
 void pci_config_writeb(u8 bus, u8 device, u8 function, u8 offset, u8 v) {
     pci_config_set_addr(bus, device, function, offset);
-    outb(v, PCI_CONFIG_DATA);
+    outb(v, PCI_CONFIG_DATA + (offset & 3));
 }
 
 void pci_config_writew(u8 bus, u8 device, u8 function, u8 offset, u16 v) {
     pci_config_set_addr(bus, device, function, offset);
-    outb(v, PCI_CONFIG_DATA);
+    outw(v, PCI_CONFIG_DATA + (offset & 2));
 }
 void pci_config_writel(u8 bus, u8 device, u8 function, u8 offset, u32 v) {
     pci_config_set_addr(bus, device, function, offset);
-    outb(v, PCI_CONFIG_DATA);
+    outl(v, PCI_CONFIG_DATA);
+}
+
+void pci_set_master(struct pci_device *dev) {
+    u16 cmd = pci_config_readw(dev->bus, dev->device, dev->function,
+                               PCI_COMMAND);
+    cmd |= PCI_COMMAND_IO | PCI_COMMAND_MASTER;
+    pci_config_writew(dev->bus, dev->device, dev->function, PCI_COMMAND, cmd);
+    dev->config.command = cmd;
 }
 
 void register_pci_device(u8 bus, u8 device, u8 function) {
     struct pci_device *pci_device =
         kmalloc(sizeof(struct pci_device), SLUB_NONE);
+    unsigned long flags;
+
     pci_device->bus = bus;
     pci_device->device = device;
     pci_device->function = function;
     pci_config_read(bus, device, function, &pci_device->config,
                     sizeof(struct pci_device_config));
 
+    write_lock_irqsave(&pci_devices_lock, flags);
     list_add(&pci_device->list, &pci_devices);
+    write_unlock_irqrestore(&pci_devices_lock, flags);
 }
 
 bool pci_check_device(u8 bus, u8 device) {
@@ -104,14 +119,19 @@ void pci_check_all_buses(void) {
 }
 
 struct pci_device *get_pci_device(u8 class_code, u8 sub_class) {
-    struct pci_device *pci_device = NULL;
+    struct pci_device *pci_device, *found = NULL;
+    unsigned long flags;
+
+    read_lock_irqsave(&pci_devices_lock, flags);
     list_for_each_entry(pci_device, &pci_devices, list) {
         if (pci_device->config.class_code == class_code &&
             pci_device->config.sub_class == sub_class) {
+            found = pci_device;
             break;
         }
     }
-    return pci_device;
+    read_unlock_irqrestore(&pci_devices_lock, flags);
+    return found;
 }
 
 void pci_bus() { pci_check_all_buses(); }
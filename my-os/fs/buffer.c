@@ -0,0 +1,407 @@
+#include <asm/irq.h>
+#include <asm/page.h>
+#include <kernel/mm.h>
+#include <kernel/printk.h>
+
+#include <my-os/buddy_alloc.h>
+#include <my-os/buffer_head.h>
+#include <my-os/kernel.h>
+#include <my-os/log2.h>
+#include <my-os/slub_alloc.h>
+
+#define BH_HASH_BITS 10
+#define BH_HASH_SIZE (1 << BH_HASH_BITS)
+
+/* block data kept cached, a soft limit while dirty buffers are pinned */
+#define BH_MAX_MEM (16 << 20)
+/* brelse() writes back once this many buffers are dirty */
+#define BH_DIRTY_LIMIT 256
+
+/* read-ahead window, in blocks */
+#define RA_MIN 4
+#define RA_MAX 64
+
+static DEFINE_SPINLOCK(buffer_lock);
+static struct list_head bh_hash_table[BH_HASH_SIZE];
+static LIST_HEAD(bh_lru); /* unused buffers, most recently released first */
+static LIST_HEAD(bh_dirty);
+static struct kmem_cache *bh_cachep;
+/* free pieces of pages cut into 512 .. PAGE_SIZE byte blocks */
+static struct list_head bh_free_data[PAGE_SHIFT - SECTOR_SHIFT + 1];
+
+static u32 nr_buffers;
+static u32 nr_dirty;
+static size_t buffer_mem;
+
+static struct {
+    u64 lookups;
+    u64 hits;
+    u64 reads;
+    u64 readahead;
+    u64 writes;
+    u64 evictions;
+} bh_stats;
+
+static struct list_head *bh_hash(struct block_device *bdev, u64 block) {
+    u64 key = block ^ ((unsigned long)bdev >> 4);
+    return &bh_hash_table[(key * 0x61c8864680b583ebULL) >>
+                          (64 - BH_HASH_BITS)];
+}
+
+/* the caller holds buffer_lock */
+static void *bh_alloc_data(u32 size) {
+    struct list_head *free = &bh_free_data[ilog2(size) - SECTOR_SHIFT];
+
+    if (list_empty(free)) {
+        // below 4G, so the bus master can transfer into it directly
+        struct page *page = __alloc_pages(GFP_DMA32, 0);
+        if (!page)
+            return NULL;
+        void *p = __va(page_to_pfn(page) << PAGE_SHIFT);
+        for (u32 off = 0; off < PAGE_SIZE; off += size)
+            list_add_tail(p + off, free);
+    }
+
+    struct list_head *data = free->next;
+    list_del(data);
+    return data;
+}
+
+static void bh_free_data_block(void *data, u32 size) {
+    list_add(data, &bh_free_data[ilog2(size) - SECTOR_SHIFT]);
+}
+
+static struct buffer_head *__find_buffer(struct block_device *bdev, u64 block,
+                                         u32 size) {
+    struct buffer_head *bh;
+    list_for_each_entry(bh, bh_hash(bdev, block), b_hash) {
+        if (bh->b_blocknr == block && bh->b_bdev == bdev &&
+            bh->b_size == size)
+            return bh;
+    }
+    return NULL;
+}
+
+/* a buffer is on the LRU exactly while nobody holds a reference */
+static void __get_bh(struct buffer_head *bh) {
+    if (!bh->b_count++)
+        list_del(&bh->b_lru);
+}
+
+static void __put_bh(struct buffer_head *bh) {
+    if (!--bh->b_count)
+        list_add(&bh->b_lru, &bh_lru);
+}
+
+static void put_bh(struct buffer_head *bh) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&buffer_lock, flags);
+    __put_bh(bh);
+    spin_unlock_irqrestore(&buffer_lock, flags);
+}
+
+static void __evict_buffer(struct buffer_head *bh) {
+    list_del(&bh->b_hash);
+    list_del(&bh->b_lru);
+    bh_free_data_block(bh->b_data, bh->b_size);
+    buffer_mem -= bh->b_size;
+    --nr_buffers;
+    ++bh_stats.evictions;
+    kfree(bh);
+}
+
+/*
+ * Evict clean unused buffers from the cold end of the LRU until @size more
+ * bytes fit. Returns false if only dirty or busy buffers were left.
+ */
+static bool __shrink_buffers(u32 size) {
+    struct list_head *pos = bh_lru.prev;
+
+    while (buffer_mem + size > BH_MAX_MEM && pos != &bh_lru) {
+        struct buffer_head *bh = list_entry(pos, struct buffer_head, b_lru);
+        pos = pos->prev;
+        if (bh->b_state & (BH_DIRTY | BH_LOCK))
+            continue;
+        __evict_buffer(bh);
+    }
+    return buffer_mem + size <= BH_MAX_MEM;
+}
+
+static int writeback_buffers(struct block_device *bdev);
+
+/*
+ * Find the buffer of @block or create one that is not read yet. The
+ * buffer is returned with a reference held, drop it with brelse().
+ */
+struct buffer_head *getblk(struct block_device *bdev, u64 block, u32 size) {
+    struct buffer_head *bh;
+    unsigned long flags;
+    bool written = false;
+
+    for (;;) {
+        spin_lock_irqsave(&buffer_lock, flags);
+        ++bh_stats.lookups;
+        bh = __find_buffer(bdev, block, size);
+        if (bh) {
+            ++bh_stats.hits;
+            __get_bh(bh);
+            spin_unlock_irqrestore(&buffer_lock, flags);
+            return bh;
+        }
+        if (__shrink_buffers(size) || !nr_dirty || written)
+            break;
+        spin_unlock_irqrestore(&buffer_lock, flags);
+
+        writeback_buffers(NULL);
+        written = true;
+    }
+
+    bh = slub_alloc(bh_cachep, SLUB_NONE);
+    void *data = bh ? bh_alloc_data(size) : NULL;
+    if (!data) {
+        spin_unlock_irqrestore(&buffer_lock, flags);
+        kfree(bh);
+        return NULL;
+    }
+
+    bh->b_state = 0;
+    bh->b_count = 1;
+    bh->b_bdev = bdev;
+    bh->b_blocknr = block;
+    bh->b_size = size;
+    bh->b_data = data;
+    init_completion(&bh->b_wait);
+    list_add(&bh->b_hash, bh_hash(bdev, block));
+    ++nr_buffers;
+    buffer_mem += size;
+
+    spin_unlock_irqrestore(&buffer_lock, flags);
+    return bh;
+}
+
+/* Release a reference, write back if too many buffers are dirty. */
+void brelse(struct buffer_head *bh) {
+    if (!bh)
+        return;
+    put_bh(bh);
+    if (nr_dirty > BH_DIRTY_LIMIT)
+        writeback_buffers(NULL);
+}
+
+void mark_buffer_dirty(struct buffer_head *bh) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&buffer_lock, flags);
+    bh->b_state |= BH_UPTODATE;
+    if (!(bh->b_state & BH_DIRTY)) {
+        bh->b_state |= BH_DIRTY;
+        list_add_tail(&bh->b_dirty, &bh_dirty);
+        ++nr_dirty;
+    }
+    spin_unlock_irqrestore(&buffer_lock, flags);
+}
+
+/* called from the disk irq, the i/o held its own reference */
+static void end_buffer_io(struct request *rq, int error) {
+    struct buffer_head *bh = rq->end_io_data;
+    unsigned long flags;
+
+    spin_lock_irqsave(&buffer_lock, flags);
+    if (error) {
+        bh->b_state |= BH_ERROR;
+    } else {
+        bh->b_state &= ~BH_ERROR;
+        if (rq->dir == REQ_READ)
+            bh->b_state |= BH_UPTODATE;
+    }
+    /*
+     * Wake the waiters while the i/o still holds its reference and under
+     * buffer_lock, so neither an eviction nor the next submit can get in
+     * between; the reference goes last.
+     */
+    bh->b_state &= ~BH_LOCK;
+    complete_all(&bh->b_wait);
+    __put_bh(bh);
+    spin_unlock_irqrestore(&buffer_lock, flags);
+}
+
+/*
+ * Mark @bh under i/o and take the i/o's reference, a write takes the
+ * buffer off the dirty list. The caller holds buffer_lock and has checked
+ * that no i/o is in flight.
+ */
+static void __lock_buffer_io(struct buffer_head *bh, int dir) {
+    bh->b_state |= BH_LOCK;
+    if (dir == REQ_WRITE && (bh->b_state & BH_DIRTY)) {
+        bh->b_state &= ~BH_DIRTY;
+        list_del(&bh->b_dirty);
+        --nr_dirty;
+    }
+    __get_bh(bh);
+    reinit_completion(&bh->b_wait);
+}
+
+static void __submit_bh(struct buffer_head *bh, int dir) {
+    u32 spb = bh->b_size >> SECTOR_SHIFT;
+
+    if (dir == REQ_READ)
+        ++bh_stats.reads;
+    else
+        ++bh_stats.writes;
+
+    blk_rq_init(&bh->b_rq, bh->b_bdev, dir, bh->b_blocknr * spb, spb,
+                bh->b_data);
+    bh->b_rq.end_io = end_buffer_io;
+    bh->b_rq.end_io_data = bh;
+    submit_request(&bh->b_rq);
+}
+
+/* Start i/o on @bh unless some is in flight already. */
+static bool submit_bh(struct buffer_head *bh, int dir) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&buffer_lock, flags);
+    if (bh->b_state & BH_LOCK) {
+        spin_unlock_irqrestore(&buffer_lock, flags);
+        return false;
+    }
+    __lock_buffer_io(bh, dir);
+    spin_unlock_irqrestore(&buffer_lock, flags);
+
+    __submit_bh(bh, dir);
+    return true;
+}
+
+void wait_on_buffer(struct buffer_head *bh) {
+    for (;;) {
+        barrier();
+        if (!buffer_locked(bh))
+            break;
+        wait_for_completion(&bh->b_wait);
+    }
+}
+
+/*
+ * Sequential read-ahead. A read of the block after the previous one
+ * extends the stream: once it gets within half a window of what has been
+ * read ahead, the window doubles up to RA_MAX and the next part is
+ * submitted. The reads queue up behind the demanded block and the
+ * elevator merges them into one command. Any other read ends the stream.
+ */
+static void bh_readahead(struct block_device *bdev, u64 block, u32 size) {
+    u64 nr_blocks = bdev->nr_sectors / (size >> SECTOR_SHIFT);
+
+    if (block != bdev->ra_prev + 1) {
+        bdev->ra_size = 0;
+        bdev->ra_end = block + 1;
+        bdev->ra_prev = block;
+        return;
+    }
+    bdev->ra_prev = block;
+
+    if (bdev->ra_end > block + 1 + bdev->ra_size / 2)
+        return;
+
+    bdev->ra_size = bdev->ra_size ? min(bdev->ra_size * 2, (u32)RA_MAX)
+                                  : (u32)RA_MIN;
+    u64 start = max(bdev->ra_end, block + 1);
+    u64 end = min(block + 1 + bdev->ra_size, nr_blocks);
+
+    for (u64 b = start; b < end; b++) {
+        struct buffer_head *bh = getblk(bdev, b, size);
+        if (!bh)
+            break;
+        if (!buffer_uptodate(bh) && submit_bh(bh, REQ_READ))
+            ++bh_stats.readahead;
+        put_bh(bh);
+    }
+    bdev->ra_end = max(bdev->ra_end, end);
+}
+
+/* Get the buffer of @block with its data read, NULL on i/o error. */
+struct buffer_head *bread(struct block_device *bdev, u64 block, u32 size) {
+    struct buffer_head *bh = getblk(bdev, block, size);
+    if (!bh)
+        return NULL;
+
+    if (!buffer_uptodate(bh))
+        submit_bh(bh, REQ_READ);
+    bh_readahead(bdev, block, size);
+
+    wait_on_buffer(bh);
+    if (!buffer_uptodate(bh)) {
+        brelse(bh);
+        return NULL;
+    }
+    return bh;
+}
+
+/* Write @bh now if it is dirty and wait for it. */
+int sync_dirty_buffer(struct buffer_head *bh) {
+    wait_on_buffer(bh);
+    if (buffer_dirty(bh))
+        submit_bh(bh, REQ_WRITE);
+    wait_on_buffer(bh);
+    return bh->b_state & BH_ERROR ? -1 : 0;
+}
+
+/*
+ * Write back the dirty buffers of @bdev, of every device if NULL. All
+ * writes are queued before waiting so the elevator can sort and merge
+ * them. Held buffers use b_lru, which is free while b_count is nonzero.
+ */
+static int writeback_buffers(struct block_device *bdev) {
+    LIST_HEAD(batch);
+    struct buffer_head *bh;
+    unsigned long flags;
+    int err = 0;
+
+    spin_lock_irqsave(&buffer_lock, flags);
+    struct list_head *pos = bh_dirty.next;
+    while (pos != &bh_dirty) {
+        bh = list_entry(pos, struct buffer_head, b_dirty);
+        pos = pos->next;
+        if ((bdev && bh->b_bdev != bdev) || (bh->b_state & BH_LOCK))
+            continue;
+        __get_bh(bh);
+        __lock_buffer_io(bh, REQ_WRITE);
+        list_add_tail(&bh->b_lru, &batch);
+    }
+    spin_unlock_irqrestore(&buffer_lock, flags);
+
+    list_for_each_entry(bh, &batch, b_lru) {
+        __submit_bh(bh, REQ_WRITE);
+    }
+
+    while (!list_empty(&batch)) {
+        bh = list_first_entry(&batch, struct buffer_head, b_lru);
+        list_del(&bh->b_lru);
+        wait_on_buffer(bh);
+        if (bh->b_state & BH_ERROR)
+            err = -1;
+        put_bh(bh);
+    }
+    return err;
+}
+
+int sync_blockdev(struct block_device *bdev) {
+    return writeback_buffers(bdev);
+}
+
+void print_buffer_stats(void) {
+    printk("buffer: %d buffers %d dirty %dKB, lookups %ld hits %ld reads %ld "
+           "readahead %ld writes %ld evictions %ld\n",
+           nr_buffers, nr_dirty, buffer_mem >> 10, bh_stats.lookups,
+           bh_stats.hits, bh_stats.reads, bh_stats.readahead, bh_stats.writes,
+           bh_stats.evictions);
+}
+
+void buffer_init(void) {
+    for (int i = 0; i < BH_HASH_SIZE; i++)
+        INIT_LIST_HEAD(&bh_hash_table[i]);
+    for (int i = 0; i < PAGE_SHIFT - SECTOR_SHIFT + 1; i++)
+        INIT_LIST_HEAD(&bh_free_data[i]);
+    bh_cachep = kmem_cache_create("buffer_head", sizeof(struct buffer_head),
+                                  8, SLUB_NONE, NULL);
+}
@@ -0,0 +1,274 @@
+#include <asm/irq.h>
+#include <kernel/printk.h>
+
+#include <my-os/buddy_alloc.h>
+#include <my-os/fs.h>
+#include <my-os/slub_alloc.h>
+#include <my-os/spinlock.h>
+#include <my-os/string.h>
+
+#define D_HASH_BITS 10
+#define D_HASH_SIZE (1 << D_HASH_BITS)
+
+/* unused dentries kept cached, the oldest are dropped past this */
+#define DCACHE_MAX_UNUSED 1024
+
+static DEFINE_SPINLOCK(dcache_lock);
+static struct list_head dentry_hash_table[D_HASH_SIZE];
+static LIST_HEAD(dentry_lru); /* unused dentries, most recently put first */
+static struct kmem_cache *dentry_cachep;
+
+static u32 nr_dentries;
+static u32 nr_unused;
+
+static struct {
+    u64 lookups;
+    u64 hits;
+    u64 negative;
+    u64 pruned;
+} dcache_stats;
+
+/* FNV-1a */
+static u32 full_name_hash(const char *name, size_t len) {
+    u32 hash = 2166136261U;
+    while (len--) {
+        hash ^= (u8)*name++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static u32 d_name_hash(const struct dentry *dir, const char *name,
+                       size_t len) {
+    if (dir && dir->d_op && dir->d_op->d_hash)
+        return dir->d_op->d_hash(dir, name, len);
+    return full_name_hash(name, len);
+}
+
+static bool d_name_eq(const struct dentry *dentry, const char *name,
+                      size_t len) {
+    if (dentry->d_op && dentry->d_op->d_compare)
+        return !dentry->d_op->d_compare(dentry, name, len);
+    return dentry->d_len == len && !memcmp(dentry->d_name, name, len);
+}
+
+static struct list_head *d_hash(const struct dentry *parent, u32 hash) {
+    u64 key = hash ^ ((unsigned long)parent >> 4);
+    return &dentry_hash_table[(key * 0x61c8864680b583ebULL) >>
+                              (64 - D_HASH_BITS)];
+}
+
+static struct dentry *__d_find(struct dentry *dir, const char *name,
+                               size_t len, u32 hash) {
+    struct dentry *dentry;
+    list_for_each_entry(dentry, d_hash(dir, hash), d_hash) {
+        if (dentry->d_hash_val == hash && dentry->d_parent == dir &&
+            d_name_eq(dentry, name, len))
+            return dentry;
+    }
+    return NULL;
+}
+
+/* a dentry is on the LRU exactly while nobody holds a reference */
+static void __dget(struct dentry *dentry) {
+    if (!dentry->d_count++) {
+        list_del(&dentry->d_lru);
+        --nr_unused;
+    }
+}
+
+/* unhash an unused dentry, the caller kills it after dropping the lock */
+static void __d_drop(struct dentry *dentry) {
+    list_del(&dentry->d_hash);
+    list_del(&dentry->d_lru);
+    --nr_unused;
+}
+
+/* free a dentry nobody can find any more, dropping what it held */
+static void d_kill(struct dentry *dentry) {
+    struct dentry *parent = dentry->d_parent;
+    unsigned long flags;
+
+    if (dentry->d_inode)
+        iput(dentry->d_inode);
+    if (dentry->d_name != dentry->d_iname)
+        kfree((void *)dentry->d_name);
+    kfree(dentry);
+
+    spin_lock_irqsave(&dcache_lock, flags);
+    --nr_dentries;
+    spin_unlock_irqrestore(&dcache_lock, flags);
+
+    if (parent != dentry)
+        dput(parent);
+}
+
+struct dentry *dget(struct dentry *dentry) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&dcache_lock, flags);
+    __dget(dentry);
+    spin_unlock_irqrestore(&dcache_lock, flags);
+    return dentry;
+}
+
+void dput(struct dentry *dentry) {
+    struct dentry *victim = NULL;
+    unsigned long flags;
+
+    spin_lock_irqsave(&dcache_lock, flags);
+    if (!--dentry->d_count) {
+        list_add(&dentry->d_lru, &dentry_lru);
+        if (++nr_unused > DCACHE_MAX_UNUSED) {
+            victim = list_last_entry(&dentry_lru, struct dentry, d_lru);
+            __d_drop(victim);
+            ++dcache_stats.pruned;
+        }
+    }
+    spin_unlock_irqrestore(&dcache_lock, flags);
+
+    if (victim)
+        d_kill(victim);
+}
+
+/*
+ * Find @name in @dir without asking the filesystem. A negative dentry
+ * is returned too, the caller checks d_inode.
+ */
+struct dentry *d_lookup(struct dentry *dir, const char *name, size_t len) {
+    u32 hash = d_name_hash(dir, name, len);
+    struct dentry *dentry;
+    unsigned long flags;
+
+    spin_lock_irqsave(&dcache_lock, flags);
+    ++dcache_stats.lookups;
+    dentry = __d_find(dir, name, len, hash);
+    if (dentry) {
+        __dget(dentry);
+        ++dcache_stats.hits;
+        if (!dentry->d_inode)
+            ++dcache_stats.negative;
+    }
+    spin_unlock_irqrestore(&dcache_lock, flags);
+    return dentry;
+}
+
+/*
+ * Allocate an unhashed dentry for @name in @dir with one reference held,
+ * it takes a reference to @dir. A NULL @dir makes a root.
+ */
+struct dentry *d_alloc(struct dentry *dir, const char *name, size_t len) {
+    struct dentry *dentry = slub_alloc(dentry_cachep, SLUB_NONE);
+    unsigned long flags;
+
+    if (!dentry)
+        return NULL;
+
+    char *d_name = dentry->d_iname;
+    if (len >= DNAME_INLINE_LEN) {
+        d_name = kmalloc(len + 1, SLUB_NONE);
+        if (!d_name) {
+            kfree(dentry);
+            return NULL;
+        }
+    }
+    memcpy(d_name, name, len);
+    d_name[len] = 0;
+
+    dentry->d_name = d_name;
+    dentry->d_len = len;
+    dentry->d_hash_val = d_name_hash(dir, name, len);
+    dentry->d_count = 1;
+    dentry->d_inode = NULL;
+    dentry->d_parent = dir ? dget(dir) : dentry;
+    dentry->d_sb = dir ? dir->d_sb : NULL;
+    dentry->d_op = dir ? dir->d_op : NULL;
+    INIT_LIST_HEAD(&dentry->d_hash);
+    INIT_LIST_HEAD(&dentry->d_lru);
+
+    spin_lock_irqsave(&dcache_lock, flags);
+    ++nr_dentries;
+    spin_unlock_irqrestore(&dcache_lock, flags);
+    return dentry;
+}
+
+struct dentry *d_make_root(struct inode *inode) {
+    struct dentry *root = d_alloc(NULL, "/", 1);
+    if (!root)
+        return NULL;
+    root->d_inode = inode;
+    root->d_sb = inode->i_sb;
+    return root;
+}
+
+/*
+ * Hash a new dentry with @inode, NULL makes it negative. The inode
+ * reference passes to the dentry. If a racing walk already added the
+ * same name, @dentry is freed and that one is returned instead.
+ */
+struct dentry *d_add(struct dentry *dentry, struct inode *inode) {
+    struct dentry *old;
+    unsigned long flags;
+
+    dentry->d_inode = inode;
+
+    spin_lock_irqsave(&dcache_lock, flags);
+    old = __d_find(dentry->d_parent, dentry->d_name, dentry->d_len,
+                   dentry->d_hash_val);
+    if (old)
+        __dget(old);
+    else
+        list_add(&dentry->d_hash,
+                 d_hash(dentry->d_parent, dentry->d_hash_val));
+    spin_unlock_irqrestore(&dcache_lock, flags);
+
+    if (old) {
+        d_kill(dentry);
+        return old;
+    }
+    return dentry;
+}
+
+/* drop up to @nr unused dentries from the cold end of the LRU */
+static size_t prune_dcache(size_t nr) {
+    struct dentry *dentry;
+    unsigned long flags;
+    size_t freed = 0;
+
+    while (freed < nr) {
+        spin_lock_irqsave(&dcache_lock, flags);
+        dentry = list_empty(&dentry_lru)
+                     ? NULL
+                     : list_last_entry(&dentry_lru, struct dentry, d_lru);
+        if (dentry) {
+            __d_drop(dentry);
+            ++dcache_stats.pruned;
+        }
+        spin_unlock_irqrestore(&dcache_lock, flags);
+
+        if (!dentry)
+            break;
+        d_kill(dentry);
+        ++freed;
+    }
+    return freed;
+}
+
+static struct shrinker dcache_shrinker = {
+    .scan = prune_dcache,
+};
+
+void print_dcache_stats(void) {
+    printk("dcache: %d dentries %d unused, lookups %ld hits %ld negative %ld "
+           "pruned %ld\n",
+           nr_dentries, nr_unused, dcache_stats.lookups, dcache_stats.hits,
+           dcache_stats.negative, dcache_stats.pruned);
+}
+
+void dcache_init(void) {
+    for (int i = 0; i < D_HASH_SIZE; i++)
+        INIT_LIST_HEAD(&dentry_hash_table[i]);
+    dentry_cachep = kmem_cache_create("dentry", sizeof(struct dentry), 8,
+                                      SLUB_NONE, NULL);
+    register_shrinker(&dcache_shrinker);
+}
@@ -0,0 +1,93 @@
+#include <kernel/printk.h>
+
+#include <my-os/buffer_head.h>
+#include <my-os/compiler.h>
+#include <my-os/string.h>
+
+#include "ext2.h"
+
+static u8 ext2_dtype(u8 file_type) {
+    switch (file_type) {
+    case EXT2_FT_REG_FILE:
+        return DT_REG;
+    case EXT2_FT_DIR:
+        return DT_DIR;
+    case EXT2_FT_SYMLINK:
+        return DT_LNK;
+    default:
+        return DT_UNKNOWN;
+    }
+}
+
+static int ext2_readdir(struct inode *dir, filldir_t filldir, void *ctx) {
+    struct super_block *sb = dir->i_sb;
+    u32 nr_blocks = (dir->i_size + sb->s_blocksize - 1) >> sb->s_blocksize_bits;
+    u32 pblk = 0, len = 0;
+
+    for (u32 lblk = 0; lblk < nr_blocks; ++lblk, ++pblk, --len) {
+        if (!len && ext2_get_block(dir, lblk, &pblk, &len))
+            return -1;
+        if (!pblk)
+            continue;
+
+        struct buffer_head *bh = bread(sb->s_bdev, pblk, sb->s_blocksize);
+        if (!bh)
+            return -1;
+
+        for (u32 off = 0; off < sb->s_blocksize;) {
+            struct ext2_dir_entry *de = bh->b_data + off;
+
+            if (de->rec_len < EXT2_DIR_ENTRY_LEN(1) ||
+                de->rec_len < EXT2_DIR_ENTRY_LEN(de->name_len) ||
+                de->rec_len > sb->s_blocksize - off || (de->rec_len & 3)) {
+                printk("ext2: bad entry in directory %ld block %d\n",
+                       dir->i_ino, lblk);
+                brelse(bh);
+                return -1;
+            }
+
+            if (de->inode && filldir(ctx, de->name, de->name_len, de->inode,
+                                     ext2_dtype(de->file_type))) {
+                brelse(bh);
+                return 0;
+            }
+            off += de->rec_len;
+        }
+        brelse(bh);
+    }
+    return 0;
+}
+
+struct ext2_lookup_ctx {
+    const char *name;
+    size_t len;
+    u64 ino;
+};
+
+static int ext2_match(void *ctx, const char *name, size_t len, u64 ino,
+                      u8 type __always_unused) {
+    struct ext2_lookup_ctx *l = ctx;
+
+    if (len != l->len || memcmp(name, l->name, len))
+        return 0;
+    l->ino = ino;
+    return 1;
+}
+
+static int ext2_lookup(struct inode *dir, const char *name, size_t len,
+                       u64 *ino) {
+    struct ext2_lookup_ctx l = {.name = name, .len = len};
+
+    if (ext2_readdir(dir, ext2_match, &l))
+        return -1;
+    *ino = l.ino;
+    return 0;
+}
+
+const struct inode_operations ext2_dir_inode_operations = {
+    .lookup = ext2_lookup,
+};
+
+const struct file_operations ext2_dir_operations = {
+    .readdir = ext2_readdir,
+};
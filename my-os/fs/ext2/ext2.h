@@ -0,0 +1,167 @@
+#ifndef _FS_EXT2_EXT2_H
+#define _FS_EXT2_EXT2_H
+
+#include <my-os/fs.h>
+#include <my-os/kernel.h>
+#include <my-os/spinlock.h>
+#include <my-os/types.h>
+
+#define EXT2_SUPER_MAGIC 0xEF53
+#define EXT2_ROOT_INO 2
+
+#define EXT2_GOOD_OLD_REV 0
+#define EXT2_GOOD_OLD_INODE_SIZE 128
+#define EXT2_GOOD_OLD_FIRST_INO 11
+
+#define EXT2_MIN_BLOCK_SIZE 1024
+
+/* the only incompat feature needed to read the tree */
+#define EXT2_FEATURE_INCOMPAT_FILETYPE 0x0002
+#define EXT2_FEATURE_INCOMPAT_SUPP EXT2_FEATURE_INCOMPAT_FILETYPE
+
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE 0x0002
+
+#define EXT2_NDIR_BLOCKS 12
+#define EXT2_IND_BLOCK EXT2_NDIR_BLOCKS
+#define EXT2_DIND_BLOCK (EXT2_IND_BLOCK + 1)
+#define EXT2_TIND_BLOCK (EXT2_DIND_BLOCK + 1)
+#define EXT2_N_BLOCKS (EXT2_TIND_BLOCK + 1)
+
+/* ext2_dir_entry.file_type */
+#define EXT2_FT_UNKNOWN 0
+#define EXT2_FT_REG_FILE 1
+#define EXT2_FT_DIR 2
+#define EXT2_FT_SYMLINK 7
+
+/* on disk, at byte 1024 of the volume */
+struct ext2_super_block {
+    u32 s_inodes_count;
+    u32 s_blocks_count;
+    u32 s_r_blocks_count;
+    u32 s_free_blocks_count;
+    u32 s_free_inodes_count;
+    u32 s_first_data_block;
+    u32 s_log_block_size;
+    u32 s_log_frag_size;
+    u32 s_blocks_per_group;
+    u32 s_frags_per_group;
+    u32 s_inodes_per_group;
+    u32 s_mtime;
+    u32 s_wtime;
+    u16 s_mnt_count;
+    u16 s_max_mnt_count;
+    u16 s_magic;
+    u16 s_state;
+    u16 s_errors;
+    u16 s_minor_rev_level;
+    u32 s_lastcheck;
+    u32 s_checkinterval;
+    u32 s_creator_os;
+    u32 s_rev_level;
+    u16 s_def_resuid;
+    u16 s_def_resgid;
+    /* EXT2_DYNAMIC_REV */
+    u32 s_first_ino;
+    u16 s_inode_size;
+    u16 s_block_group_nr;
+    u32 s_feature_compat;
+    u32 s_feature_incompat;
+    u32 s_feature_ro_compat;
+    u8 s_uuid[16];
+    char s_volume_name[16];
+} __attribute__((packed));
+
+struct ext2_group_desc {
+    u32 bg_block_bitmap;
+    u32 bg_inode_bitmap;
+    u32 bg_inode_table;
+    u16 bg_free_blocks_count;
+    u16 bg_free_inodes_count;
+    u16 bg_used_dirs_count;
+    u16 bg_pad;
+    u32 bg_reserved[3];
+} __attribute__((packed));
+
+struct ext2_inode {
+    u16 i_mode;
+    u16 i_uid;
+    u32 i_size;
+    u32 i_atime;
+    u32 i_ctime;
+    u32 i_mtime;
+    u32 i_dtime;
+    u16 i_gid;
+    u16 i_links_count;
+    u32 i_blocks;
+    u32 i_flags;
+    u32 i_osd1;
+    u32 i_block[EXT2_N_BLOCKS];
+    u32 i_generation;
+    u32 i_file_acl;
+    u32 i_size_high; /* i_dir_acl before LARGE_FILE */
+    u32 i_faddr;
+    u8 i_osd2[12];
+} __attribute__((packed));
+
+struct ext2_dir_entry {
+    u32 inode;
+    u16 rec_len;
+    u8 name_len;
+    u8 file_type;
+    char name[];
+} __attribute__((packed));
+
+#define EXT2_DIR_ENTRY_LEN(name_len) ((8 + (name_len) + 3) & ~3)
+
+struct ext2_sb_info {
+    u32 s_inodes_per_group;
+    u32 s_blocks_per_group;
+    u32 s_first_data_block;
+    u32 s_groups_count;
+    u32 s_inode_size;
+    u32 s_addr_per_block_bits; /* log2 of block numbers per block */
+    u32 s_feature_ro_compat;
+    struct ext2_group_desc *s_group_desc;
+};
+
+static inline struct ext2_sb_info *EXT2_SB(struct super_block *sb) {
+    return sb->s_fs_info;
+}
+
+/*
+ * A run of logical blocks [lblk, lblk + len) that maps to the physical
+ * blocks [pblk, pblk + len), or a hole of len blocks if pblk is 0.
+ */
+struct ext2_extent {
+    u32 lblk;
+    u32 pblk;
+    u32 len;
+};
+
+struct ext2_inode_info {
+    struct inode vfs_inode;
+    u32 i_data[EXT2_N_BLOCKS];
+    u32 i_flags;
+    /* block map cache, sorted by lblk, runs never overlap */
+    spinlock_t i_map_lock;
+    struct ext2_extent *i_extents;
+    u32 i_nr_extents;
+    u32 i_max_extents;
+};
+
+static inline struct ext2_inode_info *EXT2_I(struct inode *inode) {
+    return container_of(inode, struct ext2_inode_info, vfs_inode);
+}
+
+/* inode.c */
+int ext2_read_inode(struct inode *inode);
+int ext2_get_block(struct inode *inode, u32 lblk, u32 *pblk, u32 *len);
+void print_ext2_map_stats(void);
+
+extern const struct file_operations ext2_file_operations;
+
+/* dir.c */
+extern const struct inode_operations ext2_dir_inode_operations;
+extern const struct file_operations ext2_dir_operations;
+
+#endif /* _FS_EXT2_EXT2_H */
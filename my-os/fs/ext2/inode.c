@@ -0,0 +1,306 @@
+#include <asm/irq.h>
+#include <kernel/printk.h>
+
+#include <my-os/buffer_head.h>
+#include <my-os/slub_alloc.h>
+#include <my-os/string.h>
+
+#include "ext2.h"
+
+/* the block map cache of an inode is dropped when it outgrows this */
+#define EXT2_MAX_EXTENTS 256
+
+static struct {
+    u64 lookups;
+    u64 hits;
+    u64 walks;
+    u64 indirect_reads;
+} ext2_map_stats;
+
+int ext2_read_inode(struct inode *inode) {
+    struct super_block *sb = inode->i_sb;
+    struct ext2_sb_info *sbi = EXT2_SB(sb);
+    struct ext2_inode_info *ei = EXT2_I(inode);
+
+    u64 ino = inode->i_ino;
+    if (!ino || ino > (u64)sbi->s_inodes_per_group * sbi->s_groups_count)
+        return -1;
+
+    u32 group = (ino - 1) / sbi->s_inodes_per_group;
+    u64 offset = (u64)((ino - 1) % sbi->s_inodes_per_group) *
+                 sbi->s_inode_size;
+    u64 block = sbi->s_group_desc[group].bg_inode_table +
+                (offset >> sb->s_blocksize_bits);
+
+    struct buffer_head *bh = bread(sb->s_bdev, block, sb->s_blocksize);
+    if (!bh)
+        return -1;
+
+    struct ext2_inode *raw = bh->b_data + (offset & (sb->s_blocksize - 1));
+    inode->i_mode = raw->i_mode;
+    inode->i_nlink = raw->i_links_count;
+    inode->i_size = raw->i_size;
+    if (S_ISREG(inode->i_mode) &&
+        (sbi->s_feature_ro_compat & EXT2_FEATURE_RO_COMPAT_LARGE_FILE))
+        inode->i_size |= (u64)raw->i_size_high << 32;
+    memcpy(ei->i_data, raw->i_block, sizeof(ei->i_data));
+    ei->i_flags = raw->i_flags;
+    brelse(bh);
+
+    if (!inode->i_nlink) {
+        printk("ext2: inode %ld is deleted\n", ino);
+        return -1;
+    }
+
+    if (S_ISDIR(inode->i_mode)) {
+        inode->i_op = &ext2_dir_inode_operations;
+        inode->i_fop = &ext2_dir_operations;
+    } else if (S_ISREG(inode->i_mode)) {
+        inode->i_fop = &ext2_file_operations;
+    }
+    return 0;
+}
+
+/*
+ * Map @lblk through the direct and indirect block pointers. *len is set to
+ * the number of blocks from @lblk on that stay physically contiguous, or
+ * stay holes, within the same pointer block, so one walk resolves a whole
+ * run of the file.
+ */
+static int ext2_walk_blocks(struct inode *inode, u32 lblk, u32 *pblk,
+                            u32 *len) {
+    struct super_block *sb = inode->i_sb;
+    u32 bits = EXT2_SB(sb)->s_addr_per_block_bits;
+    u64 per = 1ULL << bits;
+    u64 n = lblk;
+    u32 offsets[4];
+    int depth;
+
+    if (n < EXT2_NDIR_BLOCKS) {
+        offsets[0] = n;
+        depth = 1;
+    } else if ((n -= EXT2_NDIR_BLOCKS) < per) {
+        offsets[0] = EXT2_IND_BLOCK;
+        offsets[1] = n;
+        depth = 2;
+    } else if ((n -= per) < per * per) {
+        offsets[0] = EXT2_DIND_BLOCK;
+        offsets[1] = n >> bits;
+        offsets[2] = n & (per - 1);
+        depth = 3;
+    } else if ((n -= per * per) < per * per * per) {
+        offsets[0] = EXT2_TIND_BLOCK;
+        offsets[1] = n >> (bits * 2);
+        offsets[2] = (n >> bits) & (per - 1);
+        offsets[3] = n & (per - 1);
+        depth = 4;
+    } else {
+        return -1;
+    }
+
+    struct buffer_head *bh = NULL;
+    u32 *ptrs = EXT2_I(inode)->i_data;
+    u32 nr = EXT2_NDIR_BLOCKS;
+
+    for (int i = 0; i < depth - 1; ++i) {
+        u32 block = ptrs[offsets[i]];
+
+        if (!block) {
+            /* the rest of this subtree is a hole */
+            u64 off = 0;
+            for (int j = i + 1; j < depth; ++j)
+                off = (off << bits) | offsets[j];
+            *pblk = 0;
+            *len = (1ULL << (bits * (depth - 1 - i))) - off;
+            if (bh)
+                brelse(bh);
+            return 0;
+        }
+
+        if (bh)
+            brelse(bh);
+        bh = bread(sb->s_bdev, block, sb->s_blocksize);
+        if (!bh)
+            return -1;
+        __sync_add_and_fetch(&ext2_map_stats.indirect_reads, 1);
+        ptrs = bh->b_data;
+        nr = per;
+    }
+
+    u32 idx = offsets[depth - 1];
+    u32 first = ptrs[idx];
+    u32 run = 1;
+    while (idx + run < nr && ptrs[idx + run] == (first ? first + run : 0))
+        ++run;
+    *pblk = first;
+    *len = run;
+
+    if (bh)
+        brelse(bh);
+    return 0;
+}
+
+/* @b continues @a, both physically or both as holes */
+static bool ext2_extent_follows(const struct ext2_extent *a,
+                                const struct ext2_extent *b) {
+    if (a->lblk + a->len != b->lblk)
+        return false;
+    return a->pblk ? a->pblk + a->len == b->pblk : !b->pblk;
+}
+
+/* first extent starting after @lblk, the caller holds i_map_lock */
+static u32 __ext2_extent_pos(struct ext2_inode_info *ei, u32 lblk) {
+    u32 lo = 0, hi = ei->i_nr_extents;
+
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (ei->i_extents[mid].lblk <= lblk)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static struct ext2_extent *__ext2_find_extent(struct ext2_inode_info *ei,
+                                              u32 lblk) {
+    u32 pos = __ext2_extent_pos(ei, lblk);
+    if (!pos)
+        return NULL;
+
+    struct ext2_extent *e = &ei->i_extents[pos - 1];
+    return lblk - e->lblk < e->len ? e : NULL;
+}
+
+static void __ext2_insert_extent(struct ext2_inode_info *ei,
+                                 struct ext2_extent new) {
+    u32 pos = __ext2_extent_pos(ei, new.lblk);
+    struct ext2_extent *ext = ei->i_extents;
+
+    /* another walk may have cached a run that starts inside this one */
+    if (pos < ei->i_nr_extents && new.lblk + new.len > ext[pos].lblk)
+        new.len = ext[pos].lblk - new.lblk;
+    if (pos && ext[pos - 1].lblk + ext[pos - 1].len > new.lblk)
+        return;
+
+    if (pos && ext2_extent_follows(&ext[pos - 1], &new)) {
+        ext[pos - 1].len += new.len;
+        if (pos < ei->i_nr_extents &&
+            ext2_extent_follows(&ext[pos - 1], &ext[pos])) {
+            ext[pos - 1].len += ext[pos].len;
+            memmove(&ext[pos], &ext[pos + 1],
+                    (ei->i_nr_extents - pos - 1) * sizeof(*ext));
+            --ei->i_nr_extents;
+        }
+        return;
+    }
+    if (pos < ei->i_nr_extents && ext2_extent_follows(&new, &ext[pos])) {
+        ext[pos].lblk = new.lblk;
+        ext[pos].pblk = new.pblk;
+        ext[pos].len += new.len;
+        return;
+    }
+
+    if (ei->i_nr_extents == ei->i_max_extents) {
+        if (ei->i_max_extents == EXT2_MAX_EXTENTS) {
+            /* badly fragmented, start over rather than grow */
+            ei->i_nr_extents = 0;
+            pos = 0;
+        } else {
+            u32 max = ei->i_max_extents ? ei->i_max_extents * 2 : 8;
+            ext = krealloc(ext, max * sizeof(*ext), SLUB_NONE);
+            if (!ext)
+                return;
+            ei->i_extents = ext;
+            ei->i_max_extents = max;
+        }
+    }
+
+    memmove(&ext[pos + 1], &ext[pos],
+            (ei->i_nr_extents - pos) * sizeof(*ext));
+    ext[pos] = new;
+    ++ei->i_nr_extents;
+}
+
+/*
+ * Map logical block @lblk of @inode to its physical block, 0 for a hole.
+ * *len is set to how many blocks from @lblk on continue the same run, the
+ * caller can step through them without mapping each one.
+ */
+int ext2_get_block(struct inode *inode, u32 lblk, u32 *pblk, u32 *len) {
+    struct ext2_inode_info *ei = EXT2_I(inode);
+    struct ext2_extent *e;
+    unsigned long flags;
+
+    __sync_add_and_fetch(&ext2_map_stats.lookups, 1);
+
+    spin_lock_irqsave(&ei->i_map_lock, flags);
+    e = __ext2_find_extent(ei, lblk);
+    if (e) {
+        u32 off = lblk - e->lblk;
+        *pblk = e->pblk ? e->pblk + off : 0;
+        *len = e->len - off;
+    }
+    spin_unlock_irqrestore(&ei->i_map_lock, flags);
+
+    if (e) {
+        __sync_add_and_fetch(&ext2_map_stats.hits, 1);
+        return 0;
+    }
+
+    __sync_add_and_fetch(&ext2_map_stats.walks, 1);
+    if (ext2_walk_blocks(inode, lblk, pblk, len))
+        return -1;
+
+    struct ext2_extent new = {.lblk = lblk, .pblk = *pblk, .len = *len};
+    spin_lock_irqsave(&ei->i_map_lock, flags);
+    __ext2_insert_extent(ei, new);
+    spin_unlock_irqrestore(&ei->i_map_lock, flags);
+    return 0;
+}
+
+static ssize_t ext2_file_read(struct inode *inode, void *buf, size_t count,
+                              u64 pos) {
+    struct super_block *sb = inode->i_sb;
+    u32 pblk = 0, len = 0;
+    size_t done = 0;
+
+    if (pos >= inode->i_size)
+        return 0;
+    count = min(count, inode->i_size - pos);
+
+    while (done < count) {
+        u32 off = pos & (sb->s_blocksize - 1);
+        size_t chunk = min((size_t)(sb->s_blocksize - off), count - done);
+
+        if (!len && ext2_get_block(inode, pos >> sb->s_blocksize_bits, &pblk,
+                                   &len))
+            break;
+
+        if (pblk) {
+            struct buffer_head *bh = bread(sb->s_bdev, pblk, sb->s_blocksize);
+            if (!bh)
+                break;
+            memcpy(buf + done, bh->b_data + off, chunk);
+            brelse(bh);
+            ++pblk;
+        } else {
+            memset(buf + done, 0, chunk);
+        }
+        --len;
+
+        done += chunk;
+        pos += chunk;
+    }
+    return done ? (ssize_t)done : -1;
+}
+
+void print_ext2_map_stats(void) {
+    printk("ext2 map: lookups %ld, hits %ld, walks %ld, indirect reads %ld\n",
+           ext2_map_stats.lookups, ext2_map_stats.hits, ext2_map_stats.walks,
+           ext2_map_stats.indirect_reads);
+}
+
+const struct file_operations ext2_file_operations = {
+    .read = ext2_file_read,
+};
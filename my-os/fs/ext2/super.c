@@ -0,0 +1,153 @@
+#include <kernel/printk.h>
+
+#include <my-os/buffer_head.h>
+#include <my-os/compiler.h>
+#include <my-os/mm_types.h>
+#include <my-os/slub_alloc.h>
+#include <my-os/string.h>
+
+#include "ext2.h"
+
+static struct inode *ext2_alloc_inode(struct super_block *sb __always_unused) {
+    struct ext2_inode_info *ei =
+        kzalloc(sizeof(struct ext2_inode_info), SLUB_NONE);
+    if (!ei)
+        return NULL;
+    spin_lock_init(&ei->i_map_lock);
+    return &ei->vfs_inode;
+}
+
+static void ext2_destroy_inode(struct inode *inode) {
+    struct ext2_inode_info *ei = EXT2_I(inode);
+
+    if (ei->i_extents)
+        kfree(ei->i_extents);
+    kfree(ei);
+}
+
+static const struct super_operations ext2_sops = {
+    .alloc_inode = ext2_alloc_inode,
+    .destroy_inode = ext2_destroy_inode,
+    .read_inode = ext2_read_inode,
+};
+
+static int ext2_read_group_desc(struct super_block *sb,
+                                struct ext2_sb_info *sbi) {
+    size_t size = sbi->s_groups_count * sizeof(struct ext2_group_desc);
+    u64 block = sbi->s_first_data_block + 1;
+
+    sbi->s_group_desc = kmalloc(size, SLUB_NONE);
+    if (!sbi->s_group_desc)
+        return -1;
+
+    for (size_t off = 0; off < size; off += sb->s_blocksize, ++block) {
+        struct buffer_head *bh = bread(sb->s_bdev, block, sb->s_blocksize);
+        if (!bh) {
+            kfree(sbi->s_group_desc);
+            return -1;
+        }
+        memcpy((void *)sbi->s_group_desc + off, bh->b_data,
+               min((size_t)sb->s_blocksize, size - off));
+        brelse(bh);
+    }
+    return 0;
+}
+
+/*
+ * Mount the ext2 volume on @bdev read-only. Returns NULL if it isn't
+ * ext2 or uses features the read path doesn't understand.
+ */
+struct super_block *ext2_mount(struct block_device *bdev) {
+    struct buffer_head *bh = bread(bdev, 1, EXT2_MIN_BLOCK_SIZE);
+    if (!bh)
+        return NULL;
+
+    struct ext2_super_block *es = bh->b_data;
+    if (es->s_magic != EXT2_SUPER_MAGIC) {
+        printk("ext2: no ext2 superblock on %s\n", bdev->name);
+        brelse(bh);
+        return NULL;
+    }
+
+    u32 incompat = es->s_rev_level == EXT2_GOOD_OLD_REV
+                       ? 0
+                       : es->s_feature_incompat;
+    if (incompat & ~EXT2_FEATURE_INCOMPAT_SUPP) {
+        printk("ext2: %s has unsupported features %x\n", bdev->name,
+               incompat & ~EXT2_FEATURE_INCOMPAT_SUPP);
+        brelse(bh);
+        return NULL;
+    }
+
+    /* the buffer cache holds at most a page per block */
+    if (es->s_log_block_size > PAGE_SHIFT - 10 || !es->s_blocks_per_group ||
+        !es->s_inodes_per_group) {
+        printk("ext2: bad superblock on %s\n", bdev->name);
+        brelse(bh);
+        return NULL;
+    }
+
+    struct super_block *sb = kzalloc(sizeof(struct super_block), SLUB_NONE);
+    struct ext2_sb_info *sbi = kzalloc(sizeof(struct ext2_sb_info), SLUB_NONE);
+    if (!sb || !sbi) {
+        brelse(bh);
+        goto fail;
+    }
+
+    sb->s_bdev = bdev;
+    sb->s_blocksize_bits = es->s_log_block_size + 10;
+    sb->s_blocksize = 1 << sb->s_blocksize_bits;
+    sb->s_op = &ext2_sops;
+    sb->s_fs_info = sbi;
+
+    sbi->s_inodes_per_group = es->s_inodes_per_group;
+    sbi->s_blocks_per_group = es->s_blocks_per_group;
+    sbi->s_first_data_block = es->s_first_data_block;
+    sbi->s_groups_count =
+        (es->s_blocks_count - es->s_first_data_block +
+         es->s_blocks_per_group - 1) / es->s_blocks_per_group;
+    sbi->s_addr_per_block_bits = sb->s_blocksize_bits - 2;
+    if (es->s_rev_level == EXT2_GOOD_OLD_REV) {
+        sbi->s_inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+    } else {
+        sbi->s_inode_size = es->s_inode_size;
+        sbi->s_feature_ro_compat = es->s_feature_ro_compat;
+    }
+    brelse(bh);
+
+    if (sbi->s_inode_size < EXT2_GOOD_OLD_INODE_SIZE ||
+        sbi->s_inode_size > sb->s_blocksize ||
+        (sbi->s_inode_size & (sbi->s_inode_size - 1))) {
+        printk("ext2: bad inode size %d on %s\n", sbi->s_inode_size,
+               bdev->name);
+        goto fail;
+    }
+
+    if (ext2_read_group_desc(sb, sbi))
+        goto fail;
+
+    struct inode *root = iget(sb, EXT2_ROOT_INO);
+    if (!root || !S_ISDIR(root->i_mode)) {
+        printk("ext2: no root directory on %s\n", bdev->name);
+        goto fail_root;
+    }
+    sb->s_root = d_make_root(root);
+    if (!sb->s_root)
+        goto fail_root;
+
+    printk("ext2: %s mounted, %dK blocks, %d groups\n", bdev->name,
+           sb->s_blocksize >> 10, sbi->s_groups_count);
+    return sb;
+
+fail_root:
+    if (root)
+        iput(root);
+    evict_inodes(sb);
+    kfree(sbi->s_group_desc);
+fail:
+    if (sbi)
+        kfree(sbi);
+    if (sb)
+        kfree(sb);
+    return NULL;
+}
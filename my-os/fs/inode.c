@@ -0,0 +1,190 @@
+#include <asm/irq.h>
+#include <kernel/printk.h>
+
+#include <my-os/buddy_alloc.h>
+#include <my-os/fs.h>
+#include <my-os/spinlock.h>
+
+#define INODE_HASH_BITS 8
+#define INODE_HASH_SIZE (1 << INODE_HASH_BITS)
+
+/* unused inodes kept cached, the oldest are destroyed past this */
+#define INODE_MAX_UNUSED 256
+
+static DEFINE_SPINLOCK(inode_lock);
+static struct list_head inode_hash_table[INODE_HASH_SIZE];
+static LIST_HEAD(inode_lru); /* unused inodes, most recently released first */
+
+static u32 nr_inodes;
+static u32 nr_unused;
+
+static struct {
+    u64 lookups;
+    u64 hits;
+    u64 reads;
+} inode_stats;
+
+static struct list_head *inode_hash(struct super_block *sb, u64 ino) {
+    u64 key = ino ^ ((unsigned long)sb >> 4);
+    return &inode_hash_table[(key * 0x61c8864680b583ebULL) >>
+                             (64 - INODE_HASH_BITS)];
+}
+
+static struct inode *__find_inode(struct super_block *sb, u64 ino) {
+    struct inode *inode;
+    list_for_each_entry(inode, inode_hash(sb, ino), i_hash) {
+        if (inode->i_ino == ino && inode->i_sb == sb)
+            return inode;
+    }
+    return NULL;
+}
+
+/* an inode is on the LRU exactly while nobody holds a reference */
+static void __iget(struct inode *inode) {
+    if (!inode->i_count++) {
+        list_del(&inode->i_lru);
+        --nr_unused;
+    }
+}
+
+/* unhash an unused inode, the caller destroys it after dropping the lock */
+static void __unhash_inode(struct inode *inode) {
+    list_del(&inode->i_hash);
+    list_del(&inode->i_lru);
+    --nr_unused;
+    --nr_inodes;
+}
+
+/*
+ * Get the in-core inode @ino of @sb, reading it from disk unless it is
+ * cached. Returns NULL if it can't be read, drop it with iput().
+ */
+struct inode *iget(struct super_block *sb, u64 ino) {
+    struct inode *inode, *old;
+    unsigned long flags;
+
+    spin_lock_irqsave(&inode_lock, flags);
+    ++inode_stats.lookups;
+    inode = __find_inode(sb, ino);
+    if (inode) {
+        ++inode_stats.hits;
+        __iget(inode);
+    }
+    spin_unlock_irqrestore(&inode_lock, flags);
+    if (inode)
+        return inode;
+
+    inode = sb->s_op->alloc_inode(sb);
+    if (!inode)
+        return NULL;
+    inode->i_sb = sb;
+    inode->i_ino = ino;
+    inode->i_count = 1;
+    if (sb->s_op->read_inode(inode)) {
+        sb->s_op->destroy_inode(inode);
+        return NULL;
+    }
+
+    spin_lock_irqsave(&inode_lock, flags);
+    ++inode_stats.reads;
+    /* somebody else may have read it meanwhile */
+    old = __find_inode(sb, ino);
+    if (old) {
+        __iget(old);
+    } else {
+        list_add(&inode->i_hash, inode_hash(sb, ino));
+        ++nr_inodes;
+    }
+    spin_unlock_irqrestore(&inode_lock, flags);
+
+    if (old) {
+        sb->s_op->destroy_inode(inode);
+        return old;
+    }
+    return inode;
+}
+
+struct inode *igrab(struct inode *inode) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&inode_lock, flags);
+    __iget(inode);
+    spin_unlock_irqrestore(&inode_lock, flags);
+    return inode;
+}
+
+void iput(struct inode *inode) {
+    struct inode *victim = NULL;
+    unsigned long flags;
+
+    spin_lock_irqsave(&inode_lock, flags);
+    if (!--inode->i_count) {
+        list_add(&inode->i_lru, &inode_lru);
+        if (++nr_unused > INODE_MAX_UNUSED) {
+            victim = list_entry(inode_lru.prev, struct inode, i_lru);
+            __unhash_inode(victim);
+        }
+    }
+    spin_unlock_irqrestore(&inode_lock, flags);
+
+    if (victim)
+        victim->i_sb->s_op->destroy_inode(victim);
+}
+
+/* destroy the unused inodes of @sb, before it goes away */
+void evict_inodes(struct super_block *sb) {
+    struct inode *inode, *tmp;
+    LIST_HEAD(dispose);
+    unsigned long flags;
+
+    spin_lock_irqsave(&inode_lock, flags);
+    list_for_each_entry_safe(inode, tmp, &inode_lru, i_lru) {
+        if (inode->i_sb != sb)
+            continue;
+        __unhash_inode(inode);
+        list_add(&inode->i_lru, &dispose);
+    }
+    spin_unlock_irqrestore(&inode_lock, flags);
+
+    list_for_each_entry_safe(inode, tmp, &dispose, i_lru)
+        sb->s_op->destroy_inode(inode);
+}
+
+/* destroy up to @nr unused inodes from the cold end of the LRU */
+static size_t prune_icache(size_t nr) {
+    struct inode *inode;
+    unsigned long flags;
+    size_t freed = 0;
+
+    while (freed < nr) {
+        spin_lock_irqsave(&inode_lock, flags);
+        inode = list_empty(&inode_lru)
+                    ? NULL
+                    : list_last_entry(&inode_lru, struct inode, i_lru);
+        if (inode)
+            __unhash_inode(inode);
+        spin_unlock_irqrestore(&inode_lock, flags);
+
+        if (!inode)
+            break;
+        inode->i_sb->s_op->destroy_inode(inode);
+        ++freed;
+    }
+    return freed;
+}
+
+static struct shrinker icache_shrinker = {
+    .scan = prune_icache,
+};
+
+void print_inode_stats(void) {
+    printk("inode: %d inodes %d unused, lookups %ld hits %ld reads %ld\n",
+           nr_inodes, nr_unused, inode_stats.lookups, inode_stats.hits,
+           inode_stats.reads);
+}
+
+void inode_init(void) {
+    for (int i = 0; i < INODE_HASH_SIZE; i++)
+        INIT_LIST_HEAD(&inode_hash_table[i]);
+    register_shrinker(&icache_shrinker);
+}
@@ -0,0 +1,88 @@
+#include <my-os/fs.h>
+
+/*
+ * Resolve one component in @dir, from the dcache if it is known there,
+ * else through the filesystem, caching the answer either way.
+ */
+static struct dentry *walk_component(struct dentry *dir, const char *name,
+                                     size_t len) {
+    if (len == 1 && name[0] == '.')
+        return dget(dir);
+    if (len == 2 && name[0] == '.' && name[1] == '.')
+        return dget(dir->d_parent);
+    if (len > NAME_MAX)
+        return NULL;
+
+    struct dentry *dentry = d_lookup(dir, name, len);
+    if (dentry)
+        return dentry;
+
+    struct inode *inode = dir->d_inode;
+    if (!inode->i_op || !inode->i_op->lookup)
+        return NULL;
+
+    u64 ino;
+    if (inode->i_op->lookup(inode, name, len, &ino))
+        return NULL;
+
+    inode = NULL;
+    if (ino && !(inode = iget(dir->d_sb, ino)))
+        return NULL;
+
+    dentry = d_alloc(dir, name, len);
+    if (!dentry) {
+        if (inode)
+            iput(inode);
+        return NULL;
+    }
+    return d_add(dentry, inode);
+}
+
+/*
+ * Walk the absolute @path from the root of @sb. Returns the dentry with a
+ * reference held, or NULL if a component is missing.
+ */
+struct dentry *lookup_path(struct super_block *sb, const char *path) {
+    struct dentry *dentry = dget(sb->s_root);
+
+    for (;;) {
+        while (*path == '/')
+            ++path;
+        if (!*path)
+            break;
+
+        const char *name = path;
+        size_t len = 0;
+        while (path[len] && path[len] != '/')
+            ++len;
+        path += len;
+
+        if (!dentry->d_inode || !S_ISDIR(dentry->d_inode->i_mode)) {
+            dput(dentry);
+            return NULL;
+        }
+
+        struct dentry *next = walk_component(dentry, name, len);
+        dput(dentry);
+        if (!next)
+            return NULL;
+        dentry = next;
+    }
+
+    if (!dentry->d_inode) {
+        dput(dentry);
+        return NULL;
+    }
+    return dentry;
+}
+
+/* like lookup_path(), but returns the inode with a reference held */
+struct inode *namei(struct super_block *sb, const char *path) {
+    struct dentry *dentry = lookup_path(sb, path);
+    if (!dentry)
+        return NULL;
+
+    struct inode *inode = igrab(dentry->d_inode);
+    dput(dentry);
+    return inode;
+}
@@ -0,0 +1,33 @@
+#include <kernel/printk.h>
+
+#include <my-os/compiler.h>
+#include <my-os/fs.h>
+#include <my-os/string.h>
+
+struct super_block *root_sb;
+
+static int print_dirent(void *ctx __always_unused, const char *name,
+                        size_t len, u64 ino, u8 type) {
+    char buf[NAME_MAX + 1];
+
+    memcpy(buf, name, len);
+    buf[len] = 0;
+    printk("  %ld %c %s\n", ino,
+           type == DT_DIR ? 'd' : type == DT_LNK ? 'l' : '-', buf);
+    return 0;
+}
+
+void mount_root(const char *bdev_name) {
+    struct block_device *bdev = lookup_bdev(bdev_name);
+    if (!bdev) {
+        printk("mount_root: no block device %s\n", bdev_name);
+        return;
+    }
+
+    root_sb = ext2_mount(bdev);
+    if (!root_sb)
+        return;
+
+    printk("/:\n");
+    vfs_readdir(root_sb->s_root->d_inode, print_dirent, NULL);
+}
@@ -4,7 +4,8 @@
 extern char _boot_start[], _boot_end[];
 extern char _start[], _end[], _end_kernel[];
 extern char _data[], _edata[], _text[], _etext[], _bss[], _ebss[];
-extern char _brk_base[];
+extern char _brk_base[], _brk_limit[];
+extern char __per_cpu_start[], __per_cpu_end[];
 
 extern char KERNEL_LMA_END[];
 
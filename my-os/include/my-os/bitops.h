@@ -24,6 +24,12 @@ static inline int fls64(u64 x) {
     asm("bsrq %1,%q0" : "+r"(bitpos) : "rm"(x));
     return bitpos + 1;
 }
+
+/* index of the lowest set bit, undefined for 0 */
+static inline unsigned long __ffs64(u64 x) {
+    asm("rep; bsfq %1,%0" : "=r"(x) : "rm"(x));
+    return x;
+}
 #endif
 
 #endif /* _MY_OS_BITOPS_H */
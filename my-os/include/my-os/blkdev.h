@@ -0,0 +1,98 @@
+#ifndef _MY_OS_BLKDEV_H
+#define _MY_OS_BLKDEV_H
+
+#include <my-os/list.h>
+#include <my-os/spinlock.h>
+#include <my-os/types.h>
+
+#define SECTOR_SHIFT 9
+#define SECTOR_SIZE (1 << SECTOR_SHIFT)
+
+#define REQ_READ 0
+#define REQ_WRITE 1
+
+struct request;
+struct request_queue;
+
+typedef void(rq_end_io_fn)(struct request *rq, int error);
+/*
+ * Start @rq on the hardware. Called with q->lock held and interrupts
+ * disabled, at most one request is active per queue. A nonzero return
+ * fails the request without starting it.
+ */
+typedef int(request_fn_proc)(struct request_queue *q, struct request *rq);
+
+struct block_device {
+    const char *name;
+    u64 nr_sectors;
+    u32 max_sectors; /* per hardware command */
+    struct request_queue *queue;
+    void *private_data;
+    /* sequential read-ahead of the buffer cache, in blocks */
+    u64 ra_prev;
+    u64 ra_end;
+    u32 ra_size;
+    struct list_head list;
+};
+
+/*
+ * Requests for adjacent sectors are merged into one hardware command: the
+ * first one stays on the queue and the others hang off it in sector order
+ * through next_merged, each with its own buffer. hw_sectors is the length
+ * of the whole chain and is what the driver transfers.
+ */
+struct request {
+    struct list_head queuelist;
+    struct block_device *bdev;
+    int dir;
+    u64 sector;
+    u32 nr_sectors;
+    void *buffer;
+    int error;
+    rq_end_io_fn *end_io;
+    void *end_io_data;
+
+    u32 hw_sectors;
+    struct request *next_merged;
+    struct request *merge_tail;
+    /* requests above max_sectors are split into children */
+    struct request *parent;
+    u32 pending;
+};
+
+#define rq_for_each_merged(pos, rq)                                            \
+    for ((pos) = (rq); (pos); (pos) = (pos)->next_merged)
+
+struct request_queue {
+    spinlock_t lock;
+    struct list_head queue_head; /* sorted by sector */
+    struct request *active;
+    u64 head_pos; /* sector after the last dispatched command */
+    request_fn_proc *request_fn;
+    void *queuedata;
+    /* statistics */
+    u64 nr_requests;
+    u64 nr_dispatched;
+    u64 nr_merges;
+    u64 nr_splits;
+    u64 nr_errors;
+};
+
+void blk_init_queue(struct request_queue *q, request_fn_proc *rfn,
+                    void *queuedata);
+void blk_rq_init(struct request *rq, struct block_device *bdev, int dir,
+                 u64 sector, u32 nr_sectors, void *buffer);
+void submit_request(struct request *rq);
+void blk_end_request(struct request *rq, int error);
+int blk_execute_rq(struct request *rq);
+
+int blk_read(struct block_device *bdev, u64 sector, u32 nr_sectors,
+             void *buffer);
+int blk_write(struct block_device *bdev, u64 sector, u32 nr_sectors,
+              void *buffer);
+
+void print_blk_stats(struct request_queue *q);
+void register_blkdev(struct block_device *bdev);
+struct block_device *lookup_bdev(const char *name);
+
+#endif /* _MY_OS_BLKDEV_H */
@@ -1,13 +1,43 @@
 #ifndef _MY_OS_BUDDY_ALLOC_H
 #define _MY_OS_BUDDY_ALLOC_H
 
+#include <my-os/gfp.h>
+#include <my-os/list.h>
 #include <my-os/mm_types.h>
 #include <my-os/types.h>
 
+/*
+ * A cache that can give memory back. Once an allocation finds the zones
+ * down to their low watermark, kshrinkd runs the shrinkers in its own
+ * context.
+ */
+struct shrinker {
+    /* free up to @nr unused objects, returns how many were freed */
+    size_t (*scan)(size_t nr);
+    struct list_head list;
+};
+
 void init_buddy_alloc(void);
+/*
+ * Hand [start, end) of node @nid to the allocator, split at the zone
+ * boundaries. The metadata of each piece comes from the piece.
+ */
+int buddy_add_range(int nid, phys_addr_t start, phys_addr_t end);
+/* recompute the watermarks once memory was added */
+void setup_per_zone_wmarks(void);
+void setup_per_cpu_pageset(void);
 
 phys_addr_t _alloc_pages(size_t order);
 
+/*
+ * Pages of node @nid, or of the nearest node that has them. NUMA_NO_NODE
+ * means the node of the calling cpu, which is what alloc_pages() asks.
+ * The zone modifier of @gfp bounds the pages for devices, GFP_DMA32 pages
+ * lie below 4G and GFP_DMA pages below 16M.
+ */
+struct page *__alloc_pages_node(int nid, gfp_t gfp, size_t order);
+struct page *__alloc_pages(gfp_t gfp, size_t order);
+struct page *alloc_pages_node(int nid, size_t order);
 struct page *alloc_pages(size_t order);
 
 static inline struct page *alloc_page() { return alloc_pages(0); }
@@ -16,4 +46,13 @@ void free_pages(struct page *);
 
 size_t pages_size(struct page *);
 
+void drain_local_pages(void);
+
+void register_shrinker(struct shrinker *shrinker);
+/* no locks held, interrupts on */
+size_t shrink_caches(void);
+void kshrinkd_init(void);
+
+void print_pcp_stats(void);
+
 #endif /* _MY_OS_BUDDY_ALLOC_H */
@@ -0,0 +1,56 @@
+#ifndef _MY_OS_BUFFER_HEAD_H
+#define _MY_OS_BUFFER_HEAD_H
+
+#include <my-os/blkdev.h>
+#include <my-os/completion.h>
+#include <my-os/list.h>
+#include <my-os/types.h>
+
+/* b_state */
+#define BH_UPTODATE (1 << 0) /* b_data matches the disk or is newer */
+#define BH_DIRTY (1 << 1)    /* b_data is newer, needs write back */
+#define BH_LOCK (1 << 2)     /* i/o in flight */
+#define BH_ERROR (1 << 3)    /* the last i/o failed */
+
+/*
+ * A cached block of a block device. Buffers are found through a hash of
+ * (b_bdev, b_blocknr, b_size) and sit on the LRU while nobody holds a
+ * reference, the least recently released ones are evicted first.
+ */
+struct buffer_head {
+    u32 b_state;
+    u32 b_count;
+    struct block_device *b_bdev;
+    u64 b_blocknr;
+    u32 b_size;
+    void *b_data;
+    struct list_head b_hash;
+    struct list_head b_lru;
+    struct list_head b_dirty;
+    struct request b_rq;
+    struct completion b_wait;
+};
+
+static inline bool buffer_uptodate(struct buffer_head *bh) {
+    return bh->b_state & BH_UPTODATE;
+}
+
+static inline bool buffer_dirty(struct buffer_head *bh) {
+    return bh->b_state & BH_DIRTY;
+}
+
+static inline bool buffer_locked(struct buffer_head *bh) {
+    return bh->b_state & BH_LOCK;
+}
+
+void buffer_init(void);
+struct buffer_head *getblk(struct block_device *bdev, u64 block, u32 size);
+struct buffer_head *bread(struct block_device *bdev, u64 block, u32 size);
+void brelse(struct buffer_head *bh);
+void wait_on_buffer(struct buffer_head *bh);
+void mark_buffer_dirty(struct buffer_head *bh);
+int sync_dirty_buffer(struct buffer_head *bh);
+int sync_blockdev(struct block_device *bdev);
+void print_buffer_stats(void);
+
+#endif /* _MY_OS_BUFFER_HEAD_H */
@@ -0,0 +1,36 @@
+#ifndef _MY_OS_CLOCKCHIPS_H
+#define _MY_OS_CLOCKCHIPS_H
+
+#include <my-os/ktime.h>
+#include <my-os/types.h>
+
+#define CLOCK_EVT_FEAT_PERIODIC 0x1
+#define CLOCK_EVT_FEAT_ONESHOT 0x2
+
+/*
+ * A per-cpu timer that raises one interrupt at a programmed time. The
+ * device with the highest rating of a cpu runs its hrtimers and tick.
+ */
+struct clock_event_device {
+    const char *name;
+    u32 features;
+    int rating;
+    int cpu;
+    /* interrupt in @delta device cycles, nonzero if that is already past */
+    int (*set_next_event)(u64 delta, struct clock_event_device *dev);
+    void (*event_handler)(struct clock_event_device *dev);
+    u64 mult; /* cycles per ns, 32.32 fixed point */
+    u64 min_delta_ns;
+    u64 max_delta_ns;
+    ktime_t next_event;
+    /* statistics */
+    u64 nr_events;
+    u64 nr_retries;
+};
+
+void clockevents_config_and_register(struct clock_event_device *dev, u64 freq,
+                                     u64 min_delta, u64 max_delta);
+int clockevents_program_event(struct clock_event_device *dev, ktime_t expires);
+struct clock_event_device *clockevents_get_device(int cpu);
+
+#endif /* _MY_OS_CLOCKCHIPS_H */
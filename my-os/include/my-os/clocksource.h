@@ -0,0 +1,25 @@
+#ifndef _MY_OS_CLOCKSOURCE_H
+#define _MY_OS_CLOCKSOURCE_H
+
+#include <my-os/ktime.h>
+#include <my-os/types.h>
+
+/*
+ * A free running counter. The one with the highest rating drives
+ * ktime_get(), cycles are turned into ns with mult.
+ */
+struct clocksource {
+    const char *name;
+    u64 (*read)(struct clocksource *cs);
+    u64 mask; /* the counter wraps at mask + 1 */
+    int rating;
+    u64 mult;        /* ns per cycle, 32.32 fixed point */
+    u64 max_idle_ns; /* longest time without timekeeping_update() */
+};
+
+void clocksource_register_hz(struct clocksource *cs, u64 hz);
+struct clocksource *clocksource_current(void);
+/* fold the elapsed cycles into the clock, before the counter can wrap */
+void timekeeping_update(void);
+
+#endif /* _MY_OS_CLOCKSOURCE_H */
@@ -3,6 +3,7 @@
 #include <my-os/types.h>
 
 #define __force
+#define __always_unused __attribute__((unused))
 
 #define likely(x) __builtin_expect(!!(x), 1)
 #define unlikely(x) __builtin_expect(!!(x), 0)
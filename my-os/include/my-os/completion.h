@@ -0,0 +1,42 @@
+#ifndef _MY_OS_COMPLETION_H
+#define _MY_OS_COMPLETION_H
+
+#include <my-os/list.h>
+#include <my-os/spinlock.h>
+#include <my-os/types.h>
+
+/*
+ * One side waits for an event that the other side, often an irq handler,
+ * signals with complete(). Waiters sleep instead of spinning; the idle task
+ * can not sleep and halts between interrupts instead.
+ */
+struct completion {
+    u32 done;
+    spinlock_t lock;
+    struct list_head wait;
+};
+
+#define COMPLETION_INITIALIZER(work)                                           \
+    {                                                                          \
+        .done = 0, .lock = __SPIN_LOCK_UNLOCKED((work).lock),                  \
+        .wait = LIST_HEAD_INIT((work).wait)                                    \
+    }
+
+#define DECLARE_COMPLETION(work)                                               \
+    struct completion work = COMPLETION_INITIALIZER(work)
+
+static inline void init_completion(struct completion *x) {
+    x->done = 0;
+    spin_lock_init(&x->lock);
+    INIT_LIST_HEAD(&x->wait);
+}
+
+/* Reuse after complete_all(), late waiters just wait for the next one. */
+static inline void reinit_completion(struct completion *x) { x->done = 0; }
+
+void wait_for_completion(struct completion *x);
+bool try_wait_for_completion(struct completion *x);
+void complete(struct completion *x);
+void complete_all(struct completion *x);
+
+#endif /* _MY_OS_COMPLETION_H */
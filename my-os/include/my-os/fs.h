@@ -1,20 +1,143 @@
 #pragma once
 
+#include <my-os/blkdev.h>
+#include <my-os/list.h>
+#include <my-os/types.h>
+
+#define S_IFMT 00170000
+#define S_IFLNK 0120000
+#define S_IFREG 0100000
+#define S_IFDIR 0040000
+
+#define S_ISLNK(m) (((m)&S_IFMT) == S_IFLNK)
+#define S_ISREG(m) (((m)&S_IFMT) == S_IFREG)
+#define S_ISDIR(m) (((m)&S_IFMT) == S_IFDIR)
+
+/* directory entry types passed to filldir_t */
+#define DT_UNKNOWN 0
+#define DT_REG 1
+#define DT_DIR 2
+#define DT_LNK 7
+
+#define NAME_MAX 255
+
+struct dentry;
+struct inode;
+struct super_block;
 
 struct super_block {
+    struct block_device *s_bdev;
+    u32 s_blocksize;
+    u8 s_blocksize_bits;
+    struct dentry *s_root;
+    const struct super_operations *s_op;
+    void *s_fs_info;
 };
 
 struct inode {
+    u64 i_ino;
+    u16 i_mode;
+    u16 i_nlink;
+    u64 i_size;
+    u32 i_count;
+    struct super_block *i_sb;
+    const struct inode_operations *i_op;
+    const struct file_operations *i_fop;
+    struct list_head i_hash;
+    struct list_head i_lru; /* unused inodes, while i_count is zero */
 };
 
 struct super_operations {
-    
+    /* allocate the fs specific inode, with struct inode embedded */
+    struct inode *(*alloc_inode)(struct super_block *sb);
+    void (*destroy_inode)(struct inode *inode);
+    /* fill a new inode from disk, i_ino is set */
+    int (*read_inode)(struct inode *inode);
 };
 
 struct inode_operations {
-    
+    /* *ino is the inode number of @name in @dir, 0 if there is none */
+    int (*lookup)(struct inode *dir, const char *name, size_t len, u64 *ino);
+};
+
+#define DNAME_INLINE_LEN 32
+
+/*
+ * A name in a directory, cached so path walks don't ask the filesystem
+ * again. d_inode is NULL for a negative dentry, a name known not to
+ * exist. Dentries with no reference sit on the LRU, a dentry holds a
+ * reference to its parent and its inode.
+ */
+struct dentry {
+    u32 d_count;
+    u32 d_hash_val;
+    struct inode *d_inode;
+    struct dentry *d_parent; /* the root is its own parent */
+    struct super_block *d_sb;
+    const struct dentry_operations *d_op;
+    const char *d_name;
+    u32 d_len;
+    struct list_head d_hash;
+    struct list_head d_lru;
+    char d_iname[DNAME_INLINE_LEN];
 };
 
 struct dentry_operations {
-    
+    /* hash of @name in @dir, for filesystems with their own name rules */
+    u32 (*d_hash)(const struct dentry *dir, const char *name, size_t len);
+    /* zero if @name in @dir names @dentry */
+    int (*d_compare)(const struct dentry *dentry, const char *name,
+                     size_t len);
+};
+
+/* return nonzero to stop the iteration */
+typedef int (*filldir_t)(void *ctx, const char *name, size_t len, u64 ino,
+                         u8 type);
+
+struct file_operations {
+    ssize_t (*read)(struct inode *inode, void *buf, size_t count, u64 pos);
+    int (*readdir)(struct inode *dir, filldir_t filldir, void *ctx);
 };
+
+/* fs/inode.c */
+void inode_init(void);
+struct inode *iget(struct super_block *sb, u64 ino);
+struct inode *igrab(struct inode *inode);
+void iput(struct inode *inode);
+void evict_inodes(struct super_block *sb);
+void print_inode_stats(void);
+
+/* fs/dcache.c */
+void dcache_init(void);
+struct dentry *d_make_root(struct inode *inode);
+struct dentry *d_lookup(struct dentry *dir, const char *name, size_t len);
+struct dentry *d_alloc(struct dentry *dir, const char *name, size_t len);
+struct dentry *d_add(struct dentry *dentry, struct inode *inode);
+struct dentry *dget(struct dentry *dentry);
+void dput(struct dentry *dentry);
+void print_dcache_stats(void);
+
+/* fs/namei.c */
+struct dentry *lookup_path(struct super_block *sb, const char *path);
+struct inode *namei(struct super_block *sb, const char *path);
+
+static inline ssize_t vfs_read(struct inode *inode, void *buf, size_t count,
+                               u64 pos) {
+    if (!inode->i_fop || !inode->i_fop->read)
+        return -1;
+    return inode->i_fop->read(inode, buf, count, pos);
+}
+
+static inline int vfs_readdir(struct inode *dir, filldir_t filldir,
+                              void *ctx) {
+    if (!dir->i_fop || !dir->i_fop->readdir)
+        return -1;
+    return dir->i_fop->readdir(dir, filldir, ctx);
+}
+
+/* fs/super.c */
+extern struct super_block *root_sb;
+void mount_root(const char *bdev_name);
+
+/* fs/ext2 */
+struct super_block *ext2_mount(struct block_device *bdev);
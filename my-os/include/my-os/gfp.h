@@ -0,0 +1,30 @@
+#ifndef _MY_OS_GFP_H
+#define _MY_OS_GFP_H
+
+#include <my-os/mm_types.h>
+#include <my-os/types.h>
+
+typedef unsigned int gfp_t;
+
+/* zone modifiers, the highest zone the memory may come from */
+#define __GFP_DMA 0x01U
+#define __GFP_DMA32 0x04U
+#define GFP_ZONEMASK (__GFP_DMA | __GFP_DMA32)
+
+#define __GFP_HIGH 0x20U  /* May use half of the min reserve */
+#define __GFP_ZERO 0x100U /* Return zeroed memory */
+
+#define GFP_KERNEL 0U
+#define GFP_ATOMIC __GFP_HIGH
+#define GFP_DMA __GFP_DMA
+#define GFP_DMA32 __GFP_DMA32
+
+static inline enum zone_type gfp_zone(gfp_t flags) {
+    if (flags & __GFP_DMA)
+        return ZONE_DMA;
+    if (flags & __GFP_DMA32)
+        return ZONE_DMA32;
+    return ZONE_NORMAL;
+}
+
+#endif /* _MY_OS_GFP_H */
@@ -0,0 +1,63 @@
+#ifndef _MY_OS_HRTIMER_H
+#define _MY_OS_HRTIMER_H
+
+#include <my-os/ktime.h>
+#include <my-os/rbtree.h>
+#include <my-os/spinlock.h>
+#include <my-os/types.h>
+
+struct clock_event_device;
+struct hrtimer_cpu_base;
+
+enum hrtimer_mode {
+    HRTIMER_MODE_ABS, /* expires is a ktime_get() value */
+    HRTIMER_MODE_REL, /* expires is relative to now */
+};
+
+enum hrtimer_restart {
+    HRTIMER_NORESTART,
+    HRTIMER_RESTART, /* the callback moved expires forward */
+};
+
+#define HRTIMER_STATE_INACTIVE 0
+#define HRTIMER_STATE_ENQUEUED 1
+
+/*
+ * A one-shot timer with ns resolution. Timers are kept in a per-cpu
+ * red-black tree ordered by expiry, the first one programs the cpu's
+ * clock event device. The callback runs in irq context on the cpu the
+ * timer was last started on.
+ */
+struct hrtimer {
+    struct rb_node node;
+    ktime_t expires;
+    enum hrtimer_restart (*function)(struct hrtimer *timer);
+    struct hrtimer_cpu_base *base;
+    u32 state;
+};
+
+struct hrtimer_cpu_base {
+    spinlock_t lock;
+    struct rb_root_cached active;
+    ktime_t expires_next; /* what the event device is programmed for */
+    struct hrtimer *running;
+    bool in_hrtirq;
+    int cpu;
+};
+
+void hrtimers_init(void);
+void hrtimer_init(struct hrtimer *timer,
+                  enum hrtimer_restart (*function)(struct hrtimer *));
+void hrtimer_start(struct hrtimer *timer, ktime_t expires,
+                   enum hrtimer_mode mode);
+int hrtimer_try_to_cancel(struct hrtimer *timer);
+int hrtimer_cancel(struct hrtimer *timer);
+u64 hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval);
+void hrtimer_reprogram_next(ktime_t limit);
+void hrtimer_interrupt(struct clock_event_device *dev);
+
+static inline bool hrtimer_active(const struct hrtimer *timer) {
+    return timer->state & HRTIMER_STATE_ENQUEUED;
+}
+
+#endif /* _MY_OS_HRTIMER_H */
@@ -0,0 +1,36 @@
+#ifndef _MY_OS_KTIME_H
+#define _MY_OS_KTIME_H
+
+#include <my-os/types.h>
+
+/* nanoseconds on the monotonic clock */
+typedef s64 ktime_t;
+
+#define KTIME_MAX ((ktime_t)(~0ULL >> 1))
+
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+
+#define HZ 1000
+#define TICK_NSEC (NSEC_PER_SEC / HZ)
+
+/* @num / @den as 32.32 fixed point, min(@num, @den) must fit in 32 bits */
+static inline u64 div_frac32(u64 num, u64 den) {
+    return ((num / den) << 32) + ((num % den) << 32) / den;
+}
+
+/* @a times the 32.32 fixed point @frac */
+static inline u64 mul_frac32(u64 a, u64 frac) {
+    return ((unsigned __int128)a * frac) >> 32;
+}
+
+ktime_t ktime_get(void);
+
+/*
+ * ns since boot from the cheapest clock of the cpu, for the scheduler.
+ * Monotonic on one cpu only.
+ */
+u64 sched_clock(void);
+
+#endif /* _MY_OS_KTIME_H */
@@ -30,6 +30,11 @@ static inline void list_add(struct list_head *new, struct list_head *head) {
     __list_add(new, head, head->next);
 }
 
+static inline void list_add_tail(struct list_head *new,
+                                 struct list_head *head) {
+    __list_add(new, head->prev, head);
+}
+
 static inline void __list_del(struct list_head *prev, struct list_head *next) {
     next->prev = prev;
     prev->next = next;
@@ -41,6 +46,11 @@ static inline void list_del(struct list_head *entry) {
     entry->prev = NULL;
 }
 
+static inline void list_del_init(struct list_head *entry) {
+    __list_del(entry->prev, entry->next);
+    INIT_LIST_HEAD(entry);
+}
+
 #define list_for_each(pos, head)                                               \
     for (pos = (head)->next; pos != (head); pos = (pos)->next)
 
@@ -66,6 +76,12 @@ static inline void list_del(struct list_head *entry) {
     for (entry = list_last_entry(head, typeof(*entry), member);                \
          &entry->member != (head); entry = list_prev_entry(entry, member))
 
+/* @entry may be removed from the list while iterating */
+#define list_for_each_entry_safe(entry, n, head, member)                       \
+    for (entry = list_first_entry(head, typeof(*entry), member),               \
+        n = list_next_entry(entry, member);                                    \
+         &entry->member != (head); entry = n, n = list_next_entry(n, member))
+
 static inline size_t list_len(struct list_head *head) {
     struct list_head *p;
     size_t i = 0;
@@ -0,0 +1,61 @@
+#ifndef _MY_OS_LLIST_H
+#define _MY_OS_LLIST_H
+
+#include <my-os/kernel.h>
+#include <my-os/types.h>
+
+/*
+ * Lock-less singly linked list. Any number of cpus may llist_add()
+ * concurrently, the consumer takes the whole list at once with
+ * llist_del_all(). Entries come back newest first.
+ */
+struct llist_node {
+    struct llist_node *next;
+};
+
+struct llist_head {
+    struct llist_node *first;
+};
+
+#define LLIST_HEAD_INIT(name)                                                  \
+    { NULL }
+
+static inline void init_llist_head(struct llist_head *list) {
+    list->first = NULL;
+}
+
+static inline bool llist_empty(const struct llist_head *head) {
+    return *(struct llist_node *volatile *)&head->first == NULL;
+}
+
+/* returns true if the list was empty before */
+static inline bool llist_add(struct llist_node *new, struct llist_head *head) {
+    struct llist_node *first = head->first, *old;
+
+    do {
+        old = first;
+        new->next = old;
+    } while ((first = __sync_val_compare_and_swap(&head->first, old, new)) !=
+             old);
+    return !old;
+}
+
+static inline struct llist_node *llist_del_all(struct llist_head *head) {
+    return __sync_lock_test_and_set(&head->first, NULL);
+}
+
+static inline struct llist_node *llist_reverse_order(struct llist_node *head) {
+    struct llist_node *new_head = NULL;
+
+    while (head) {
+        struct llist_node *tmp = head;
+        head = head->next;
+        tmp->next = new_head;
+        new_head = tmp;
+    }
+    return new_head;
+}
+
+#define llist_entry(ptr, type, member) container_of(ptr, type, member)
+
+#endif /* _MY_OS_LLIST_H */
@@ -0,0 +1,74 @@
+#ifndef _MY_OS_LOCKSTAT_H
+#define _MY_OS_LOCKSTAT_H
+
+#include <my-os/types.h>
+
+/*
+ * Lock statistics, built in with -DLOCK_STAT. All locks initialized at the
+ * same place share a class and are accounted together. A class shows up
+ * in print_lock_stats() once one of its locks was taken.
+ */
+struct lock_class {
+    const char *name;
+    struct lock_class *next;
+    u32 registered;
+    u64 acquisitions;
+    u64 contentions;
+    u64 wait_cycles;
+    u64 max_wait_cycles;
+};
+
+#ifdef LOCK_STAT
+
+#include <asm/msr.h>
+
+/* only valid at file scope, the class must outlive the lock */
+#define __LOCK_CLASS(n) .class = &(struct lock_class){.name = n},
+#define lock_class_of(l) ((l)->class)
+
+#define lock_class_init(l, n)                                                  \
+    do {                                                                       \
+        static struct lock_class __class = {.name = n};                        \
+        (l)->class = &__class;                                                 \
+    } while (0)
+
+void lock_class_register(struct lock_class *class);
+
+static inline u64 lock_stat_start(void) { return rdtsc(); }
+
+/* the lock was taken after waiting since @start, 0 if it was free */
+static inline void lock_stat_acquired(struct lock_class *class, u64 start) {
+    if (!class)
+        return;
+    if (!class->registered)
+        lock_class_register(class);
+
+    __sync_fetch_and_add(&class->acquisitions, 1);
+    if (!start)
+        return;
+
+    u64 wait = rdtsc() - start, max = class->max_wait_cycles, old;
+    __sync_fetch_and_add(&class->contentions, 1);
+    __sync_fetch_and_add(&class->wait_cycles, wait);
+    while (wait > max &&
+           (old = __sync_val_compare_and_swap(&class->max_wait_cycles, max,
+                                              wait)) != max)
+        max = old;
+}
+
+#else
+
+#define __LOCK_CLASS(n)
+#define lock_class_of(l) NULL
+#define lock_class_init(l, n)                                                  \
+    do {                                                                       \
+    } while (0)
+
+static inline u64 lock_stat_start(void) { return 0; }
+#define lock_stat_acquired(class, start) ((void)(class), (void)(start))
+
+#endif
+
+void print_lock_stats(void);
+
+#endif /* _MY_OS_LOCKSTAT_H */
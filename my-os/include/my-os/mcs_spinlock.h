@@ -0,0 +1,75 @@
+#ifndef _MY_OS_MCS_SPINLOCK_H
+#define _MY_OS_MCS_SPINLOCK_H
+
+#include <my-os/spinlock.h>
+
+/*
+ * Queued lock for contended paths. Each waiter brings a node, usually on
+ * its stack, links it behind the tail and spins on its own node until the
+ * previous owner hands the lock over. Waiters do not all hammer the cache
+ * line of the lock as they do with a ticket lock.
+ */
+struct mcs_spinlock {
+    struct mcs_spinlock *volatile next;
+    volatile u32 locked;
+};
+
+struct mcs_lock {
+    struct mcs_spinlock *volatile tail;
+#ifdef LOCK_STAT
+    struct lock_class *class;
+#endif
+};
+
+#define __MCS_LOCK_UNLOCKED(name)                                              \
+    { .tail = NULL, __LOCK_CLASS(#name) }
+
+#define DEFINE_MCS_LOCK(x) struct mcs_lock x = __MCS_LOCK_UNLOCKED(x)
+
+#define mcs_lock_init(lock)                                                    \
+    do {                                                                       \
+        (lock)->tail = NULL;                                                   \
+        lock_class_init(lock, #lock);                                          \
+    } while (0)
+
+static inline void mcs_spin_lock(struct mcs_lock *lock,
+                                 struct mcs_spinlock *node) {
+    struct mcs_spinlock *prev;
+    u64 start = 0;
+
+    preempt_disable();
+    node->next = NULL;
+    node->locked = 0;
+    prev = __sync_lock_test_and_set(&lock->tail, node);
+    if (prev) {
+        start = lock_stat_start();
+        prev->next = node;
+        while (!node->locked)
+            cpu_relax();
+    }
+    barrier();
+    lock_stat_acquired(lock_class_of(lock), start);
+}
+
+static inline void mcs_spin_unlock(struct mcs_lock *lock,
+                                   struct mcs_spinlock *node) {
+    struct mcs_spinlock *next = node->next;
+
+    barrier();
+    if (!next) {
+        /* no successor yet, or one that has not linked itself in */
+        if (__sync_bool_compare_and_swap(&lock->tail, node, NULL))
+            goto out;
+        while (!(next = node->next))
+            cpu_relax();
+    }
+    next->locked = 1;
+out:
+    preempt_enable();
+}
+
+static inline bool mcs_is_locked(struct mcs_lock *lock) {
+    return lock->tail != NULL;
+}
+
+#endif /* _MY_OS_MCS_SPINLOCK_H */
@@ -23,6 +23,12 @@ struct memblock {
     struct memblock_type reserved;
 };
 
+extern struct memblock __init_memblock;
+
+/* walk the regions of memory or reserved, in address order */
+#define for_each_memblock(type, region)                                        \
+    list_for_each_entry(region, &__init_memblock.type.regions.list, list)
+
 int memblock_add(phys_addr_t base , size_t size);
 int memblock_reserve(phys_addr_t base , size_t size);
 int memblock_free(phys_addr_t base, size_t size);
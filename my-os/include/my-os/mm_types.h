@@ -3,6 +3,8 @@
 
 #include <asm/page.h>
 #include <my-os/list.h>
+#include <my-os/mcs_spinlock.h>
+#include <my-os/numa.h>
 
 struct mm_struct {
     pml4e_t *top_page;
@@ -16,34 +18,78 @@ struct page {
     unsigned int flags;
     int _refcount;
     union {
+        /* free page on a per-cpu list */
+        struct list_head lru;
         struct {
             struct list_head slub_list;
             struct kmem_cache *slub_cache;
+            /* freelist and counters are swapped together by cmpxchg16b */
             void *freelist;
-            unsigned inuse : 16;
-            unsigned objects : 15;
-            unsigned frozen : 1;
+            union {
+                unsigned long counters;
+                struct {
+                    unsigned inuse : 16;
+                    unsigned objects : 15;
+                    unsigned frozen : 1;
+                };
+            };
         };
     };
 };
 
 extern struct page *mem_map;
 
-struct free_area {
-    struct list_head free_list;
-    unsigned long nr_free;
-};
+/* low bits of flags hold the order of an allocated block's head page */
+#define PAGE_ORDER_MASK 0xf
+
+static inline unsigned int page_order(struct page *page) {
+    return page->flags & PAGE_ORDER_MASK;
+}
+
+static inline void set_page_order(struct page *page, unsigned int order) {
+    page->flags = (page->flags & ~PAGE_ORDER_MASK) | order;
+}
 
 #define MAX_ORDER 11
+
+enum zone_type {
+    ZONE_DMA,   /* below 16M, for isa dma */
+    ZONE_DMA32, /* below 4G, for 32-bit bus masters */
+    ZONE_NORMAL,
+    __MAX_NR_ZONES
+};
+
+#define MAX_NR_ZONES __MAX_NR_ZONES
+
+enum zone_watermarks { WMARK_MIN, WMARK_LOW, WMARK_HIGH, NR_WMARK };
+
 struct zone {
-    struct free_area free_area[MAX_ORDER];
+    /* buddy allocators of the zone's memory ranges, in address order */
+    struct list_head buddy_list;
+    /* cpus of every node refill and drain through it, waiters queue */
+    struct mcs_lock lock;
+    /*
+     * Allocations stop at the low mark and only dig down to min once the
+     * caches were shrunk. lowmem_reserve[z] is kept on top of that from
+     * allocations that could have been served by the higher zone z.
+     */
+    unsigned long watermark[NR_WMARK];
+    unsigned long lowmem_reserve[MAX_NR_ZONES];
+    unsigned long managed_pages;
+    unsigned long free_pages;
+    unsigned long zone_start_pfn;
+    int node;
+    const char *name;
 };
 
-#define MAX_NR_ZONES 4 /* __MAX_NR_ZONES */
 struct pglist_data {
     struct zone node_zones[MAX_NR_ZONES];
-    int nr_zones;
+    int node_id;
     unsigned long node_start_pfn;
+    unsigned long node_present_pages;
+    /* online nodes by slit distance, the node itself first */
+    int node_fallback[MAX_NUMNODES];
+    int nr_fallback;
 };
 
 #define PAGE_SHIFT 12
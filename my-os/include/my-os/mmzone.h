@@ -0,0 +1,93 @@
+#ifndef _MY_OS_MMZONE_H
+#define _MY_OS_MMZONE_H
+
+#include <asm/page_types.h>
+#include <kernel/mm.h>
+#include <my-os/mm_types.h>
+#include <my-os/numa.h>
+#include <my-os/types.h>
+
+/*
+ * Physical memory is tracked in sections. Only sections with memory in
+ * them get their part of vmemmap populated, so holes cost neither page
+ * structs nor buddy metadata. The table has two levels and a root page
+ * is only allocated once one of its sections shows up.
+ */
+struct mem_section {
+    unsigned long flags;
+};
+
+#define SECTION_MARKED_PRESENT (1UL << 0)
+#define SECTION_HAS_MEM_MAP (1UL << 1)
+/* node of the memory in the section, above the flag bits */
+#define SECTION_NID_SHIFT 8
+
+#define PFN_SECTION_SHIFT (SECTION_SIZE_BITS - PAGE_SHIFT)
+#define PAGES_PER_SECTION (1UL << PFN_SECTION_SHIFT)
+#define PAGE_SECTION_MASK (~(PAGES_PER_SECTION - 1))
+
+#define NR_MEM_SECTIONS (1UL << (MAX_PHYSMEM_BITS - SECTION_SIZE_BITS))
+#define SECTIONS_PER_ROOT (PAGE_SIZE / sizeof(struct mem_section))
+#define NR_SECTION_ROOTS (NR_MEM_SECTIONS / SECTIONS_PER_ROOT)
+
+extern struct mem_section *mem_section[NR_SECTION_ROOTS];
+
+static inline unsigned long pfn_to_section_nr(unsigned long pfn) {
+    return pfn >> PFN_SECTION_SHIFT;
+}
+
+static inline unsigned long section_nr_to_pfn(unsigned long nr) {
+    return nr << PFN_SECTION_SHIFT;
+}
+
+static inline struct mem_section *__nr_to_section(unsigned long nr) {
+    struct mem_section *root;
+
+    if (nr >= NR_MEM_SECTIONS)
+        return NULL;
+    root = mem_section[nr / SECTIONS_PER_ROOT];
+    if (!root)
+        return NULL;
+    return root + nr % SECTIONS_PER_ROOT;
+}
+
+static inline struct mem_section *__pfn_to_section(unsigned long pfn) {
+    return __nr_to_section(pfn_to_section_nr(pfn));
+}
+
+static inline bool present_section(struct mem_section *ms) {
+    return ms && (ms->flags & SECTION_MARKED_PRESENT);
+}
+
+static inline bool valid_section(struct mem_section *ms) {
+    return ms && (ms->flags & SECTION_HAS_MEM_MAP);
+}
+
+/* the page struct of @pfn exists */
+static inline bool pfn_valid(unsigned long pfn) {
+    return valid_section(__pfn_to_section(pfn));
+}
+
+static inline int page_to_nid(struct page *page) {
+    struct mem_section *ms = __pfn_to_section(page_to_pfn(page));
+    return ms ? ms->flags >> SECTION_NID_SHIFT : 0;
+}
+
+extern struct pglist_data node_data[MAX_NUMNODES];
+#define NODE_DATA(nid) (&node_data[nid])
+
+/* nearest node with memory to the calling cpu */
+static inline int numa_mem_id(void) {
+    struct pglist_data *pgdat = NODE_DATA(numa_node_id());
+    return pgdat->nr_fallback ? pgdat->node_fallback[0] : 0;
+}
+
+void sparse_init(void);
+
+/*
+ * Bring a section aligned range of new memory of node @nid online: map
+ * it, give it page structs and hand it to the buddy allocator.
+ */
+int add_memory(int nid, phys_addr_t start, size_t size);
+
+#endif /* _MY_OS_MMZONE_H */
@@ -0,0 +1,44 @@
+#ifndef _MY_OS_NUMA_H
+#define _MY_OS_NUMA_H
+
+#include <asm/percpu.h>
+#include <my-os/types.h>
+
+#define NODES_SHIFT 3
+#define MAX_NUMNODES (1 << NODES_SHIFT)
+#define NUMA_NO_NODE (-1)
+
+/* slit distances, a node to itself and the default between two nodes */
+#define LOCAL_DISTANCE 10
+#define REMOTE_DISTANCE 20
+
+/* nodes with memory, or memory that can be hot-added */
+extern u64 node_online_mask;
+
+static inline bool node_online(int nid) {
+    return node_online_mask & (1ULL << nid);
+}
+
+static inline void set_node_online(int nid) {
+    __sync_fetch_and_or(&node_online_mask, 1ULL << nid);
+}
+
+#define for_each_online_node(nid)                                              \
+    for ((nid) = 0; (nid) < MAX_NUMNODES; (nid)++)                             \
+        if (node_online(nid))
+
+/* the node of each cpu, set up with the per-cpu areas */
+DECLARE_PER_CPU(int, numa_node);
+
+static inline int numa_node_id(void) { return this_cpu_read(numa_node); }
+
+int cpu_to_node(int cpu);
+int node_distance(int from, int to);
+
+/*
+ * Node of the memory at @addr. @end is set to where that node's range
+ * ends, or where the next described range starts.
+ */
+int phys_to_nid(phys_addr_t addr, phys_addr_t *end);
+
+#endif /* _MY_OS_NUMA_H */
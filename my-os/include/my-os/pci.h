@@ -1,6 +1,11 @@
 #pragma once
 #include <my-os/list.h>
 
+#define PCI_COMMAND 0x04
+#define PCI_COMMAND_IO 0x1
+#define PCI_COMMAND_MEMORY 0x2
+#define PCI_COMMAND_MASTER 0x4
+
 struct pci_device_config {
     u16 vendor_id;
     u16 device_id;
@@ -49,3 +54,4 @@ struct pci_device {
 
 void pci_bus(void);
 struct pci_device *get_pci_device(u8 class_code, u8 sub_class);
+void pci_set_master(struct pci_device *dev);
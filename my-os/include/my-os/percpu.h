@@ -0,0 +1,36 @@
+#ifndef _MY_OS_PERCPU_H
+#define _MY_OS_PERCPU_H
+
+#include <asm/percpu.h>
+#include <my-os/types.h>
+
+/*
+ * Per-cpu variables are linked into .data..percpu, which is only the
+ * template copied into the area of each cpu. A cpu reaches its own copy
+ * through %gs, any copy is reached with per_cpu() and the offsets below.
+ * Until the areas are set up every offset is 0 and the template is used.
+ */
+DECLARE_PER_CPU(unsigned long, this_cpu_off);
+
+#define per_cpu_ptr(ptr, cpu)                                                  \
+    ((__typeof__(ptr))((unsigned long)(ptr) + __per_cpu_offset[cpu]))
+
+#define per_cpu(var, cpu) (*per_cpu_ptr(&(var), cpu))
+
+#define this_cpu_ptr(ptr)                                                      \
+    ((__typeof__(ptr))((unsigned long)(ptr) + this_cpu_read(this_cpu_off)))
+
+/* bytes at least left in every area for alloc_percpu() */
+#define PERCPU_DYNAMIC_RESERVE (4 << 10)
+
+void setup_per_cpu_areas(void);
+
+/*
+ * Zeroed per-cpu memory, used through per_cpu_ptr() and this_cpu_ptr().
+ * It comes from the reserve and can not be freed.
+ */
+void *__alloc_percpu(size_t size, size_t align);
+#define alloc_percpu(type)                                                     \
+    ((type *)__alloc_percpu(sizeof(type), __alignof__(type)))
+
+#endif /* _MY_OS_PERCPU_H */
@@ -0,0 +1,56 @@
+#ifndef _MY_OS_PREEMPT_H
+#define _MY_OS_PREEMPT_H
+
+#include <asm/percpu.h>
+
+#include <my-os/compiler.h>
+
+/*
+ * Every interrupt return may switch tasks through preempt_schedule_irq(),
+ * unless the count of the cpu is raised. Lock holders raise it, so a task
+ * is never switched out while it holds or waits for a spinlock and the
+ * cpus queued behind it do not spin on a lock whose owner is off the cpu.
+ * The count is per cpu and stays with the cpu across a task switch. The
+ * run queue lock, handed from the task switching out to the one
+ * switching in, is a raw lock and leaves it alone.
+ *
+ * preempt_enable() does not reschedule itself, a pending switch happens
+ * at the next interrupt return.
+ */
+DECLARE_PER_CPU(int, __preempt_count);
+
+/* the bits from HARDIRQ_SHIFT up count the irq handlers running */
+#define HARDIRQ_SHIFT 16
+#define HARDIRQ_OFFSET (1 << HARDIRQ_SHIFT)
+#define HARDIRQ_MASK (0xff << HARDIRQ_SHIFT)
+
+#define preempt_count() this_cpu_read(__preempt_count)
+#define preemptible() (preempt_count() == 0)
+#define in_interrupt() (preempt_count() & HARDIRQ_MASK)
+
+/* around do_IRQ() */
+#define irq_enter()                                                            \
+    do {                                                                       \
+        this_cpu_add(__preempt_count, HARDIRQ_OFFSET);                         \
+        barrier();                                                             \
+    } while (0)
+
+#define irq_exit()                                                             \
+    do {                                                                       \
+        barrier();                                                             \
+        this_cpu_sub(__preempt_count, HARDIRQ_OFFSET);                         \
+    } while (0)
+
+#define preempt_disable()                                                      \
+    do {                                                                       \
+        this_cpu_inc(__preempt_count);                                         \
+        barrier();                                                             \
+    } while (0)
+
+#define preempt_enable()                                                       \
+    do {                                                                       \
+        barrier();                                                             \
+        this_cpu_dec(__preempt_count);                                         \
+    } while (0)
+
+#endif /* _MY_OS_PREEMPT_H */
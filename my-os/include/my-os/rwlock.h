@@ -0,0 +1,103 @@
+#ifndef _MY_OS_RWLOCK_H
+#define _MY_OS_RWLOCK_H
+
+#include <my-os/spinlock.h>
+
+/*
+ * Reader-writer lock. The low byte of cnts is the writer state, readers
+ * are counted above it. Readers get in directly while no writer holds or
+ * waits for the lock, everyone else queues on wait_lock in order, so a
+ * stream of readers can not starve a writer.
+ *
+ * A reader in an interrupt may have interrupted a reader of the same
+ * lock on its cpu, while a writer waits on wait_lock for that reader to
+ * leave. So it does not queue: it only waits for a writer that holds the
+ * lock. Outside interrupts a cpu must not take the lock for reading
+ * twice, the second read would queue behind the waiting writer.
+ */
+typedef struct {
+    volatile u32 cnts;
+    raw_spinlock_t wait_lock; /* taken with the preempt count raised */
+#ifdef LOCK_STAT
+    struct lock_class *class;
+#endif
+} rwlock_t;
+
+#define _QW_WAITING 0x01
+#define _QW_LOCKED 0xff
+#define _QW_WMASK 0xff
+#define _QR_BIAS 0x100
+
+#define __RW_LOCK_UNLOCKED(name)                                               \
+    { .cnts = 0, .wait_lock = {.val = 0}, __LOCK_CLASS(#name) }
+
+#define DEFINE_RWLOCK(x) rwlock_t x = __RW_LOCK_UNLOCKED(x)
+
+#define rwlock_init(lock)                                                      \
+    do {                                                                       \
+        (lock)->cnts = 0;                                                      \
+        (lock)->wait_lock = (raw_spinlock_t){.val = 0};                        \
+        lock_class_init(lock, #lock);                                          \
+    } while (0)
+
+void queued_read_lock_slowpath(rwlock_t *lock);
+void queued_write_lock_slowpath(rwlock_t *lock);
+
+static inline void read_lock(rwlock_t *lock) {
+    preempt_disable();
+    u32 cnts = __sync_fetch_and_add(&lock->cnts, _QR_BIAS);
+
+    if (cnts & _QW_WMASK) {
+        queued_read_lock_slowpath(lock);
+        return;
+    }
+    barrier();
+    lock_stat_acquired(lock_class_of(lock), 0);
+}
+
+static inline void read_unlock(rwlock_t *lock) {
+    barrier();
+    __sync_fetch_and_sub(&lock->cnts, _QR_BIAS);
+    preempt_enable();
+}
+
+static inline void write_lock(rwlock_t *lock) {
+    preempt_disable();
+    if (!__sync_bool_compare_and_swap(&lock->cnts, 0, _QW_LOCKED)) {
+        queued_write_lock_slowpath(lock);
+        return;
+    }
+    lock_stat_acquired(lock_class_of(lock), 0);
+}
+
+static inline void write_unlock(rwlock_t *lock) {
+    barrier();
+    __sync_fetch_and_sub(&lock->cnts, _QW_LOCKED);
+    preempt_enable();
+}
+
+#define read_lock_irqsave(lock, flags)                                         \
+    do {                                                                       \
+        local_irq_save(flags);                                                 \
+        read_lock(lock);                                                       \
+    } while (0)
+
+#define read_unlock_irqrestore(lock, flags)                                    \
+    do {                                                                       \
+        read_unlock(lock);                                                     \
+        local_irq_restore(flags);                                              \
+    } while (0)
+
+#define write_lock_irqsave(lock, flags)                                        \
+    do {                                                                       \
+        local_irq_save(flags);                                                 \
+        write_lock(lock);                                                      \
+    } while (0)
+
+#define write_unlock_irqrestore(lock, flags)                                   \
+    do {                                                                       \
+        write_unlock(lock);                                                    \
+        local_irq_restore(flags);                                              \
+    } while (0)
+
+#endif /* _MY_OS_RWLOCK_H */
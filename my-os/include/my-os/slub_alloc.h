@@ -1,27 +1,32 @@
 #ifndef _MY_OS_SLUB_ALLOC_H
 #define _MY_OS_SLUB_ALLOC_H
 
+#include <asm/smp.h>
+#include <my-os/gfp.h>
 #include <my-os/list.h>
+#include <my-os/numa.h>
+#include <my-os/spinlock.h>
 #include <my-os/types.h>
 
-typedef unsigned int gfp_t;
 typedef unsigned int slub_flags_t;
 
 struct kmem_cache_node {
+    spinlock_t list_lock;
     unsigned long nr_partial;
     struct list_head partial;
     /* u64 nr_slabs; */
     /* u64 total_objects; */
 };
 
+/* freelist and tid are swapped together by cmpxchg16b */
 struct kmem_cache_cpu {
-    void **freelist;      /* Pointer to next available object */
-    struct page *page;    /* The slab from which we are allocating */
-    struct page *partial; /* Partially allocated frozen slabs */
-};
+    void **freelist;   /* Pointer to next available object */
+    unsigned long tid; /* Globally unique transaction id */
+    struct page *page; /* The slab from which we are allocating */
+} __attribute__((aligned(16)));
 
 struct kmem_cache {
-    struct kmem_cache_cpu cpu_slab;
+    struct kmem_cache_cpu *cpu_slab; /* per-cpu */
     unsigned int size;        /* The size of an object including metadata */
     unsigned int object_size; /* The size of an object without metadata */
     unsigned int offset;
@@ -32,15 +37,25 @@ struct kmem_cache {
     int refcount;       /* Refcount for slab cache destroy */
     const char *name;
     void (*ctor)(void *);
-    struct kmem_cache_node node;
+    /* partial slabs by the node of their memory */
+    struct kmem_cache_node node[MAX_NUMNODES];
     struct list_head list;
 };
 
+#define SLUB_NONE 0x0U
+
 void *kmalloc(size_t size, gfp_t flags);
 void kfree(void *);
 void *krealloc(void *p, size_t size, gfp_t flags);
 void kmem_cache_init(void);
 
-#define SLUB_NONE 0x0U
+static inline void *kzalloc(size_t size, gfp_t flags) {
+    return kmalloc(size, flags | __GFP_ZERO);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size,
+                                     unsigned int align, slub_flags_t flags,
+                                     void (*ctor)(void *));
+void *slub_alloc(struct kmem_cache *s, gfp_t gfpflags);
 
 #endif /* _MY_OS_SLUB_ALLOC_H */
@@ -0,0 +1,45 @@
+#ifndef _MY_OS_SMP_H
+#define _MY_OS_SMP_H
+
+#include <asm/smp.h>
+
+#include <my-os/llist.h>
+#include <my-os/types.h>
+
+typedef void (*smp_call_func_t)(void *info);
+
+#define CSD_FLAG_LOCK 0x01 /* queued or running, not to be reused */
+#define CSD_FLAG_SYNCHRONOUS 0x02 /* the sender waits for func to return */
+
+struct call_single_data {
+    struct llist_node llist;
+    smp_call_func_t func;
+    void *info;
+    volatile u32 flags;
+};
+
+/*
+ * Run @func(@info) on other cpus from their call function ipi, with
+ * interrupts disabled there. With @wait the caller spins until every
+ * target returned; it keeps serving calls sent to itself meanwhile, so
+ * two cpus calling each other do not deadlock.
+ */
+int smp_call_function_single(int cpu, smp_call_func_t func, void *info,
+                             bool wait);
+void smp_call_function_many(u64 mask, smp_call_func_t func, void *info,
+                            bool wait);
+void smp_call_function(smp_call_func_t func, void *info, bool wait);
+/*
+ * Like smp_call_function_many(), and @func also runs on this cpu when it
+ * is in @mask. The cpus are picked and the local call made without a
+ * chance to migrate in between.
+ */
+void on_each_cpu_mask(u64 mask, smp_call_func_t func, void *info, bool wait);
+/* on_each_cpu_mask() over every online cpu */
+void on_each_cpu(smp_call_func_t func, void *info, bool wait);
+
+void generic_smp_call_function_interrupt(void);
+void call_function_init(void);
+void print_smp_call_stats(void);
+
+#endif /* _MY_OS_SMP_H */
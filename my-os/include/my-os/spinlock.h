@@ -0,0 +1,166 @@
+#ifndef _MY_OS_SPINLOCK_H
+#define _MY_OS_SPINLOCK_H
+
+#include <asm/irq.h>
+
+#include <my-os/compiler.h>
+#include <my-os/lockstat.h>
+#include <my-os/preempt.h>
+#include <my-os/types.h>
+
+/*
+ * Ticket lock. A cpu takes the next ticket from tail and spins until head
+ * reaches it, so waiters get the lock in the order they arrived. Both
+ * halves are read at once through val.
+ *
+ * A raw lock leaves the preempt count alone. It is for the locks that
+ * are only taken where nothing can preempt anyway: the run queue lock,
+ * which is handed from the task switching out to the one switching in,
+ * and the lock inside a rwlock_t. Everything else uses spinlock_t, whose
+ * holders and waiters can not be preempted. A lock an irq handler takes
+ * is still only taken with interrupts off, spin_lock_irqsave().
+ */
+typedef struct {
+    union {
+        volatile u32 val;
+        struct {
+            volatile u16 head;
+            volatile u16 tail;
+        };
+    };
+#ifdef LOCK_STAT
+    struct lock_class *class;
+#endif
+} raw_spinlock_t;
+
+typedef struct {
+    raw_spinlock_t rlock;
+} spinlock_t;
+
+#define TICKET_SHIFT 16
+
+#define __RAW_SPIN_LOCK_UNLOCKED(name)                                         \
+    { .val = 0, __LOCK_CLASS(#name) }
+
+#define __SPIN_LOCK_UNLOCKED(name)                                             \
+    { .rlock = __RAW_SPIN_LOCK_UNLOCKED(name) }
+
+#define DEFINE_RAW_SPINLOCK(x) raw_spinlock_t x = __RAW_SPIN_LOCK_UNLOCKED(x)
+#define DEFINE_SPINLOCK(x) spinlock_t x = __SPIN_LOCK_UNLOCKED(x)
+
+static inline void cpu_relax(void) { asm volatile("pause" : : : "memory"); }
+
+#define raw_spin_lock_init(lock)                                               \
+    do {                                                                       \
+        (lock)->val = 0;                                                       \
+        lock_class_init(lock, #lock);                                          \
+    } while (0)
+
+#define spin_lock_init(lock)                                                   \
+    do {                                                                       \
+        (lock)->rlock.val = 0;                                                 \
+        lock_class_init(&(lock)->rlock, #lock);                                \
+    } while (0)
+
+static inline bool raw_spin_trylock(raw_spinlock_t *lock) {
+    u32 old = lock->val;
+
+    if ((u16)old != old >> TICKET_SHIFT ||
+        __sync_val_compare_and_swap(&lock->val, old,
+                                    old + (1 << TICKET_SHIFT)) != old)
+        return false;
+    lock_stat_acquired(lock_class_of(lock), 0);
+    return true;
+}
+
+static inline void raw_spin_lock(raw_spinlock_t *lock) {
+    u32 old = __sync_fetch_and_add(&lock->val, 1 << TICKET_SHIFT);
+    u16 ticket = old >> TICKET_SHIFT;
+    u64 start = 0;
+
+    if ((u16)old != ticket) {
+        start = lock_stat_start();
+        while (lock->head != ticket)
+            cpu_relax();
+    }
+    barrier();
+    lock_stat_acquired(lock_class_of(lock), start);
+}
+
+/* only the owner writes head, the increment needs no lock prefix */
+static inline void raw_spin_unlock(raw_spinlock_t *lock) {
+    barrier();
+    asm volatile("addw $1, %0" : "+m"(lock->head) : : "memory", "cc");
+}
+
+static inline bool raw_spin_is_locked(raw_spinlock_t *lock) {
+    u32 val = lock->val;
+    return (u16)val != val >> TICKET_SHIFT;
+}
+
+static inline bool raw_spin_is_contended(raw_spinlock_t *lock) {
+    u32 val = lock->val;
+    return (u16)((val >> TICKET_SHIFT) - val) > 1;
+}
+
+#define raw_spin_lock_irqsave(lock, flags)                                     \
+    do {                                                                       \
+        local_irq_save(flags);                                                 \
+        raw_spin_lock(lock);                                                   \
+    } while (0)
+
+#define raw_spin_unlock_irqrestore(lock, flags)                                \
+    do {                                                                       \
+        raw_spin_unlock(lock);                                                 \
+        local_irq_restore(flags);                                              \
+    } while (0)
+
+static inline bool spin_trylock(spinlock_t *lock) {
+    preempt_disable();
+    if (raw_spin_trylock(&lock->rlock))
+        return true;
+    preempt_enable();
+    return false;
+}
+
+static inline void spin_lock(spinlock_t *lock) {
+    preempt_disable();
+    raw_spin_lock(&lock->rlock);
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+    raw_spin_unlock(&lock->rlock);
+    preempt_enable();
+}
+
+static inline bool spin_is_locked(spinlock_t *lock) {
+    return raw_spin_is_locked(&lock->rlock);
+}
+
+static inline bool spin_is_contended(spinlock_t *lock) {
+    return raw_spin_is_contended(&lock->rlock);
+}
+
+static inline void spin_lock_irq(spinlock_t *lock) {
+    irq_disable();
+    spin_lock(lock);
+}
+
+static inline void spin_unlock_irq(spinlock_t *lock) {
+    spin_unlock(lock);
+    irq_enable();
+}
+
+#define spin_lock_irqsave(lock, flags)                                         \
+    do {                                                                       \
+        local_irq_save(flags);                                                 \
+        spin_lock(lock);                                                       \
+    } while (0)
+
+#define spin_unlock_irqrestore(lock, flags)                                    \
+    do {                                                                       \
+        spin_unlock(lock);                                                     \
+        local_irq_restore(flags);                                              \
+    } while (0)
+
+#endif /* _MY_OS_SPINLOCK_H */
@@ -3,6 +3,8 @@
 
 #include <my-os/types.h>
 
+void string_init(void);
+
 size_t strlen(const char *);
 
 void *memset(void *s, int c, size_t n);
@@ -23,4 +25,8 @@ int memcmp(const void *cs, const void *ct, size_t count);
 
 char *strdup(const char *s);
 
+void clear_page(void *page);
+
+void copy_page(void *to, const void *from);
+
 #endif /* X86_KERNEL_STRING_H */
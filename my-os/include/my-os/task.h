@@ -1,37 +1,57 @@
 #pragma once
 
+#include <asm/current.h>
 #include <asm/page_types.h>
 
 #include <my-os/mm_types.h>
 #include <my-os/rbtree.h>
+#include <my-os/spinlock.h>
 
 struct cfs_rq;
+struct task_struct;
 
 struct sched_entity {
     struct rb_node run_node;
     u64 vruntime;
     u64 weight;
-    u64 sum_exec_runtime;
+    u64 exec_start; /* sched_clock() when it was last charged */
+    u64 sum_exec_runtime; /* ns */
     u64 prev_sum_exec_runtime;
     struct cfs_rq *cfs_rq;
+    u32 on_rq; /* queued on cfs_rq, running or runnable */
 };
 
 struct cfs_rq {
+    raw_spinlock_t lock;
     struct rb_root_cached tasks_timeline;
     struct sched_entity *curr;
+    struct task_struct *idle; /* runs when tasks_timeline is empty */
     u64 weight;
     u32 nr_running;
+    u32 cpu;
     u64 min_vruntime;
-    u64 clock_task;
+    u64 clock_task; /* ns its tasks and idle ran */
+    u64 next_balance;
+    /* statistics */
+    u64 nr_switches;
+    u64 nr_migrations;
 };
 
 struct cfs_rq *get_rq();
+struct cfs_rq *cpu_rq(int cpu);
+
+typedef void (worker_routine)();
 
 struct thread_struct {
     unsigned long sp;
     unsigned long ip;
 };
 
+#define TASK_RUNNING 0
+#define TASK_INTERRUPTIBLE 1
+#define TASK_UNINTERRUPTIBLE 2
+#define TASK_DEAD 4 /* its routine returned, never woken again */
+
 struct task_struct {
     volatile long state;
     struct sched_entity se;
@@ -41,6 +61,7 @@ struct task_struct {
     const char *name;
     struct list_head tasks;
     struct thread_struct thread;
+    worker_routine *routine;
 };
 
 #define TIF_NEED_RESCHED 3 /* rescheduling necessary */
@@ -53,13 +74,9 @@ union thread_union {
 extern union thread_union init_thread_union;
 extern struct task_struct *init_task;
 
-extern struct task_struct *get_current(void);
-#define current get_current()
 void set_current(struct task_struct *task);
 #define task_top_of_stack(task) ((unsigned long)(task) + THREAD_SIZE)
 
-typedef void (worker_routine)();
-
 struct task_struct *create_task(const char *name, worker_routine routine);
 
 // sched
@@ -72,11 +89,20 @@ static inline struct sched_entity *sched_of(struct rb_node *node) {
 }
 
 void schedule_init();
+void init_idle(struct task_struct *idle, int cpu);
 void schedule_irq_init();
-void rq_enqueue(struct sched_entity *se);
-void rq_dequeue(struct sched_entity *se);
+void schedule(void);
+void _schedule(void); /* interrupts must be disabled */
+void schedule_tail(void);
+void cpu_idle(void);
+void rq_enqueue(struct cfs_rq *rq, struct sched_entity *se);
+void rq_dequeue(struct cfs_rq *rq, struct sched_entity *se);
 void activate_task(struct cfs_rq *rq, struct task_struct *task);
 void deactivate_task(struct cfs_rq *rq, struct task_struct *task);
+void wake_up_new_task(struct task_struct *task);
+bool wake_up_process(struct task_struct *task);
+bool is_idle_task(struct task_struct *task);
+void print_sched_stats(void);
 int nice(int i);
 void context_switch(struct task_struct *prev, struct task_struct *next);
-extern u64 jiffies_64;
+void scheduler_tick(void);
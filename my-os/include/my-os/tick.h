@@ -0,0 +1,16 @@
+#ifndef _MY_OS_TICK_H
+#define _MY_OS_TICK_H
+
+#include <my-os/ktime.h>
+#include <my-os/types.h>
+
+extern u64 jiffies_64;
+/* cpus idling with their tick stopped */
+extern u64 nohz_idle_mask;
+
+void tick_setup(int cpu);
+void tick_nohz_idle_enter(void);
+void tick_nohz_idle_exit(void);
+void print_tick_stats(void);
+
+#endif /* _MY_OS_TICK_H */
@@ -4,18 +4,25 @@
 #include <asm/io.h>
 #include <asm/irq.h>
 #include <asm/multiboot2/api.h>
+#include <asm/numa.h>
 #include <asm/page_types.h>
 #include <asm/processor.h>
 #include <asm/sections.h>
 #include <asm/smp.h>
+#include <asm/tsc.h>
 
 #include <my-os/pci.h>
 #include <my-os/buddy_alloc.h>
+#include <my-os/buffer_head.h>
 #include <my-os/disk.h>
+#include <my-os/fs.h>
+#include <my-os/hrtimer.h>
 #include <my-os/memblock.h>
 #include <my-os/mm_types.h>
+#include <my-os/percpu.h>
 #include <my-os/rbtree.h>
 #include <my-os/slub_alloc.h>
+#include <my-os/smp.h>
 #include <my-os/task.h>
 
 #include <kernel/keyboard.h>
@@ -78,6 +85,8 @@ void lisp_task() {
 
 void start_kernel(void) {
 
+    string_init();
+
     printk("lma end %p\n", (unsigned long)KERNEL_LMA_END);
 
     memblock_init();
@@ -87,10 +96,15 @@ void start_kernel(void) {
 
     multiboot2_memblock_setup();
     print_memblock();
+    numa_init();
 
     init_mem_mapping();
+    zone_sizes_init();
     set_vga_base(__va(VGA_BASE));
     init_buddy_alloc();
+    smp_prepare_boot_cpu();
+    setup_per_cpu_areas();
+    setup_per_cpu_pageset();
 
     mem_init();
 
@@ -99,8 +113,6 @@ void start_kernel(void) {
     idt_setup();
     init_IRQ();
 
-    smp_init();
-
     fpu_init();
 
     keyboard_init();
@@ -108,15 +120,24 @@ void start_kernel(void) {
 
     schedule_init();
     schedule_irq_init();
+    call_function_init();
+    hrtimers_init();
 
     acpi_init();
-    ata_init();
- 
+    tsc_init();
+
     local_apic_init();
+    buffer_init();
+    inode_init();
+    dcache_init();
+    kshrinkd_init();
+    ata_init();
+    mount_root("hdb");
+
+    smp_init();
 
     struct task_struct *task = create_task("lisp", lisp_task);
     /* lisp_task(); */
-   
-    for (;;)
-        ;
+
+    cpu_idle();
 }
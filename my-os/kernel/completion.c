@@ -0,0 +1,97 @@
+#include <asm/irq.h>
+#include <my-os/completion.h>
+#include <my-os/limits.h>
+#include <my-os/task.h>
+
+struct completion_waiter {
+    struct list_head list;
+    struct task_struct *task;
+};
+
+/* interrupts are disabled and x->lock is held */
+static void do_wait_for_common(struct completion *x) {
+    struct completion_waiter waiter = {.task = current};
+
+    if (is_idle_task(current)) {
+        while (!x->done) {
+            spin_unlock(&x->lock);
+            asm volatile("sti; hlt; cli" : : : "memory");
+            spin_lock(&x->lock);
+        }
+        return;
+    }
+
+    /*
+     * complete() takes the waiter it wakes off the list, so a second
+     * complete() before this one has run wakes the next waiter. If the
+     * count was taken by a try_wait_for_completion() in between, go back
+     * to the head of the queue.
+     */
+    list_add_tail(&waiter.list, &x->wait);
+    for (;;) {
+        current->state = TASK_UNINTERRUPTIBLE;
+        spin_unlock(&x->lock);
+        _schedule();
+        spin_lock(&x->lock);
+        if (x->done)
+            break;
+        if (list_empty(&waiter.list))
+            list_add(&waiter.list, &x->wait);
+    }
+    /* still queued after complete_all() */
+    if (!list_empty(&waiter.list))
+        list_del(&waiter.list);
+}
+
+void wait_for_completion(struct completion *x) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&x->lock, flags);
+    if (!x->done)
+        do_wait_for_common(x);
+    if (x->done != UINT_MAX)
+        x->done--;
+    spin_unlock_irqrestore(&x->lock, flags);
+}
+
+bool try_wait_for_completion(struct completion *x) {
+    unsigned long flags;
+    bool ret = false;
+
+    spin_lock_irqsave(&x->lock, flags);
+    if (x->done) {
+        if (x->done != UINT_MAX)
+            x->done--;
+        ret = true;
+    }
+    spin_unlock_irqrestore(&x->lock, flags);
+    return ret;
+}
+
+void complete(struct completion *x) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&x->lock, flags);
+    if (x->done != UINT_MAX)
+        x->done++;
+    if (!list_empty(&x->wait)) {
+        struct completion_waiter *waiter =
+            list_first_entry(&x->wait, struct completion_waiter, list);
+
+        list_del_init(&waiter->list);
+        wake_up_process(waiter->task);
+    }
+    spin_unlock_irqrestore(&x->lock, flags);
+}
+
+void complete_all(struct completion *x) {
+    unsigned long flags;
+    struct completion_waiter *waiter;
+
+    spin_lock_irqsave(&x->lock, flags);
+    x->done = UINT_MAX;
+    list_for_each_entry(waiter, &x->wait, list) {
+        wake_up_process(waiter->task);
+    }
+    spin_unlock_irqrestore(&x->lock, flags);
+}
@@ -0,0 +1,92 @@
+#include <kernel/printk.h>
+
+#include <my-os/lockstat.h>
+#include <my-os/preempt.h>
+#include <my-os/rwlock.h>
+
+void queued_read_lock_slowpath(rwlock_t *lock) {
+    u64 start = lock_stat_start();
+
+    /* keep the reader count, a waiting writer waits for us to leave */
+    if (in_interrupt()) {
+        while ((lock->cnts & _QW_WMASK) == _QW_LOCKED)
+            cpu_relax();
+        barrier();
+        lock_stat_acquired(lock_class_of(lock), start);
+        return;
+    }
+
+    /* back out and queue behind the writer */
+    __sync_fetch_and_sub(&lock->cnts, _QR_BIAS);
+    raw_spin_lock(&lock->wait_lock);
+    __sync_fetch_and_add(&lock->cnts, _QR_BIAS);
+
+    /*
+     * A waiting writer would hold wait_lock, so the write byte is either
+     * clear or a writer owns the lock and we wait for it to leave.
+     */
+    while ((lock->cnts & _QW_WMASK) == _QW_LOCKED)
+        cpu_relax();
+    raw_spin_unlock(&lock->wait_lock);
+
+    barrier();
+    lock_stat_acquired(lock_class_of(lock), start);
+}
+
+void queued_write_lock_slowpath(rwlock_t *lock) {
+    u64 start = lock_stat_start();
+    u32 cnts;
+
+    raw_spin_lock(&lock->wait_lock);
+    if (lock->cnts == 0 &&
+        __sync_bool_compare_and_swap(&lock->cnts, 0, _QW_LOCKED))
+        goto out;
+
+    /* turn new readers away, then wait for the ones inside to leave */
+    for (;;) {
+        cnts = lock->cnts;
+        if (!(cnts & _QW_WMASK) &&
+            __sync_bool_compare_and_swap(&lock->cnts, cnts,
+                                         cnts | _QW_WAITING))
+            break;
+        cpu_relax();
+    }
+    while (!__sync_bool_compare_and_swap(&lock->cnts, _QW_WAITING, _QW_LOCKED))
+        cpu_relax();
+out:
+    raw_spin_unlock(&lock->wait_lock);
+    lock_stat_acquired(lock_class_of(lock), start);
+}
+
+#ifdef LOCK_STAT
+
+static struct lock_class *volatile lock_classes;
+
+void lock_class_register(struct lock_class *class) {
+    struct lock_class *first;
+
+    if (!__sync_bool_compare_and_swap(&class->registered, 0, 1))
+        return;
+    do {
+        first = lock_classes;
+        class->next = first;
+    } while (!__sync_bool_compare_and_swap(&lock_classes, first, class));
+}
+
+void print_lock_stats(void) {
+    for (struct lock_class *c = lock_classes; c; c = c->next) {
+        printk("lock %s: %ld acquired, %ld contended, %ld wait cycles "
+               "(avg %ld, max %ld)\n",
+               c->name, c->acquisitions, c->contentions, c->wait_cycles,
+               c->contentions ? c->wait_cycles / c->contentions : 0,
+               c->max_wait_cycles);
+    }
+}
+
+#else
+
+void print_lock_stats(void) {
+    printk("lockstat: not built in, compile with -DLOCK_STAT\n");
+}
+
+#endif
@@ -1,12 +1,22 @@
 #include <asm/irq.h>
+#include <asm/smp.h>
+#include <my-os/bitops.h>
+#include <my-os/compiler.h>
+#include <my-os/ktime.h>
+#include <my-os/percpu.h>
 #include <my-os/slub_alloc.h>
 #include <my-os/task.h>
+#include <my-os/tick.h>
 
-u64 jiffies_64 = 0;
+/* one run queue per cpu, indexed by local APIC id */
+static DEFINE_PER_CPU(struct cfs_rq, runqueues);
+
+struct cfs_rq *cpu_rq(int cpu) {
+    return &per_cpu(runqueues, cpu);
+}
 
-struct cfs_rq *rq;
 struct cfs_rq *get_rq() {
-    return rq;
+    return this_cpu_ptr(&runqueues);
 }
 
 /*
@@ -14,8 +24,10 @@ struct cfs_rq *get_rq() {
  *
  * (default: 6ms * (1 + ilog(ncpus)), units: nanoseconds)
  */
-/* unsigned int sysctl_sched_latency = 6000000ULL; */
-unsigned int sysctl_sched_latency = 6ULL;
+unsigned int sysctl_sched_latency = 6000000ULL;
+
+/* run queue time between two periodic load balance passes */
+#define BALANCE_INTERVAL (4 * NSEC_PER_MSEC)
 
 const int sched_prio_to_weight[40] = {
     /* -20 */ 88761, 71755, 56483, 46273, 36291,
@@ -30,23 +42,27 @@ const int sched_prio_to_weight[40] = {
 
 int nice(int i) { return sched_prio_to_weight[i + 20]; }
 
-static inline u64 task_cfs_runtime(struct sched_entity *se) {
-    return (sysctl_sched_latency * se->weight) / get_rq()->weight;
+static inline u64 task_cfs_runtime(struct cfs_rq *cfs_rq,
+                                   struct sched_entity *se) {
+    return (sysctl_sched_latency * se->weight) / cfs_rq->weight;
 }
 
-static inline u64 task_cfs_vruntime(struct sched_entity *se) {
-    return (task_cfs_runtime(se) * nice(0)) / se->weight;
+static inline u64 task_cfs_vruntime(struct cfs_rq *cfs_rq,
+                                    struct sched_entity *se) {
+    return (task_cfs_runtime(cfs_rq, se) * nice(0)) / se->weight;
 }
 
 struct cfs_rq *task_cfs_rq(struct task_struct *task) {
     return task->se.cfs_rq;
 }
 
-void preempt_schedule_irq();
+static inline bool is_idle_se(struct cfs_rq *cfs_rq, struct sched_entity *se) {
+    return se == &cfs_rq->idle->se;
+}
 
 static void check_preempt_tick(struct cfs_rq *cfs_rq,
                                struct sched_entity *curr) {
-    u64 ideal_runtime = task_cfs_runtime(curr);
+    u64 ideal_runtime = task_cfs_runtime(cfs_rq, curr);
     u64 delta_exec = curr->sum_exec_runtime - curr->prev_sum_exec_runtime;
     if (delta_exec > ideal_runtime) {
         curr->prev_sum_exec_runtime = curr->sum_exec_runtime;
@@ -54,30 +70,83 @@ static void check_preempt_tick(struct cfs_rq *cfs_rq,
     }
 }
 
+static bool load_balance(struct cfs_rq *this_rq);
+
+/*
+ * Charge the running entity the sched_clock() time since it was last
+ * charged, its vruntime advances weighted by its load. The caller holds
+ * cfs_rq->lock.
+ */
+static void update_curr(struct cfs_rq *cfs_rq) {
+    struct sched_entity *curr = cfs_rq->curr;
+    u64 now = sched_clock();
+    s64 delta_exec = now - curr->exec_start;
+
+    if (delta_exec <= 0)
+        return;
+
+    curr->exec_start = now;
+    curr->sum_exec_runtime += delta_exec;
+    cfs_rq->clock_task += delta_exec;
+
+    if (is_idle_se(cfs_rq, curr) || !curr->on_rq)
+        return;
+
+    /* curr stays in the tree while it runs, keep its position right */
+    rq_dequeue(cfs_rq, curr);
+    curr->vruntime += delta_exec * nice(0) / curr->weight;
+    rq_enqueue(cfs_rq, curr);
+}
+
+/* the caller holds cfs_rq->lock */
 static void update_cfs_curr(struct cfs_rq *cfs_rq) {
-    ++cfs_rq->clock_task;
     struct sched_entity *curr = cfs_rq->curr;
-    ++curr->sum_exec_runtime;
 
+    update_curr(cfs_rq);
+
+    if (is_idle_se(cfs_rq, curr)) {
+        if (cfs_rq->nr_running)
+            task_of(curr)->flags = TIF_NEED_RESCHED;
+        return;
+    }
     check_preempt_tick(cfs_rq, curr);
 }
 
-irqreturn_t do_timer(int irq, void *dev_id) {
-    jiffies_64 += 1;
+static void resched_curr(struct cfs_rq *rq);
+
+/* called from the tick hrtimer of every cpu, interrupts are disabled */
+void scheduler_tick(void) {
+    struct cfs_rq *cfs_rq = get_rq();
+
+    raw_spin_lock(&cfs_rq->lock);
+    update_cfs_curr(cfs_rq);
+    raw_spin_unlock(&cfs_rq->lock);
 
-    update_cfs_curr(get_rq());
-    
-    return IRQ_NONE;
+    if (cfs_rq->clock_task >= cfs_rq->next_balance) {
+        cfs_rq->next_balance = cfs_rq->clock_task + BALANCE_INTERVAL;
+        load_balance(cfs_rq);
+
+        /* idle cpus with the tick stopped do not balance, kick one */
+        u64 idle = nohz_idle_mask & ~(1ULL << cfs_rq->cpu);
+        if (cfs_rq->nr_running > 1 && idle)
+            resched_curr(cpu_rq(__ffs64(idle)));
+    }
+}
+
+static irqreturn_t do_reschedule(int irq __always_unused,
+                                  void *dev_id __always_unused) {
+    /* the flag is set by the sender, the irq return path does the rest */
+    return IRQ_HANDLED;
 }
 
 void schedule_irq_init() {
-    irq_set_handler(2, handle_simple_irq, "timer");
+    irq_set_handler(RESCHEDULE_IRQ, handle_simple_irq, "reschedule");
 
-    struct irq_action *action = kmalloc(sizeof(struct irq_action), SLUB_NONE);
-    action->name = "timer";
-    action->handler = do_timer;
+    struct irq_action *action = kzalloc(sizeof(struct irq_action), SLUB_NONE);
+    action->name = "reschedule";
+    action->handler = do_reschedule;
 
-    setup_irq(2, action);
+    setup_irq(RESCHEDULE_IRQ, action);
 }
 
 extern struct task_struct *__switch_to_asm(struct task_struct *prev,
@@ -104,127 +173,363 @@ void context_switch(struct task_struct *prev, struct task_struct *next) {
 
 void __switch_to(struct task_struct *prev_p, struct task_struct *next_p) {}
 
-bool _rq_insert(struct rb_root_cached *root, struct sched_entity *data) {
-
-    struct rb_node *rb_first = rb_first_cached(root);
-    struct rb_node **new = &rb_first_cached(root), *parent = NULL;
+static void _rq_insert(struct rb_root_cached *root,
+                       struct sched_entity *data) {
+    struct rb_node **new = &root->rb_root.rb_node, *parent = NULL;
+    bool leftmost = true;
 
-    /* Figure out where to put new node */
+    /* Figure out where to put new node, equal keys go right */
     while (*new) {
         struct sched_entity *this =
             container_of(*new, struct sched_entity, run_node);
 
         parent = *new;
-        if (data->vruntime < this->vruntime)
+        if (data->vruntime < this->vruntime) {
             new = &((*new)->rb_left);
-        else if (data->vruntime > this->vruntime)
+        } else {
             new = &((*new)->rb_right);
-        else
-            return false;
+            leftmost = false;
+        }
     }
 
     /* Add new node and rebalance tree. */
     rb_link_node(&data->run_node, parent, new);
-
-    if (!rb_first ||
-        rb_entry(rb_first, struct sched_entity, run_node)->vruntime >
-            data->vruntime) {
-        rb_insert_color_cached(&data->run_node, root, true);
-    } else {
-        rb_insert_color_cached(&data->run_node, root, false);
-    }
-
-    return true;
+    rb_insert_color_cached(&data->run_node, root, leftmost);
 }
 
-void rq_enqueue(struct sched_entity *se) {
-    if (!_rq_insert(&rq->tasks_timeline, se)) {
-        halt();
-    }
+void rq_enqueue(struct cfs_rq *rq, struct sched_entity *se) {
+    _rq_insert(&rq->tasks_timeline, se);
 }
 
-void rq_dequeue(struct sched_entity *se) {
+void rq_dequeue(struct cfs_rq *rq, struct sched_entity *se) {
     rb_erase_cached(&se->run_node, &rq->tasks_timeline);
 }
 
+/* the caller holds rq->lock */
 void activate_task(struct cfs_rq *rq, struct task_struct *task) {
+    task->se.on_rq = 1;
     ++rq->nr_running;
     rq->weight += task->se.weight;
 
     struct sched_entity *se = &task->se;
     se->vruntime = rq->min_vruntime;
 
-    se->vruntime += task_cfs_vruntime(se);
+    se->vruntime += task_cfs_vruntime(rq, se);
     --se->vruntime;
 
     se->cfs_rq = rq;
-    se->prev_sum_exec_runtime = rq->clock_task;
-    se->sum_exec_runtime = rq->clock_task;
+    se->prev_sum_exec_runtime = se->sum_exec_runtime;
 
-    rq_enqueue(se);
+    rq_enqueue(rq, se);
 }
 
+/* the caller holds rq->lock */
 void deactivate_task(struct cfs_rq *rq, struct task_struct *task) {
+    task->se.on_rq = 0;
     --rq->nr_running;
     rq->weight -= task->se.weight;
-    rq_dequeue(&task->se);
+    rq_dequeue(rq, &task->se);
+}
+
+/* Lock two run queues in address order so that balancers never deadlock. */
+static void double_rq_lock(struct cfs_rq *rq1, struct cfs_rq *rq2) {
+    if (rq1 < rq2) {
+        raw_spin_lock(&rq1->lock);
+        raw_spin_lock(&rq2->lock);
+    } else {
+        raw_spin_lock(&rq2->lock);
+        raw_spin_lock(&rq1->lock);
+    }
+}
+
+static void double_rq_unlock(struct cfs_rq *rq1, struct cfs_rq *rq2) {
+    raw_spin_unlock(&rq1->lock);
+    raw_spin_unlock(&rq2->lock);
+}
+
+static struct cfs_rq *find_busiest_queue(struct cfs_rq *this_rq) {
+    struct cfs_rq *busiest = NULL;
+    u32 max_running = this_rq->nr_running + 1;
+    int cpu;
+
+    for_each_online_cpu(cpu) {
+        struct cfs_rq *rq = cpu_rq(cpu);
+        if (rq == this_rq)
+            continue;
+        if (rq->nr_running > max_running) {
+            max_running = rq->nr_running;
+            busiest = rq;
+        }
+    }
+    return busiest;
+}
+
+/*
+ * Move the leftmost sched_entity that is not currently running from
+ * @src to @dst, keeping its lag relative to the queue's min_vruntime.
+ */
+static bool steal_task(struct cfs_rq *dst, struct cfs_rq *src) {
+    struct rb_node *node = rb_first_cached(&src->tasks_timeline);
+
+    for (; node; node = rb_next(node)) {
+        struct sched_entity *se = sched_of(node);
+        if (se == src->curr)
+            continue;
+
+        struct task_struct *task = task_of(se);
+        u64 lag = se->vruntime > src->min_vruntime
+                      ? se->vruntime - src->min_vruntime
+                      : 0;
+
+        deactivate_task(src, task);
+
+        ++dst->nr_running;
+        dst->weight += se->weight;
+        se->vruntime = dst->min_vruntime + lag;
+        se->cfs_rq = dst;
+        se->prev_sum_exec_runtime = se->sum_exec_runtime;
+        se->on_rq = 1;
+        rq_enqueue(dst, se);
+
+        ++dst->nr_migrations;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Pull one task from the busiest run queue, if it runs at least two more
+ * tasks than this one. Called periodically from the tick and whenever a
+ * cpu is about to go idle. Interrupts must be disabled.
+ */
+static bool load_balance(struct cfs_rq *this_rq) {
+    struct cfs_rq *busiest = find_busiest_queue(this_rq);
+    bool moved = false;
+
+    if (!busiest)
+        return false;
+
+    double_rq_lock(this_rq, busiest);
+    if (busiest->nr_running >= this_rq->nr_running + 2)
+        moved = steal_task(this_rq, busiest);
+    double_rq_unlock(this_rq, busiest);
+
+    if (moved && is_idle_se(this_rq, this_rq->curr))
+        current->flags = TIF_NEED_RESCHED;
+    return moved;
 }
 
-void rq_init() {
-    struct sched_entity *init_se = &init_task->se;
-    rq = kmalloc(sizeof(struct cfs_rq), SLUB_NONE);
+/*
+ * Make the current task of @rq reschedule. A remote cpu may be halted
+ * with its tick stopped, it is sent an ipi.
+ */
+static void resched_curr(struct cfs_rq *rq) {
+    task_of(rq->curr)->flags = TIF_NEED_RESCHED;
+    if ((int)rq->cpu != smp_processor_id())
+        smp_send_reschedule(rq->cpu);
+}
+
+static struct cfs_rq *select_task_rq(void) {
+    struct cfs_rq *idlest = get_rq();
+    int cpu;
+
+    for_each_online_cpu(cpu) {
+        struct cfs_rq *rq = cpu_rq(cpu);
+        if (rq->nr_running < idlest->nr_running)
+            idlest = rq;
+    }
+    return idlest;
+}
+
+void wake_up_new_task(struct task_struct *task) {
+    unsigned long flags;
+
+    struct cfs_rq *rq = select_task_rq();
+    raw_spin_lock_irqsave(&rq->lock, flags);
+    activate_task(rq, task);
+    if (is_idle_se(rq, rq->curr))
+        resched_curr(rq);
+    raw_spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+/*
+ * Put a task that went to sleep in schedule() back on the run queue it
+ * slept on. That queue's lock is the one the sleeper dropped, so a task
+ * that has set its state but not yet switched away is seen as on_rq and
+ * only has its state reset. Returns false if the task was running or dead.
+ */
+bool wake_up_process(struct task_struct *task) {
+    unsigned long flags;
+    bool woken = false;
+
+    struct cfs_rq *rq = task_cfs_rq(task);
+    raw_spin_lock_irqsave(&rq->lock, flags);
+    while (rq != task_cfs_rq(task)) {
+        raw_spin_unlock(&rq->lock);
+        rq = task_cfs_rq(task);
+        raw_spin_lock(&rq->lock);
+    }
+
+    if (task->state & (TASK_INTERRUPTIBLE | TASK_UNINTERRUPTIBLE)) {
+        task->state = TASK_RUNNING;
+        if (!task->se.on_rq) {
+            activate_task(rq, task);
+            if (is_idle_se(rq, rq->curr))
+                resched_curr(rq);
+        }
+        woken = true;
+    }
+
+    raw_spin_unlock_irqrestore(&rq->lock, flags);
+    return woken;
+}
+
+bool is_idle_task(struct task_struct *task) {
+    return task == get_rq()->idle;
+}
+
+static void rq_init(int cpu, struct task_struct *idle) {
+    struct cfs_rq *rq = cpu_rq(cpu);
+    struct sched_entity *idle_se = &idle->se;
+
+    raw_spin_lock_init(&rq->lock);
     rq->tasks_timeline = RB_ROOT_CACHED;
-    rq->curr = init_se;
+    rq->curr = idle_se;
+    rq->idle = idle;
+    rq->cpu = cpu;
     rq->min_vruntime = 0;
-    rq->weight = init_se->weight;
-    rq->clock_task = jiffies_64;
-    rq->nr_running = 1;
+    rq->weight = 0;
+    rq->clock_task = 0;
+    rq->next_balance = BALANCE_INTERVAL;
+    rq->nr_running = 0;
+    rq->nr_switches = 0;
+    rq->nr_migrations = 0;
+
+    idle_se->vruntime = 0;
+    idle_se->cfs_rq = rq;
+    idle_se->prev_sum_exec_runtime = 0;
+    idle_se->sum_exec_runtime = 0;
+    idle_se->exec_start = sched_clock();
+}
 
-    init_se->vruntime = 0;
-    init_se->cfs_rq = rq;
-    init_se->prev_sum_exec_runtime = rq->clock_task;
-    init_se->sum_exec_runtime = rq->clock_task;
-    rq_enqueue(init_se);
+void schedule_init() {
+    int cpu = smp_processor_id();
+    set_current(init_task);
+    rq_init(cpu, init_task);
+    set_cpu_online(cpu, true);
 }
 
-void schedule_init() { rq_init(); }
+/* Called by a secondary cpu on its own idle task before it goes online. */
+void init_idle(struct task_struct *idle, int cpu) {
+    set_current(idle);
+    rq_init(cpu, idle);
+}
 
-struct task_struct *pick_next_task() {
-    return task_of(sched_of(rb_first_cached(&rq->tasks_timeline)));
+static struct task_struct *pick_next_task(struct cfs_rq *rq) {
+    struct rb_node *left = rb_first_cached(&rq->tasks_timeline);
+    if (!left)
+        return rq->idle;
+    return task_of(sched_of(left));
 }
 
-void _schedule() {
+/*
+ * The run queue lock is held across context_switch() and dropped by the
+ * task we switched to, so a balancer on another cpu can not pull @prev
+ * before its stack pointer has been saved.
+ */
+void schedule_tail(void) { raw_spin_unlock(&get_rq()->lock); }
+
+/* interrupts must be disabled */
+void _schedule(void) {
     struct task_struct *prev, *next;
+    struct cfs_rq *cfs_rq = get_rq();
+
+    if (is_idle_se(cfs_rq, cfs_rq->curr))
+        tick_nohz_idle_exit();
+
+    if (!cfs_rq->nr_running)
+        load_balance(cfs_rq);
+
+    raw_spin_lock(&cfs_rq->lock);
 
     current->flags = 0;
 
     prev = current;
-    struct sched_entity *se = &current->se;
-    se->vruntime += task_cfs_vruntime(se);
-
-    rq_dequeue(se);
+    update_curr(cfs_rq);
 
-    rq_enqueue(se);
+    /* going to sleep, wake_up_process() puts it back */
+    if (!is_idle_se(cfs_rq, &prev->se) && prev->state != TASK_RUNNING)
+        deactivate_task(cfs_rq, prev);
 
-    next = pick_next_task();
+    next = pick_next_task(cfs_rq);
 
-    struct cfs_rq *cfs_rq = get_rq();
-    cfs_rq->min_vruntime = next->se.vruntime;
+    if (next != cfs_rq->idle)
+        cfs_rq->min_vruntime = next->se.vruntime;
 
     if (prev != next) {
-        cfs_rq->curr = &next->se;        
+        cfs_rq->curr = &next->se;
+        next->se.exec_start = sched_clock();
+        ++cfs_rq->nr_switches;
         /* printk("prev %s next %s\n", prev->name, next->name);         */
         set_current(next);
-        irq_enable();
         context_switch(prev, next);
-        irq_disable();
+        schedule_tail();
+    } else {
+        raw_spin_unlock(&cfs_rq->lock);
     }
 }
 
+void schedule(void) {
+    unsigned long flags;
+
+    local_irq_save(flags);
+    _schedule();
+    local_irq_restore(flags);
+}
+
+DEFINE_PER_CPU(int, __preempt_count);
+
+/* on the way out of every interrupt, unless a lock is held or waited for */
 void preempt_schedule_irq() {
+    if (!preemptible())
+        return;
     if (current->flags == TIF_NEED_RESCHED) {
         /* irq_enable(); */
         _schedule();
         /* irq_disable(); */
     }
 }
+
+/*
+ * The idle task of a cpu: pull work from busy cpus or halt with the tick
+ * stopped until the next timer or a reschedule ipi.
+ */
+void cpu_idle(void) {
+    for (;;) {
+        irq_disable();
+        struct cfs_rq *cfs_rq = get_rq();
+        if (cfs_rq->nr_running || load_balance(cfs_rq)) {
+            _schedule();
+            irq_enable();
+        } else {
+            tick_nohz_idle_enter();
+            asm volatile("sti; hlt; cli" : : : "memory");
+            tick_nohz_idle_exit();
+            irq_enable();
+        }
+    }
+}
+
+void print_sched_stats(void) {
+    int cpu;
+
+    for_each_online_cpu(cpu) {
+        struct cfs_rq *rq = cpu_rq(cpu);
+        u64 idle = rq->idle->se.sum_exec_runtime;
+        printk("cpu%d: running %d, switches %d, migrations %d, busy %ld/%ld "
+               "ms\n",
+               cpu, rq->nr_running, rq->nr_switches, rq->nr_migrations,
+               (rq->clock_task - idle) / NSEC_PER_MSEC,
+               rq->clock_task / NSEC_PER_MSEC);
+    }
+}
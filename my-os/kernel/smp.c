@@ -0,0 +1,196 @@
+#include <asm/irq.h>
+#include <kernel/printk.h>
+
+#include <my-os/compiler.h>
+#include <my-os/percpu.h>
+#include <my-os/smp.h>
+#include <my-os/spinlock.h>
+
+/* calls queued for each cpu, drained by its call function ipi */
+static DEFINE_PER_CPU(struct llist_head, call_single_queue);
+
+/* the csds a cpu sends with, one per target */
+static DEFINE_PER_CPU(struct call_single_data[NR_CPUS], cfd_data);
+
+static DEFINE_PER_CPU(u64, smp_calls_sent);
+static DEFINE_PER_CPU(u64, smp_call_ipis);
+
+static void flush_smp_call_function_queue(void) {
+    struct llist_node *entry =
+        llist_del_all(this_cpu_ptr(&call_single_queue));
+
+    /* run them in the order they were queued */
+    entry = llist_reverse_order(entry);
+    while (entry) {
+        struct call_single_data *csd =
+            llist_entry(entry, struct call_single_data, llist);
+        smp_call_func_t func = csd->func;
+        void *info = csd->info;
+
+        /* the sender may reuse csd once it is unlocked, read next first */
+        entry = entry->next;
+        if (csd->flags & CSD_FLAG_SYNCHRONOUS) {
+            func(info);
+            __sync_fetch_and_and(&csd->flags, ~CSD_FLAG_LOCK);
+        } else {
+            __sync_fetch_and_and(&csd->flags, ~CSD_FLAG_LOCK);
+            func(info);
+        }
+    }
+}
+
+/* wait for @csd to be run, serving our own queue to break call cycles */
+static void csd_lock_wait(struct call_single_data *csd) {
+    unsigned long flags;
+
+    while (csd->flags & CSD_FLAG_LOCK) {
+        local_irq_save(flags);
+        flush_smp_call_function_queue();
+        local_irq_restore(flags);
+        cpu_relax();
+    }
+}
+
+static void csd_lock(struct call_single_data *csd) {
+    csd_lock_wait(csd);
+    csd->flags = CSD_FLAG_LOCK;
+    barrier();
+}
+
+/* queue @csd for @cpu, only the first entry of an empty queue needs an ipi */
+static void generic_exec_single(int cpu, struct call_single_data *csd) {
+    this_cpu_inc(smp_calls_sent);
+    if (llist_add(&csd->llist, &per_cpu(call_single_queue, cpu))) {
+        this_cpu_inc(smp_call_ipis);
+        arch_send_call_function_ipi(cpu);
+    }
+}
+
+int smp_call_function_single(int cpu, smp_call_func_t func, void *info,
+                             bool wait) {
+    struct call_single_data *csd;
+    unsigned long flags;
+
+    if (cpu < 0 || cpu >= NR_CPUS || !cpu_online(cpu))
+        return -1;
+
+    /* interrupts off: no preemption or migration while queueing */
+    local_irq_save(flags);
+    if (cpu == smp_processor_id()) {
+        func(info);
+        local_irq_restore(flags);
+        return 0;
+    }
+
+    csd = &(*this_cpu_ptr(&cfd_data))[cpu];
+    csd_lock(csd);
+    csd->func = func;
+    csd->info = info;
+    if (wait)
+        csd->flags |= CSD_FLAG_SYNCHRONOUS;
+    generic_exec_single(cpu, csd);
+    local_irq_restore(flags);
+
+    if (wait)
+        csd_lock_wait(csd);
+    return 0;
+}
+
+/*
+ * Queue @func for the cpus of @mask other than this one, run it here if
+ * this cpu is in @mask, then wait for the others with @wait. Interrupts
+ * stay off throughout: the task can not migrate between picking the cpus
+ * and the local call, which would skip the cpu it lands on. Waiting with
+ * them off is fine, csd_lock_wait() serves our own queue meanwhile.
+ */
+static void __smp_call_function_many(u64 mask, smp_call_func_t func,
+                                     void *info, bool wait) {
+    int this_cpu = smp_processor_id();
+    struct call_single_data *csds = *this_cpu_ptr(&cfd_data);
+    bool run_local = mask & (1ULL << this_cpu);
+    int cpu;
+
+    mask &= cpu_online_mask & ~(1ULL << this_cpu);
+    for_each_online_cpu(cpu) {
+        if (!(mask & (1ULL << cpu)))
+            continue;
+
+        struct call_single_data *csd = &csds[cpu];
+        csd_lock(csd);
+        csd->func = func;
+        csd->info = info;
+        if (wait)
+            csd->flags |= CSD_FLAG_SYNCHRONOUS;
+        generic_exec_single(cpu, csd);
+    }
+
+    if (run_local)
+        func(info);
+
+    if (!wait)
+        return;
+
+    for_each_online_cpu(cpu) {
+        if (mask & (1ULL << cpu))
+            csd_lock_wait(&csds[cpu]);
+    }
+}
+
+void smp_call_function_many(u64 mask, smp_call_func_t func, void *info,
+                            bool wait) {
+    unsigned long flags;
+
+    local_irq_save(flags);
+    __smp_call_function_many(mask & ~(1ULL << smp_processor_id()), func,
+                             info, wait);
+    local_irq_restore(flags);
+}
+
+void smp_call_function(smp_call_func_t func, void *info, bool wait) {
+    smp_call_function_many(cpu_online_mask, func, info, wait);
+}
+
+void on_each_cpu_mask(u64 mask, smp_call_func_t func, void *info,
+                      bool wait) {
+    unsigned long flags;
+
+    local_irq_save(flags);
+    __smp_call_function_many(mask, func, info, wait);
+    local_irq_restore(flags);
+}
+
+void on_each_cpu(smp_call_func_t func, void *info, bool wait) {
+    on_each_cpu_mask(cpu_online_mask, func, info, wait);
+}
+
+void generic_smp_call_function_interrupt(void) {
+    flush_smp_call_function_queue();
+}
+
+static irqreturn_t do_call_function(int irq __always_unused,
+                                    void *dev_id __always_unused) {
+    generic_smp_call_function_interrupt();
+    return IRQ_HANDLED;
+}
+
+static struct irq_action call_function_action = {
+    .name = "call-function",
+    .handler = do_call_function,
+};
+
+void print_smp_call_stats(void) {
+    int cpu;
+
+    for_each_online_cpu(cpu) {
+        printk("smp call cpu%d: %ld calls sent, %ld ipis\n", cpu,
+               per_cpu(smp_calls_sent, cpu), per_cpu(smp_call_ipis, cpu));
+    }
+}
+
+void call_function_init(void) {
+    for (int cpu = 0; cpu < NR_CPUS; cpu++)
+        init_llist_head(&per_cpu(call_single_queue, cpu));
+
+    irq_set_handler(CALL_FUNCTION_IRQ, handle_simple_irq, "call-function");
+    setup_irq(CALL_FUNCTION_IRQ, &call_function_action);
+}
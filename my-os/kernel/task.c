@@ -1,6 +1,8 @@
 #include <my-os/slub_alloc.h>
+#include <my-os/string.h>
 #include <my-os/task.h>
 #include <asm/irq.h>
+#include <asm/smp.h>
 
 union thread_union init_thread_union = {
     .task = {.mm = &init_mm,
@@ -10,27 +12,44 @@ union thread_union init_thread_union = {
 
 struct task_struct *init_task = &init_thread_union.task;
 
-struct task_struct *current_task = &init_thread_union.task;
+DEFINE_PER_CPU(struct task_struct *, current_task);
 
-struct task_struct *get_current(void) {
-    return current_task;
+void set_current(struct task_struct *task) {
+    this_cpu_write(current_task, task);
 }
 
-void set_current(struct task_struct *task) { current_task = task; }
+/*
+ * A task whose routine returns leaves the run queue for good, _schedule()
+ * takes it off like a sleeper and nothing wakes it. Its stack is the one
+ * we are on, so it is not freed.
+ */
+static void task_entry(void) {
+    schedule_tail();
+    irq_enable();
+    current->routine();
+
+    irq_disable();
+    current->state = TASK_DEAD;
+    _schedule();
+}
 
 struct task_struct *create_task(const char *name, worker_routine routine) {
     /* irq_disable();    */
     struct task_struct *task = kmalloc(sizeof(union thread_union), SLUB_NONE);
+    // only the task needs clearing, not the whole stack
+    bzero(task, sizeof(struct task_struct));
     task->pid = current->pid + 1;
     task->name = name;
-    task->thread.sp = task_top_of_stack(task);
-    task->thread.ip = (phys_addr_t)routine;
+    /* task_entry is entered by a ret, keep the stack aligned as after a call */
+    task->thread.sp = task_top_of_stack(task) - sizeof(unsigned long);
+    task->thread.ip = (phys_addr_t)task_entry;
+    task->routine = routine;
 
     list_add(&task->tasks, &init_task->tasks);
     printk("task stack %p\n", task);
     printk("task stack %p\n", task->thread.sp);
     task->se.weight = nice(0);
-    activate_task(get_rq(), task);
+    wake_up_new_task(task);
     /* irq_enable(); */
     return task;
 }
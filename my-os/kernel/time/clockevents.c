@@ -0,0 +1,75 @@
+#include <asm/smp.h>
+#include <kernel/printk.h>
+
+#include <my-os/clockchips.h>
+#include <my-os/hrtimer.h>
+#include <my-os/kernel.h>
+#include <my-os/percpu.h>
+#include <my-os/tick.h>
+
+/* give up on a device that keeps missing this many deadlines */
+#define CLOCKEVENTS_MAX_RETRIES 10
+
+static DEFINE_PER_CPU(struct clock_event_device *, cpu_clockevents);
+
+struct clock_event_device *clockevents_get_device(int cpu) {
+    return per_cpu(cpu_clockevents, cpu);
+}
+
+/*
+ * Program @dev to fire at @expires, clamped to what the device can do.
+ * A deadline already in the past fires after min_delta_ns, and the minimum
+ * is raised when the device keeps reporting it missed one.
+ */
+int clockevents_program_event(struct clock_event_device *dev,
+                              ktime_t expires) {
+    dev->next_event = expires;
+
+    s64 delta = expires - ktime_get();
+    for (int i = 0; i < CLOCKEVENTS_MAX_RETRIES; i++) {
+        if (delta > (s64)dev->max_delta_ns)
+            delta = dev->max_delta_ns;
+        if (delta < (s64)dev->min_delta_ns)
+            delta = dev->min_delta_ns;
+
+        if (!dev->set_next_event(mul_frac32(delta, dev->mult), dev))
+            return 0;
+
+        ++dev->nr_retries;
+        dev->min_delta_ns += dev->min_delta_ns / 2;
+        delta = dev->min_delta_ns;
+    }
+    printk("clockevents: %s can not be programmed\n", dev->name);
+    return -1;
+}
+
+/*
+ * Set up the ns conversion of @dev running at @freq and make it the event
+ * device of dev->cpu if it is rated higher than the current one. Has to
+ * run on that cpu, with interrupts disabled.
+ */
+void clockevents_config_and_register(struct clock_event_device *dev, u64 freq,
+                                     u64 min_delta, u64 max_delta) {
+    u64 ns_per_cycle = div_frac32(NSEC_PER_SEC, freq);
+    struct clock_event_device *old = per_cpu(cpu_clockevents, dev->cpu);
+
+    dev->mult = div_frac32(freq, NSEC_PER_SEC);
+    dev->min_delta_ns = max(mul_frac32(min_delta, ns_per_cycle), 1ULL);
+    dev->max_delta_ns = mul_frac32(max_delta, ns_per_cycle);
+    dev->next_event = KTIME_MAX;
+
+    printk("clockevents: %s on cpu %d, %ld Hz, %ld..%ld ns\n", dev->name,
+           dev->cpu, freq, dev->min_delta_ns, dev->max_delta_ns);
+
+    if (!(dev->features & CLOCK_EVT_FEAT_ONESHOT))
+        return;
+    if (old && old->rating >= dev->rating)
+        return;
+
+    dev->event_handler = hrtimer_interrupt;
+    per_cpu(cpu_clockevents, dev->cpu) = dev;
+    if (old)
+        clockevents_program_event(dev, old->next_event);
+    else
+        tick_setup(dev->cpu);
+}
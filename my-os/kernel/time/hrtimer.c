@@ -0,0 +1,244 @@
+#include <asm/irq.h>
+#include <asm/smp.h>
+
+#include <my-os/clockchips.h>
+#include <my-os/hrtimer.h>
+#include <my-os/kernel.h>
+#include <my-os/percpu.h>
+
+static DEFINE_PER_CPU(struct hrtimer_cpu_base, hrtimer_bases);
+
+static struct hrtimer_cpu_base *this_cpu_base(void) {
+    return this_cpu_ptr(&hrtimer_bases);
+}
+
+static ktime_t __hrtimer_next_expiry(struct hrtimer_cpu_base *base) {
+    struct rb_node *left = rb_first_cached(&base->active);
+    return left ? rb_entry(left, struct hrtimer, node)->expires : KTIME_MAX;
+}
+
+/* program the device of the local @base for @expires if that is earlier */
+static void __hrtimer_reprogram(struct hrtimer_cpu_base *base,
+                                ktime_t expires) {
+    struct clock_event_device *dev = clockevents_get_device(base->cpu);
+
+    if (!dev || base->in_hrtirq || expires >= base->expires_next)
+        return;
+    base->expires_next = expires;
+    clockevents_program_event(dev, expires);
+}
+
+/* returns true if @timer became the first one to expire */
+static bool enqueue_hrtimer(struct hrtimer *timer,
+                            struct hrtimer_cpu_base *base) {
+    struct rb_node **new = &base->active.rb_root.rb_node, *parent = NULL;
+    bool leftmost = true;
+
+    while (*new) {
+        parent = *new;
+        if (timer->expires < rb_entry(parent, struct hrtimer, node)->expires) {
+            new = &parent->rb_left;
+        } else {
+            new = &parent->rb_right;
+            leftmost = false;
+        }
+    }
+    rb_link_node(&timer->node, parent, new);
+    rb_insert_color_cached(&timer->node, &base->active, leftmost);
+    timer->base = base;
+    timer->state = HRTIMER_STATE_ENQUEUED;
+    return leftmost;
+}
+
+/*
+ * The device is left programmed for a removed first timer, it fires
+ * once for nothing and is set up for the next timer then.
+ */
+static void remove_hrtimer(struct hrtimer *timer,
+                           struct hrtimer_cpu_base *base) {
+    rb_erase_cached(&timer->node, &base->active);
+    timer->state = HRTIMER_STATE_INACTIVE;
+}
+
+void hrtimer_init(struct hrtimer *timer,
+                  enum hrtimer_restart (*function)(struct hrtimer *)) {
+    RB_CLEAR_NODE(&timer->node);
+    timer->expires = 0;
+    timer->function = function;
+    timer->base = NULL;
+    timer->state = HRTIMER_STATE_INACTIVE;
+}
+
+static void hrtimer_lock_bases(struct hrtimer_cpu_base *a,
+                               struct hrtimer_cpu_base *b) {
+    if (a > b) {
+        struct hrtimer_cpu_base *t = a;
+        a = b;
+        b = t;
+    }
+    spin_lock(&a->lock);
+    if (b != a)
+        spin_lock(&b->lock);
+}
+
+static void hrtimer_unlock_bases(struct hrtimer_cpu_base *a,
+                                 struct hrtimer_cpu_base *b) {
+    if (b != a)
+        spin_unlock(&b->lock);
+    spin_unlock(&a->lock);
+}
+
+/*
+ * (Re)arm @timer on the local cpu. A timer whose callback is running on
+ * another cpu stays there, that cpu reprograms when the callback returns.
+ */
+void hrtimer_start(struct hrtimer *timer, ktime_t expires,
+                   enum hrtimer_mode mode) {
+    struct hrtimer_cpu_base *new_base, *old_base, *base;
+    unsigned long flags;
+
+    if (mode == HRTIMER_MODE_REL)
+        expires += ktime_get();
+
+    local_irq_save(flags);
+    new_base = this_cpu_base();
+    for (;;) {
+        old_base = timer->base ? timer->base : new_base;
+        hrtimer_lock_bases(old_base, new_base);
+        if (timer->base == old_base || !timer->base)
+            break;
+        /* migrated by another cpu while we took the locks */
+        hrtimer_unlock_bases(old_base, new_base);
+    }
+
+    if (hrtimer_active(timer))
+        remove_hrtimer(timer, old_base);
+
+    base = old_base->running == timer ? old_base : new_base;
+    timer->expires = expires;
+    if (enqueue_hrtimer(timer, base) && base == new_base)
+        __hrtimer_reprogram(base, expires);
+
+    hrtimer_unlock_bases(old_base, new_base);
+    local_irq_restore(flags);
+}
+
+/*
+ * Returns 1 if @timer was pending, 0 if it was not, -1 if its callback
+ * is running right now and can not be stopped.
+ */
+int hrtimer_try_to_cancel(struct hrtimer *timer) {
+    struct hrtimer_cpu_base *base = timer->base;
+    unsigned long flags;
+    int ret = 0;
+
+    if (!base)
+        return 0;
+
+    spin_lock_irqsave(&base->lock, flags);
+    if (base->running == timer) {
+        ret = -1;
+    } else if (hrtimer_active(timer)) {
+        remove_hrtimer(timer, base);
+        ret = 1;
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+    return ret;
+}
+
+/* like hrtimer_try_to_cancel(), waiting for a running callback */
+int hrtimer_cancel(struct hrtimer *timer) {
+    int ret;
+    while ((ret = hrtimer_try_to_cancel(timer)) < 0)
+        cpu_relax();
+    return ret;
+}
+
+/*
+ * Move the expiry of an inactive @timer forward by whole @intervals so it
+ * lies after @now. Returns the number of intervals skipped.
+ */
+u64 hrtimer_forward(struct hrtimer *timer, ktime_t now, ktime_t interval) {
+    s64 delta = now - timer->expires;
+    u64 overruns;
+
+    if (delta < 0)
+        return 0;
+
+    overruns = delta / interval + 1;
+    timer->expires += overruns * interval;
+    return overruns;
+}
+
+/*
+ * Program the local device for the first timer, but no later than
+ * @limit. The idle loop uses this once it stopped the tick.
+ */
+void hrtimer_reprogram_next(ktime_t limit) {
+    struct hrtimer_cpu_base *base;
+    struct clock_event_device *dev;
+    unsigned long flags;
+
+    local_irq_save(flags);
+    base = this_cpu_base();
+    dev = clockevents_get_device(base->cpu);
+    spin_lock(&base->lock);
+    ktime_t next = min(__hrtimer_next_expiry(base), limit);
+    if (dev && next != base->expires_next) {
+        base->expires_next = next;
+        clockevents_program_event(dev, next);
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+/* event handler of every clock event device, runs with irqs disabled */
+void hrtimer_interrupt(struct clock_event_device *dev) {
+    struct hrtimer_cpu_base *base = this_cpu_base();
+    struct rb_node *left;
+
+    ++dev->nr_events;
+
+    spin_lock(&base->lock);
+    base->in_hrtirq = true;
+    ktime_t now = ktime_get();
+
+    while ((left = rb_first_cached(&base->active))) {
+        struct hrtimer *timer = rb_entry(left, struct hrtimer, node);
+        if (timer->expires > now)
+            break;
+
+        remove_hrtimer(timer, base);
+        base->running = timer;
+        spin_unlock(&base->lock);
+
+        enum hrtimer_restart restart = timer->function(timer);
+
+        spin_lock(&base->lock);
+        /* the callback may have started the timer itself */
+        if (restart == HRTIMER_RESTART && !hrtimer_active(timer))
+            enqueue_hrtimer(timer, base);
+        base->running = NULL;
+
+        /* a long callback can make more timers due */
+        now = ktime_get();
+    }
+
+    base->in_hrtirq = false;
+    base->expires_next = __hrtimer_next_expiry(base);
+    if (base->expires_next != KTIME_MAX)
+        clockevents_program_event(dev, base->expires_next);
+    spin_unlock(&base->lock);
+}
+
+void hrtimers_init(void) {
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct hrtimer_cpu_base *base = &per_cpu(hrtimer_bases, cpu);
+
+        spin_lock_init(&base->lock);
+        base->active = RB_ROOT_CACHED;
+        base->expires_next = KTIME_MAX;
+        base->running = NULL;
+        base->in_hrtirq = false;
+        base->cpu = cpu;
+    }
+}
@@ -0,0 +1,138 @@
+#include <asm/irq.h>
+#include <asm/smp.h>
+#include <kernel/printk.h>
+
+#include <my-os/clockchips.h>
+#include <my-os/clocksource.h>
+#include <my-os/hrtimer.h>
+#include <my-os/kernel.h>
+#include <my-os/percpu.h>
+#include <my-os/task.h>
+#include <my-os/tick.h>
+
+u64 jiffies_64 = 0;
+u64 nohz_idle_mask;
+
+/*
+ * The periodic tick of a cpu is an hrtimer. It is stopped while the cpu
+ * idles, the event device is then only programmed for the next real timer.
+ */
+struct tick_sched {
+    struct hrtimer sched_timer;
+    bool stopped;
+    ktime_t idle_entry;
+    /* statistics */
+    u64 nr_ticks;
+    u64 nr_idle_enter;
+    u64 idle_ticks; /* ticks that were not taken while idle */
+};
+
+static DEFINE_PER_CPU(struct tick_sched, tick_cpu_sched);
+
+/* jiffies are advanced by whichever cpu ticks first */
+static DEFINE_SPINLOCK(jiffies_lock);
+static ktime_t last_jiffies_update;
+
+/* interrupts must be disabled */
+static void tick_do_update_jiffies64(ktime_t now) {
+    if (now - last_jiffies_update < TICK_NSEC)
+        return;
+
+    spin_lock(&jiffies_lock);
+    s64 delta = now - last_jiffies_update;
+    if (delta >= TICK_NSEC) {
+        u64 ticks = delta / TICK_NSEC;
+        last_jiffies_update += ticks * TICK_NSEC;
+        jiffies_64 += ticks;
+        timekeeping_update();
+    }
+    spin_unlock(&jiffies_lock);
+}
+
+static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer) {
+    struct tick_sched *ts = container_of(timer, struct tick_sched, sched_timer);
+    ktime_t now = ktime_get();
+
+    tick_do_update_jiffies64(now);
+    ++ts->nr_ticks;
+    scheduler_tick();
+
+    hrtimer_forward(timer, now, TICK_NSEC);
+    return HRTIMER_RESTART;
+}
+
+/* start the tick of @cpu once it has an event device, runs on that cpu */
+void tick_setup(int cpu) {
+    struct tick_sched *ts = &per_cpu(tick_cpu_sched, cpu);
+    ktime_t now = ktime_get();
+
+    hrtimer_init(&ts->sched_timer, tick_sched_timer);
+    hrtimer_start(&ts->sched_timer, now - now % TICK_NSEC + TICK_NSEC,
+                  HRTIMER_MODE_ABS);
+}
+
+/*
+ * Called by the idle loop with interrupts disabled before it halts. The
+ * tick is cancelled and the device programmed for the first pending
+ * hrtimer, at the latest before the clocksource could wrap.
+ */
+void tick_nohz_idle_enter(void) {
+    int cpu = smp_processor_id();
+    struct tick_sched *ts = &per_cpu(tick_cpu_sched, cpu);
+    struct clocksource *cs = clocksource_current();
+
+    if (ts->stopped || !cs || !clockevents_get_device(cpu))
+        return;
+    if (hrtimer_try_to_cancel(&ts->sched_timer) <= 0)
+        return;
+
+    ts->stopped = true;
+    ts->idle_entry = ktime_get();
+    ++ts->nr_idle_enter;
+    __sync_fetch_and_or(&nohz_idle_mask, 1ULL << cpu);
+
+    ktime_t limit = (u64)(KTIME_MAX - ts->idle_entry) > cs->max_idle_ns
+                        ? ts->idle_entry + cs->max_idle_ns
+                        : KTIME_MAX;
+    hrtimer_reprogram_next(limit);
+}
+
+/*
+ * Restart the tick on its old grid, the scheduler charges the idle time
+ * from sched_clock(). A no-op if the tick is running, so the scheduler
+ * may call it freely. Interrupts must be disabled.
+ */
+void tick_nohz_idle_exit(void) {
+    int cpu = smp_processor_id();
+    struct tick_sched *ts = &per_cpu(tick_cpu_sched, cpu);
+
+    if (!ts->stopped)
+        return;
+
+    ktime_t now = ktime_get();
+    tick_do_update_jiffies64(now);
+
+    ts->idle_ticks += hrtimer_forward(&ts->sched_timer, now, TICK_NSEC);
+
+    ts->stopped = false;
+    __sync_fetch_and_and(&nohz_idle_mask, ~(1ULL << cpu));
+    hrtimer_start(&ts->sched_timer, ts->sched_timer.expires,
+                  HRTIMER_MODE_ABS);
+}
+
+void print_tick_stats(void) {
+    int cpu;
+
+    for_each_online_cpu(cpu) {
+        struct tick_sched *ts = &per_cpu(tick_cpu_sched, cpu);
+        struct clock_event_device *dev = clockevents_get_device(cpu);
+
+        printk("tick cpu%d: %ld ticks, %ld idle entries, %ld idle ticks "
+               "skipped",
+               cpu, ts->nr_ticks, ts->nr_idle_enter, ts->idle_ticks);
+        if (dev)
+            printk(", %s %ld events %ld retries", dev->name, dev->nr_events,
+                   dev->nr_retries);
+        printk("\n");
+    }
+}
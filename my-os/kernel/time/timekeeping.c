@@ -0,0 +1,79 @@
+#include <asm/irq.h>
+#include <kernel/printk.h>
+
+#include <my-os/clocksource.h>
+#include <my-os/compiler.h>
+#include <my-os/spinlock.h>
+
+static struct clocksource *clock;
+
+/*
+ * ktime_get() is base_ns plus the cycles since cycle_last. Readers retry
+ * while seq is odd or changed, an update is in progress then.
+ */
+static DEFINE_SPINLOCK(timekeeper_lock);
+static volatile u32 tk_seq;
+static u64 cycle_last;
+static ktime_t base_ns;
+
+static ktime_t __timekeeping_ns(u64 now) {
+    return base_ns + mul_frac32((now - cycle_last) & clock->mask, clock->mult);
+}
+
+ktime_t ktime_get(void) {
+    u32 seq;
+    ktime_t ns;
+
+    if (!clock)
+        return 0;
+
+    do {
+        while ((seq = tk_seq) & 1)
+            cpu_relax();
+        barrier();
+        ns = __timekeeping_ns(clock->read(clock));
+        barrier();
+    } while (seq != tk_seq);
+    return ns;
+}
+
+/* the caller holds timekeeper_lock */
+static void __timekeeping_switch(struct clocksource *new) {
+    ++tk_seq;
+    barrier();
+    if (clock)
+        base_ns = __timekeeping_ns(clock->read(clock));
+    clock = new;
+    cycle_last = clock->read(clock);
+    barrier();
+    ++tk_seq;
+}
+
+void timekeeping_update(void) {
+    unsigned long flags;
+
+    if (!clock)
+        return;
+
+    spin_lock_irqsave(&timekeeper_lock, flags);
+    __timekeeping_switch(clock);
+    spin_unlock_irqrestore(&timekeeper_lock, flags);
+}
+
+void clocksource_register_hz(struct clocksource *cs, u64 hz) {
+    unsigned long flags;
+
+    cs->mult = div_frac32(NSEC_PER_SEC, hz);
+    /* half a wrap, for a 64 bit counter that is forever */
+    unsigned __int128 max_ns =
+        ((unsigned __int128)(cs->mask >> 1) * cs->mult) >> 32;
+    cs->max_idle_ns = max_ns > KTIME_MAX ? KTIME_MAX : (u64)max_ns;
+    printk("clocksource: %s, %ld Hz\n", cs->name, hz);
+
+    spin_lock_irqsave(&timekeeper_lock, flags);
+    if (!clock || cs->rating > clock->rating)
+        __timekeeping_switch(cs);
+    spin_unlock_irqrestore(&timekeeper_lock, flags);
+}
+
+struct clocksource *clocksource_current(void) { return clock; }
@@ -1,23 +1,159 @@
+#include <asm/processor.h>
+
+#include <kernel/printk.h>
+#include <my-os/mm_types.h>
 #include <my-os/slub_alloc.h>
 #include <my-os/string.h>
 
+/*
+ * All primitives work a word at a time or with the fast string
+ * instructions. Copies and fills beyond STRING_NT_THRESHOLD use movnti,
+ * a non-temporal store that keeps a large buffer from flushing the
+ * caches; it needs SSE2 but no xmm registers, so nothing has to be
+ * saved around it.
+ */
+
+#define CPUID_FEAT_EDX_SSE2 26
+#define CPUID_7_EBX_ERMS 9
+
+#define STRING_NT_THRESHOLD (256 * 1024)
+
+static bool string_has_erms; /* rep movsb/stosb beat the qword forms */
+static bool string_has_sse2; /* movnti available */
+
+typedef unsigned long __attribute__((may_alias)) word_t;
+
+#define WORD_SIZE sizeof(word_t)
+#define REPEAT_BYTE(x) ((~0UL / 0xff) * (x))
+#define HAS_ZERO_BYTE(v) (((v)-REPEAT_BYTE(0x01)) & ~(v)&REPEAT_BYTE(0x80))
+
+void string_init(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    string_has_sse2 = edx & 1 << CPUID_FEAT_EDX_SSE2;
+
+    if (cpuid_eax(0) >= 7) {
+        cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+        string_has_erms = ebx & 1 << CPUID_7_EBX_ERMS;
+    }
+    printk("string: erms %d, sse2 %d\n", string_has_erms, string_has_sse2);
+}
+
+static inline void rep_movsb(void *dest, const void *src, size_t n) {
+    asm volatile("rep movsb"
+                 : "+D"(dest), "+S"(src), "+c"(n)
+                 :
+                 : "memory");
+}
+
+static inline void rep_movsq(void *dest, const void *src, size_t n) {
+    asm volatile("rep movsq"
+                 : "+D"(dest), "+S"(src), "+c"(n)
+                 :
+                 : "memory");
+}
+
+static inline void rep_stosb(void *dest, u8 c, size_t n) {
+    asm volatile("rep stosb" : "+D"(dest), "+c"(n) : "a"(c) : "memory");
+}
+
+static inline void rep_stosq(void *dest, unsigned long v, size_t n) {
+    asm volatile("rep stosq" : "+D"(dest), "+c"(n) : "a"(v) : "memory");
+}
+
+static inline void movnti(void *dest, unsigned long v) {
+    asm volatile("movnti %1, %0" : "=m"(*(word_t *)dest) : "r"(v));
+}
+
+static inline void sfence(void) { asm volatile("sfence" : : : "memory"); }
+
+/* dest word aligned, n a multiple of the word size */
+static void memset_nt(void *dest, unsigned long v, size_t n) {
+    char *d = dest;
+    for (; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE, d += 4 * WORD_SIZE) {
+        movnti(d, v);
+        movnti(d + WORD_SIZE, v);
+        movnti(d + 2 * WORD_SIZE, v);
+        movnti(d + 3 * WORD_SIZE, v);
+    }
+    for (; n; n -= WORD_SIZE, d += WORD_SIZE)
+        movnti(d, v);
+    sfence();
+}
+
+/* dest word aligned, n a multiple of the word size */
+static void memcpy_nt(void *dest, const void *src, size_t n) {
+    char *d = dest;
+    const char *s = src;
+    for (; n >= 4 * WORD_SIZE; n -= 4 * WORD_SIZE) {
+        unsigned long w0 = *(const word_t *)s;
+        unsigned long w1 = *(const word_t *)(s + WORD_SIZE);
+        unsigned long w2 = *(const word_t *)(s + 2 * WORD_SIZE);
+        unsigned long w3 = *(const word_t *)(s + 3 * WORD_SIZE);
+        movnti(d, w0);
+        movnti(d + WORD_SIZE, w1);
+        movnti(d + 2 * WORD_SIZE, w2);
+        movnti(d + 3 * WORD_SIZE, w3);
+        d += 4 * WORD_SIZE;
+        s += 4 * WORD_SIZE;
+    }
+    for (; n; n -= WORD_SIZE, d += WORD_SIZE, s += WORD_SIZE)
+        movnti(d, *(const word_t *)s);
+    sfence();
+}
+
 size_t strlen(const char *s) {
-    const char *sc;
-    for (sc = s; *sc != '\0'; ++sc)
+    const char *sc = s;
+
+    // aligned word loads never cross into the next page
+    for (; (unsigned long)sc & (WORD_SIZE - 1); ++sc)
+        if (*sc == '\0')
+            return sc - s;
+    while (!HAS_ZERO_BYTE(*(const word_t *)sc))
+        sc += WORD_SIZE;
+    for (; *sc != '\0'; ++sc)
         /* nothing */;
     return sc - s;
 }
 
 void *memset(void *s, int c, size_t count) {
     char *xs = s;
-
-    while (count--)
-        *xs++ = c;
+    unsigned long v = REPEAT_BYTE((u8)c);
+
+    if (string_has_sse2 && count >= STRING_NT_THRESHOLD) {
+        size_t head = -(unsigned long)xs & (WORD_SIZE - 1);
+        rep_stosb(xs, c, head);
+        xs += head;
+        count -= head;
+        memset_nt(xs, v, count & ~(WORD_SIZE - 1));
+        xs += count & ~(WORD_SIZE - 1);
+        rep_stosb(xs, c, count & (WORD_SIZE - 1));
+    } else if (string_has_erms) {
+        rep_stosb(xs, c, count);
+    } else {
+        rep_stosq(xs, v, count / WORD_SIZE);
+        rep_stosb(xs + (count & ~(WORD_SIZE - 1)), c, count & (WORD_SIZE - 1));
+    }
     return s;
 }
 
 void *bzero(void *s, size_t n) { return memset(s, 0, n); }
 
+void clear_page(void *page) {
+    if (string_has_erms)
+        rep_stosb(page, 0, PAGE_SIZE);
+    else
+        rep_stosq(page, 0, PAGE_SIZE / WORD_SIZE);
+}
+
+void copy_page(void *to, const void *from) {
+    if (string_has_erms)
+        rep_movsb(to, from, PAGE_SIZE);
+    else
+        rep_movsq(to, from, PAGE_SIZE / WORD_SIZE);
+}
+
 int strcmp(const char *cs, const char *ct) {
     unsigned char c1, c2;
 
@@ -32,32 +168,49 @@ int strcmp(const char *cs, const char *ct) {
     return 0;
 }
 
-void *memmove(void *dest, const void *src, size_t count) {
-    char *tmp;
-    const char *s;
+void *memcpy(void *dest, const void *src, size_t count) {
+    char *tmp = dest;
+    const char *s = src;
 
-    if (dest <= src) {
-        tmp = dest;
-        s = src;
-        while (count--)
-            *tmp++ = *s++;
+    if (string_has_sse2 && count >= STRING_NT_THRESHOLD) {
+        size_t head = -(unsigned long)tmp & (WORD_SIZE - 1);
+        rep_movsb(tmp, s, head);
+        tmp += head;
+        s += head;
+        count -= head;
+        memcpy_nt(tmp, s, count & ~(WORD_SIZE - 1));
+        tmp += count & ~(WORD_SIZE - 1);
+        s += count & ~(WORD_SIZE - 1);
+        rep_movsb(tmp, s, count & (WORD_SIZE - 1));
+    } else if (string_has_erms) {
+        rep_movsb(tmp, s, count);
     } else {
-        tmp = dest;
-        tmp += count;
-        s = src;
-        s += count;
-        while (count--)
-            *--tmp = *--s;
+        rep_movsq(tmp, s, count / WORD_SIZE);
+        rep_movsb(tmp + (count & ~(WORD_SIZE - 1)),
+                  s + (count & ~(WORD_SIZE - 1)), count & (WORD_SIZE - 1));
     }
     return dest;
 }
 
-void *memcpy(void *dest, const void *src, size_t count) {
-    char *tmp = dest;
-    const char *s = src;
+void *memmove(void *dest, const void *src, size_t count) {
+    char *tmp;
+    const char *s;
 
+    // a forward copy is safe unless dest starts inside src
+    if (dest <= src || (const char *)dest >= (const char *)src + count)
+        return memcpy(dest, src, count);
+
+    tmp = dest;
+    tmp += count;
+    s = src;
+    s += count;
+    for (; count >= WORD_SIZE; count -= WORD_SIZE) {
+        tmp -= WORD_SIZE;
+        s -= WORD_SIZE;
+        *(word_t *)tmp = *(const word_t *)s;
+    }
     while (count--)
-        *tmp++ = *s++;
+        *--tmp = *--s;
     return dest;
 }
 
@@ -82,7 +235,12 @@ int memcmp(const void *cs, const void *ct, size_t count) {
     const unsigned char *su1, *su2;
     int res = 0;
 
-    for (su1 = cs, su2 = ct; 0 < count; ++su1, ++su2, count--)
+    // skip equal words, the first difference is found bytewise
+    for (su1 = cs, su2 = ct; count >= WORD_SIZE;
+         su1 += WORD_SIZE, su2 += WORD_SIZE, count -= WORD_SIZE)
+        if (*(const word_t *)su1 != *(const word_t *)su2)
+            break;
+    for (; 0 < count; ++su1, ++su2, count--)
         if ((res = *su1 - *su2) != 0)
             break;
     return res;
@@ -91,6 +249,6 @@ int memcmp(const void *cs, const void *ct, size_t count) {
 char *strdup(const char *s) {
     size_t len = strlen(s) + 1;
     char *new = kmalloc(len, SLUB_NONE);
-    memcpy(new, s, len );
+    memcpy(new, s, len);
     return new;
 }
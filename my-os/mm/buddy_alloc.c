@@ -1,10 +1,23 @@
+#include <asm/irq.h>
 #include <asm/multiboot2/api.h>
 #include <asm/page.h>
 #include <asm/sections.h>
+#include <asm/smp.h>
 #include <my-os/buddy_alloc.h>
+#include <my-os/completion.h>
+#include <my-os/gfp.h>
 #include <my-os/kernel.h>
+#include <my-os/list.h>
 #include <my-os/log2.h>
+#include <my-os/mcs_spinlock.h>
+#include <my-os/memblock.h>
 #include <my-os/mm_types.h>
+#include <my-os/mmzone.h>
+#include <my-os/numa.h>
+#include <my-os/percpu.h>
+#include <my-os/spinlock.h>
+#include <my-os/string.h>
+#include <my-os/task.h>
 #include <my-os/types.h>
 
 #include <kernel/mm.h>
@@ -15,25 +28,102 @@ struct buddy_free_area {
     u8 area[];
 };
 
+/*
+ * One allocator per present memory range, its metadata is taken from
+ * the start of the range itself.
+ */
 struct buddy_alloc {
+    struct list_head list;
     size_t start_pfn;
+    size_t pfn_num;
+    size_t nr_free;
     size_t free_area_num;
+    /* areas of MAX_ORDER come first, then one per set bit of the tail */
+    size_t full_area_num;
+    int tail_area[MAX_ORDER];
+    /* max tree over the area roots, leaves padded to a power of two */
+    size_t summary_leaves;
+    u8 *summary;
     struct buddy_free_area **free_area;
 };
 
-static struct buddy_alloc *buddy_base;
+
+/*
+ * Per-cpu cache of order-0 pages. Freed pages go to the head and are
+ * handed out first while still cache hot, refills from the buddy go to
+ * the tail and drains take the coldest pages from the tail. Only the
+ * owning cpu touches its list, with interrupts off.
+ */
+struct per_cpu_pages {
+    struct list_head list;
+    int count;
+    int high;  /* drain a batch once count reaches this */
+    int batch; /* pages moved per refill/drain */
+
+    u64 alloc_hit;
+    u64 alloc_miss;
+    u64 free_hit;
+    u64 drain;
+};
+
+#define PCP_BATCH 31
+#define PCP_HIGH (PCP_BATCH * 6)
+
+static DEFINE_PER_CPU(struct per_cpu_pages, pcp_pages);
 
 #define is_align(n, align) (!((n) & ((align)-1)))
 
-#define MAX_ORDER 11
 #define FREE_AREA_PFN (1 << MAX_ORDER)
 #define FREE_AREA_NODE_NUM ((FREE_AREA_PFN << 1) - 1)
 
+#define LEFT_LEAF(index) ((index)*2 + 1)
+#define RIGHT_LEAF(index) ((index)*2 + 2)
+#define PARENT(index) (((index) + 1) / 2 - 1)
+
 /* #define buddy_node(buddy, i, j)                                                \ */
 /*     ((buddy)->free_area + ((i)*FREE_AREA_NODE_NUM + (j))) */
 
 long buddy_alloc_pfn(struct buddy_alloc *buddy, size_t order);
 
+static void buddy_summary_update(struct buddy_alloc *buddy, size_t i) {
+    u8 *summary = buddy->summary;
+    size_t index = buddy->summary_leaves - 1 + i;
+
+    summary[index] = buddy->free_area[i]->area[0];
+    while (index) {
+        index = PARENT(index);
+        u8 order = max(summary[LEFT_LEAF(index)], summary[RIGHT_LEAF(index)]);
+        if (summary[index] == order)
+            break;
+        summary[index] = order;
+    }
+}
+
+static void buddy_summary_init(struct buddy_alloc *buddy) {
+    u8 *summary = buddy->summary;
+    size_t leaf = buddy->summary_leaves - 1;
+
+    for (size_t i = 0; i < buddy->summary_leaves; i++) {
+        summary[leaf + i] =
+            i < buddy->free_area_num ? buddy->free_area[i]->area[0] : 0;
+    }
+    for (size_t index = leaf; index--;) {
+        summary[index] =
+            max(summary[LEFT_LEAF(index)], summary[RIGHT_LEAF(index)]);
+    }
+}
+
+/* first pfn offset covered by free area i */
+static size_t buddy_area_offset(struct buddy_alloc *buddy, size_t i) {
+    if (i < buddy->full_area_num)
+        return i << MAX_ORDER;
+
+    size_t order = buddy->free_area[i]->max_order;
+    size_t tail_pfn = buddy->pfn_num & (FREE_AREA_PFN - 1);
+    return (buddy->full_area_num << MAX_ORDER) +
+           (tail_pfn & ~((2UL << order) - 1));
+}
+
 struct buddy_alloc *buddy_new(phys_addr_t start, phys_addr_t end) {
     printk("buddy: %#x-%#x\n", start, end);
     if (end < start) {
@@ -46,11 +136,44 @@ struct buddy_alloc *buddy_new(phys_addr_t start, phys_addr_t end) {
         return NULL;
     }
     size_t pfn_num = mem_size >> PAGE_SHIFT;
+    size_t full_area_num = pfn_num >> MAX_ORDER;
+    size_t tail_pfn = pfn_num & (FREE_AREA_PFN - 1);
+
+    size_t free_area_num = full_area_num;
+    for (size_t order = 0; order < MAX_ORDER; order++) {
+        if (tail_pfn & (1UL << order))
+            free_area_num++;
+    }
+    size_t summary_leaves = 1;
+    while (summary_leaves < free_area_num)
+        summary_leaves <<= 1;
+
+    // each area holds a header byte and 2 * pages - 1 nodes
+    size_t meta_size = sizeof(struct buddy_alloc) +
+                       free_area_num * sizeof(struct buddy_free_area *) +
+                       (summary_leaves << 1) - 1 + (pfn_num << 1);
+    if (meta_size >= mem_size) {
+        return NULL;
+    }
+
+    struct buddy_alloc *buddy = __va(start);
+    buddy->start_pfn = start >> PAGE_SHIFT;
+    buddy->pfn_num = pfn_num;
+    buddy->nr_free = pfn_num;
+    buddy->free_area_num = free_area_num;
+    buddy->full_area_num = full_area_num;
+    buddy->summary_leaves = summary_leaves;
+
+    // area pointers and summary live in front of the areas, all of the
+    // metadata comes from the range itself
+    u8 *free_area_base = (u8 *)(buddy + 1);
+    buddy->free_area = (struct buddy_free_area **)free_area_base;
+    free_area_base += free_area_num * sizeof(struct buddy_free_area *);
+    buddy->summary = free_area_base;
+    free_area_base += (summary_leaves << 1) - 1;
 
     size_t free_area_order = MAX_ORDER;
-    size_t free_area_num = 0;
-    struct buddy_free_area **brk_free_area_base = NULL;
-    u8 *free_area_base = __va(start);
+    size_t i = 0;
     while (pfn_num) {
         size_t map_page = 1 << free_area_order;
         if (pfn_num < map_page) {
@@ -63,9 +186,9 @@ struct buddy_alloc *buddy_new(phys_addr_t start, phys_addr_t end) {
         size_t node_num = (map_page << 1) - 1;
         size_t node_order = free_area_order + 2;
 
-        struct buddy_free_area **area =
-            extend_brk(sizeof(struct buddy_free_area *), 8);
-        *area = (struct buddy_free_area *)free_area_base;
+        if (free_area_order < MAX_ORDER)
+            buddy->tail_area[free_area_order] = i;
+        buddy->free_area[i++] = (struct buddy_free_area *)free_area_base;
 
         free_area_base[0] = free_area_order;
         free_area_base += 1;
@@ -75,36 +198,26 @@ struct buddy_alloc *buddy_new(phys_addr_t start, phys_addr_t end) {
             }
             free_area_base[j] = node_order;
         }
-        free_area_num++;
-        if (!brk_free_area_base)
-            brk_free_area_base = area;
 
         free_area_base += node_num;
         pfn_num -= map_page;
     }
 
-    struct buddy_alloc *buddy = extend_brk(sizeof(struct buddy_alloc), 8);
-    buddy->start_pfn = start >> PAGE_SHIFT;
-    buddy->free_area_num = free_area_num;
-    buddy->free_area = brk_free_area_base;
+    buddy_summary_init(buddy);
 
-    size_t reserve_mem = __pa(free_area_base) - start;
+    size_t reserve_mem = ALIGN(__pa(free_area_base), PAGE_SIZE) - start;
     printk("reserve memory %#x\n", reserve_mem);
 
     // mark reserve
     size_t reserve_num = reserve_mem >> PAGE_SHIFT;
     while (reserve_num) {
-        size_t i = ilog2(reserve_num);
-        buddy_alloc_pfn(buddy, i);
-        reserve_num -= 1 << i;
+        size_t order = min((size_t)ilog2(reserve_num), (size_t)MAX_ORDER);
+        buddy_alloc_pfn(buddy, order);
+        reserve_num -= 1 << order;
     }
     return buddy;
 }
 
-#define LEFT_LEAF(index) ((index)*2 + 1)
-#define RIGHT_LEAF(index) ((index)*2 + 2)
-#define PARENT(index) (((index) + 1) / 2 - 1)
-
 long _buddy_alloc(struct buddy_free_area *area, size_t order) {
     if (!area) {
         return -1;
@@ -139,26 +252,30 @@ long buddy_alloc_pfn(struct buddy_alloc *buddy, size_t order) {
     if (!buddy || order > MAX_ORDER)
         return -1;
 
-    size_t i;
-    size_t map_pfn = 0;
-    for (i = 0; i < buddy->free_area_num; i++) {
-        if (buddy->free_area[i]->area[0] >= order + 1) {
-            break;
-        }
-        map_pfn += 1 << buddy->free_area[i]->max_order;
-    }
-
-    if (i == buddy->free_area_num) {
+    // walk the summary to the leftmost area that fits
+    u8 *summary = buddy->summary;
+    if (summary[0] < order + 1) {
         return -1;
     }
+    size_t node = 0;
+    while (node < buddy->summary_leaves - 1) {
+        if (summary[LEFT_LEAF(node)] >= order + 1) {
+            node = LEFT_LEAF(node);
+        } else {
+            node = RIGHT_LEAF(node);
+        }
+    }
+    size_t i = node - (buddy->summary_leaves - 1);
 
     long index = _buddy_alloc(buddy->free_area[i], order);
     if (index == -1) {
         return -1;
     }
+    buddy_summary_update(buddy, i);
+    buddy->nr_free -= 1UL << order;
 
-    map_pfn +=
-        (index + 1) * (1 << order) - (1 << buddy->free_area[i]->max_order);
+    size_t map_pfn = buddy_area_offset(buddy, i) + (index + 1) * (1 << order) -
+                     (1 << buddy->free_area[i]->max_order);
     /* printk("alloc order %d, free area %d, index %d, pfn %#x\n", order, i, index, */
     /*        map_pfn); */
     return buddy->start_pfn + map_pfn;
@@ -167,19 +284,28 @@ long buddy_alloc_pfn(struct buddy_alloc *buddy, size_t order) {
 int buddy_get_free_area_index(struct buddy_alloc *buddy, long pfn,
                               size_t *map_page_offset) {
     size_t pfn_offset = pfn - buddy->start_pfn;
-    size_t index = 0;
-    size_t map_page = 1 << buddy->free_area[index]->max_order;
-    while (pfn_offset >= map_page) {
-        if (index > buddy->free_area_num) {
-            return -1;
-        }
-        map_page += 1 << buddy->free_area[index]->max_order;
-        index++;
+    if (pfn_offset >= buddy->pfn_num) {
+        return -1;
+    }
+
+    size_t index = pfn_offset >> MAX_ORDER;
+    if (index < buddy->full_area_num) {
+        *map_page_offset = index << MAX_ORDER;
+        return index;
     }
-    *map_page_offset = map_page - (1 << buddy->free_area[index]->max_order);
-    return index;
+
+    // tail areas follow the set bits of the tail size from high to low,
+    // the first bit where the offset differs from the size picks the area
+    size_t tail_pfn = buddy->pfn_num & (FREE_AREA_PFN - 1);
+    size_t tail_offset = pfn_offset & (FREE_AREA_PFN - 1);
+    size_t order = ilog2(tail_pfn ^ tail_offset);
+
+    *map_page_offset = (buddy->full_area_num << MAX_ORDER) +
+                       (tail_pfn & ~((2UL << order) - 1));
+    return buddy->tail_area[order];
 }
 
+/* returns the order of the block that was freed */
 int _buddy_free(struct buddy_free_area *area, size_t area_offset) {
     size_t index = area_offset + (1 << area->max_order) - 1;
     size_t node_order = 1;
@@ -191,21 +317,24 @@ int _buddy_free(struct buddy_free_area *area, size_t area_offset) {
     }
 
     area->area[index] = node_order;
+    int order = node_order - 1;
 
     while (index) {
         index = PARENT(index);
         node_order++;
         size_t left_order = area->area[LEFT_LEAF(index)];
         size_t right_order = area->area[RIGHT_LEAF(index)];
-        if (left_order + right_order == node_order) {
+        // merge only when both children are completely free
+        if (left_order == node_order - 1 && right_order == node_order - 1) {
             area->area[index] = node_order;
         } else {
             area->area[index] = max(left_order, right_order);
         }
     }
-    return 0;
+    return order;
 }
 
+/* the order freed, -1 when the pfn is not in the buddy */
 int buddy_free(struct buddy_alloc *buddy, long pfn) {
     size_t map_page_offset = 0;
     int free_area_index =
@@ -217,54 +346,581 @@ int buddy_free(struct buddy_alloc *buddy, long pfn) {
     size_t page_offset = pfn - buddy->start_pfn;
     size_t area_offset = page_offset - map_page_offset;
 
-    return _buddy_free(buddy->free_area[free_area_index], area_offset);
+    int order = _buddy_free(buddy->free_area[free_area_index], area_offset);
+    buddy_summary_update(buddy, free_area_index);
+    buddy->nr_free += 1UL << order;
+    return order;
 }
 
-size_t buddy_size(struct buddy_alloc *buddy, long pfn) {
-    size_t map_page_offset = 0;
-    int free_area_index =
-        buddy_get_free_area_index(buddy, pfn, &map_page_offset);
+/* the lists live in the per-cpu areas, which come after the buddy */
+void setup_per_cpu_pageset(void) {
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct per_cpu_pages *pcp = &per_cpu(pcp_pages, cpu);
+        INIT_LIST_HEAD(&pcp->list);
+        pcp->count = 0;
+        pcp->high = PCP_HIGH;
+        pcp->batch = PCP_BATCH;
+    }
+}
 
-    if (free_area_index == -1) {
+static const char *const zone_names[MAX_NR_ZONES] = {"DMA", "DMA32",
+                                                     "Normal"};
+
+/* lowmem_reserve of a zone is the managed memory above it by this ratio */
+static const int lowmem_reserve_ratio[MAX_NR_ZONES] = {256, 256, 32};
+
+/* the lowest zone whose upper bound lies above @pfn */
+static enum zone_type pfn_zone(unsigned long pfn) {
+    enum zone_type z;
+
+    for (z = ZONE_DMA; z < ZONE_NORMAL; z++) {
+        if (pfn < max_zone_pfn[z])
+            break;
+    }
+    return z;
+}
+
+static int zone_add_range(struct zone *zone, phys_addr_t start,
+                          phys_addr_t end) {
+    struct mcs_spinlock node;
+    unsigned long flags;
+
+    struct buddy_alloc *buddy = buddy_new(start, end);
+    if (!buddy) {
         return -1;
     }
-    size_t page_offset = pfn - buddy->start_pfn;
-    size_t area_offset = page_offset - map_page_offset;
 
-    struct buddy_free_area *area = buddy->free_area[free_area_index];
-    size_t index = area_offset + (1 << area->max_order) - 1;
-    size_t node_order = 1;
-    for (; area->area[index]; index = PARENT(index))
-        node_order++;
+    local_irq_save(flags);
+    mcs_spin_lock(&zone->lock, &node);
+    struct buddy_alloc *pos;
+    list_for_each_entry(pos, &zone->buddy_list, list) {
+        if (pos->start_pfn > buddy->start_pfn)
+            break;
+    }
+    list_add_tail(&buddy->list, &pos->list);
+    if (!zone->managed_pages || buddy->start_pfn < zone->zone_start_pfn)
+        zone->zone_start_pfn = buddy->start_pfn;
+    /* the metadata pages are already taken */
+    zone->managed_pages += buddy->nr_free;
+    zone->free_pages += buddy->nr_free;
+    mcs_spin_unlock(&zone->lock, &node);
+    local_irq_restore(flags);
+    return 0;
+}
 
-    printk("size order %d, free area %d, index %d, pfn %#x\n", --node_order,
-           free_area_index, index, pfn);
-    return 1 << --node_order << PAGE_SHIFT;
+/* one buddy per zone the range crosses */
+int buddy_add_range(int nid, phys_addr_t start, phys_addr_t end) {
+    struct pglist_data *pgdat = NODE_DATA(nid);
+    int added = 0;
+
+    start = ALIGN(start, PAGE_SIZE);
+    end = round_down(end, PAGE_SIZE);
+    if (start >= end) {
+        return -1;
+    }
+
+    while (start < end) {
+        enum zone_type z = pfn_zone(start >> PAGE_SHIFT);
+        phys_addr_t zone_end = end;
+
+        if (z < ZONE_NORMAL)
+            zone_end = min(end, (phys_addr_t)max_zone_pfn[z] << PAGE_SHIFT);
+        if (!zone_add_range(&pgdat->node_zones[z], start, zone_end)) {
+            if (!pgdat->node_present_pages ||
+                (start >> PAGE_SHIFT) < pgdat->node_start_pfn)
+                pgdat->node_start_pfn = start >> PAGE_SHIFT;
+            pgdat->node_present_pages += (zone_end - start) >> PAGE_SHIFT;
+            added++;
+        }
+        start = zone_end;
+    }
+    return added ? 0 : -1;
+}
+
+/* online nodes, nearest first, equal distances by node id */
+static void build_node_fallback(struct pglist_data *pgdat) {
+    u64 used = 0;
+    int nid;
+
+    pgdat->nr_fallback = 0;
+    for (;;) {
+        int best = NUMA_NO_NODE;
+        for_each_online_node(nid) {
+            if (used & (1ULL << nid))
+                continue;
+            if (best == NUMA_NO_NODE ||
+                node_distance(pgdat->node_id, nid) <
+                    node_distance(pgdat->node_id, best))
+                best = nid;
+        }
+        if (best == NUMA_NO_NODE)
+            break;
+        used |= 1ULL << best;
+        pgdat->node_fallback[pgdat->nr_fallback++] = best;
+    }
+}
+
+static unsigned long int_sqrt(unsigned long x) {
+    unsigned long r = 0;
+
+    for (unsigned long bit = 1UL << (BITS_PER_LONG - 2); bit; bit >>= 2) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        } else {
+            r >>= 1;
+        }
+    }
+    return r;
 }
 
+/*
+ * The reserve grows with the square root of memory, 128k to 64M, and is
+ * shared by the zones in proportion to their size. A zone also keeps
+ * back lowmem_reserve from allocations that could have used the zones
+ * above it, so ordinary allocations can not use up the memory that only
+ * it can provide.
+ */
+void setup_per_zone_wmarks(void) {
+    unsigned long managed = 0;
+    int nid;
+
+    for_each_online_node(nid) {
+        for (int z = 0; z < MAX_NR_ZONES; z++)
+            managed += NODE_DATA(nid)->node_zones[z].managed_pages;
+    }
+    if (!managed)
+        return;
+
+    unsigned long min_free_kbytes =
+        int_sqrt((managed << (PAGE_SHIFT - 10)) * 16);
+    min_free_kbytes = min(max(min_free_kbytes, 128UL), 65536UL);
+    unsigned long pages_min = min_free_kbytes >> (PAGE_SHIFT - 10);
+
+    for_each_online_node(nid) {
+        struct pglist_data *pgdat = NODE_DATA(nid);
+
+        for (int z = 0; z < MAX_NR_ZONES; z++) {
+            struct zone *zone = &pgdat->node_zones[z];
+            unsigned long min = pages_min * zone->managed_pages / managed;
+            unsigned long above = 0;
+
+            zone->watermark[WMARK_MIN] = min;
+            zone->watermark[WMARK_LOW] = min + (min >> 2);
+            zone->watermark[WMARK_HIGH] = min + (min >> 1);
+
+            for (int j = 0; j <= z; j++)
+                zone->lowmem_reserve[j] = 0;
+            for (int j = z + 1; j < MAX_NR_ZONES; j++) {
+                above += pgdat->node_zones[j].managed_pages;
+                zone->lowmem_reserve[j] = above / lowmem_reserve_ratio[z];
+            }
+        }
+    }
+}
+
+/*
+ * One buddy per piece of a memblock range on a node and zone. Memory
+ * below the end of the kernel image stays out of the buddy.
+ */
 void init_buddy_alloc() {
-    buddy_base = buddy_new((phys_addr_t)KERNEL_LMA_END, end_pfn << PAGE_SHIFT);
+    struct memblock_region *region;
+    int nid;
+
+    for (nid = 0; nid < MAX_NUMNODES; nid++) {
+        struct pglist_data *pgdat = NODE_DATA(nid);
+        pgdat->node_id = nid;
+        for (int z = 0; z < MAX_NR_ZONES; z++) {
+            struct zone *zone = &pgdat->node_zones[z];
+            INIT_LIST_HEAD(&zone->buddy_list);
+            mcs_lock_init(&zone->lock);
+            zone->node = nid;
+            zone->name = zone_names[z];
+        }
+    }
+
+    for_each_memblock(memory, region) {
+        phys_addr_t start = max(region->base, (phys_addr_t)KERNEL_LMA_END);
+        phys_addr_t end = region->base + region->size;
+
+        while (start < end) {
+            phys_addr_t node_end;
+            nid = phys_to_nid(start, &node_end);
+            node_end = min(node_end, end);
+            buddy_add_range(nid, start, node_end);
+            start = node_end;
+        }
+    }
+
+    for (nid = 0; nid < MAX_NUMNODES; nid++)
+        build_node_fallback(NODE_DATA(nid));
+    setup_per_zone_wmarks();
+    for_each_online_node(nid) {
+        struct pglist_data *pgdat = NODE_DATA(nid);
+
+        printk("node %d: %ld pages from pfn %#x\n", nid,
+               pgdat->node_present_pages, pgdat->node_start_pfn);
+        for (int z = 0; z < MAX_NR_ZONES; z++) {
+            struct zone *zone = &pgdat->node_zones[z];
+            if (!zone->managed_pages)
+                continue;
+            printk("  %s: %ld pages from pfn %#x, min %ld low %ld high %ld\n",
+                   zone->name, zone->managed_pages, zone->zone_start_pfn,
+                   zone->watermark[WMARK_MIN], zone->watermark[WMARK_LOW],
+                   zone->watermark[WMARK_HIGH]);
+        }
+    }
+}
+
+/* zone lock held */
+static long zone_alloc_pfn(struct zone *zone, size_t order) {
+    struct buddy_alloc *buddy;
+
+    list_for_each_entry(buddy, &zone->buddy_list, list) {
+        long pfn = buddy_alloc_pfn(buddy, order);
+        if (pfn != -1) {
+            zone->free_pages -= 1UL << order;
+            return pfn;
+        }
+    }
+    return -1;
+}
+
+/* -1 when the pfn is not in the zone */
+static int zone_free_pfn(struct zone *zone, long pfn) {
+    struct mcs_spinlock node;
+    struct buddy_alloc *buddy;
+    int order = -1;
+
+    mcs_spin_lock(&zone->lock, &node);
+    list_for_each_entry(buddy, &zone->buddy_list, list) {
+        if ((size_t)(pfn - buddy->start_pfn) < buddy->pfn_num) {
+            order = buddy_free(buddy, pfn);
+            break;
+        }
+    }
+    if (order >= 0)
+        zone->free_pages += 1UL << order;
+    mcs_spin_unlock(&zone->lock, &node);
+    return order < 0 ? -1 : 0;
+}
+
+/* the watermark to check is the low two bits */
+#define ALLOC_WMARK_MIN WMARK_MIN
+#define ALLOC_WMARK_LOW WMARK_LOW
+#define ALLOC_WMARK_MASK 0x3
+#define ALLOC_NO_WMARKS 0x4
+#define ALLOC_HIGH 0x8 /* __GFP_HIGH, half of min is enough */
+
+/*
+ * Whether @zone stays above its watermark after an allocation of @order
+ * that could have been served from @classzone.
+ */
+static bool zone_watermark_ok(struct zone *zone, size_t order,
+                              enum zone_type classzone, int alloc_flags) {
+    long free = zone->free_pages - ((1UL << order) - 1);
+    long min = zone->watermark[alloc_flags & ALLOC_WMARK_MASK];
+
+    if (alloc_flags & ALLOC_NO_WMARKS)
+        return true;
+    if (alloc_flags & ALLOC_HIGH)
+        min -= min / 2;
+    return free > min + (long)zone->lowmem_reserve[classzone];
+}
+
+/*
+ * Walk the nodes along the fallback of @nid and in each node the zones
+ * from the highest @gfp allows down to DMA.
+ */
+static long get_page_from_zonelist(int nid, gfp_t gfp, size_t order,
+                                   int alloc_flags) {
+    struct pglist_data *pgdat = NODE_DATA(nid);
+    enum zone_type highest = gfp_zone(gfp);
+    struct mcs_spinlock node;
+
+    for (int i = 0; i < pgdat->nr_fallback; i++) {
+        struct pglist_data *from = NODE_DATA(pgdat->node_fallback[i]);
+
+        for (int z = highest; z >= ZONE_DMA; z--) {
+            struct zone *zone = &from->node_zones[z];
+
+            if (!zone->managed_pages ||
+                !zone_watermark_ok(zone, order, highest, alloc_flags))
+                continue;
+            mcs_spin_lock(&zone->lock, &node);
+            long pfn = zone_alloc_pfn(zone, order);
+            mcs_spin_unlock(&zone->lock, &node);
+            if (pfn != -1)
+                return pfn;
+        }
+    }
+    return -1;
+}
+
+/* the section knows the node, the others are only asked for split sections */
+static void buddy_free_pfn(long pfn) {
+    int home = page_to_nid(pfn_to_page(pfn));
+    enum zone_type z = pfn_zone(pfn);
+    int nid;
+
+    if (!zone_free_pfn(&NODE_DATA(home)->node_zones[z], pfn))
+        return;
+    for_each_online_node(nid) {
+        if (nid != home && !zone_free_pfn(&NODE_DATA(nid)->node_zones[z], pfn))
+            return;
+    }
+    printk("buddy: free of pfn %#x outside every zone\n", pfn);
 }
 
+// early page table pages, taken before the page structs exist, they
+// may use the reserves
 phys_addr_t _alloc_pages(size_t order) {
-    long pfn = buddy_alloc_pfn(buddy_base, order);
+    unsigned long flags;
+    local_irq_save(flags);
+    long pfn = get_page_from_zonelist(numa_node_id(), GFP_KERNEL, order,
+                                      ALLOC_NO_WMARKS);
+    local_irq_restore(flags);
     if (pfn == -1) {
         return 0;
     }
     return pfn << PAGE_SHIFT;
 }
 
-struct page *alloc_pages(size_t order) {
-    long pfn = buddy_alloc_pfn(buddy_base, order);
-    if (pfn == -1) {
+/* a batch from the nearest zones, one lock round trip per zone; the
+ * watermark is rechecked for every page so a batch never takes a zone
+ * below it */
+static int pcp_refill(struct per_cpu_pages *pcp, int alloc_flags) {
+    struct pglist_data *pgdat = NODE_DATA(numa_node_id());
+    struct mcs_spinlock node;
+    int n = 0;
+
+    for (int i = 0; i < pgdat->nr_fallback && n < pcp->batch; i++) {
+        struct pglist_data *from = NODE_DATA(pgdat->node_fallback[i]);
+
+        for (int z = ZONE_NORMAL; z >= ZONE_DMA && n < pcp->batch; z--) {
+            struct zone *zone = &from->node_zones[z];
+
+            if (!zone->managed_pages ||
+                !zone_watermark_ok(zone, 0, ZONE_NORMAL, alloc_flags))
+                continue;
+            mcs_spin_lock(&zone->lock, &node);
+            for (; n < pcp->batch; n++) {
+                if (!zone_watermark_ok(zone, 0, ZONE_NORMAL, alloc_flags))
+                    break;
+                long pfn = zone_alloc_pfn(zone, 0);
+                if (pfn == -1)
+                    break;
+                list_add_tail(&pfn_to_page(pfn)->lru, &pcp->list);
+            }
+            mcs_spin_unlock(&zone->lock, &node);
+        }
+    }
+    pcp->count += n;
+    return n;
+}
+
+static void pcp_drain(struct per_cpu_pages *pcp, int count) {
+    while (count-- && !list_empty(&pcp->list)) {
+        struct page *page = list_last_entry(&pcp->list, struct page, lru);
+        list_del(&page->lru);
+        buddy_free_pfn(page_to_pfn(page));
+        pcp->count--;
+    }
+    pcp->drain++;
+}
+
+static struct page *pcp_alloc_page(int alloc_flags) {
+    struct per_cpu_pages *pcp = this_cpu_ptr(&pcp_pages);
+
+    if (list_empty(&pcp->list)) {
+        pcp->alloc_miss++;
+        if (!pcp_refill(pcp, alloc_flags))
+            return NULL;
+    } else {
+        pcp->alloc_hit++;
+    }
+
+    struct page *page = list_first_entry(&pcp->list, struct page, lru);
+    list_del(&page->lru);
+    pcp->count--;
+    return page;
+}
+
+static void pcp_free_page(struct page *page) {
+    struct per_cpu_pages *pcp = this_cpu_ptr(&pcp_pages);
+
+    list_add(&page->lru, &pcp->list);
+    pcp->count++;
+    pcp->free_hit++;
+    if (pcp->count >= pcp->high)
+        pcp_drain(pcp, pcp->batch);
+}
+
+static LIST_HEAD(shrinker_list);
+static DEFINE_SPINLOCK(shrinker_lock);
+
+/* objects asked from each shrinker per round */
+#define SHRINK_BATCH 128
+
+void register_shrinker(struct shrinker *shrinker) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&shrinker_lock, flags);
+    list_add_tail(&shrinker->list, &shrinker_list);
+    spin_unlock_irqrestore(&shrinker_lock, flags);
+}
+
+/*
+ * Shrinkers are never unregistered, so the one returned stays valid
+ * after the lock is dropped for its scan.
+ */
+static struct shrinker *next_shrinker(struct shrinker *prev) {
+    struct list_head *next;
+    unsigned long flags;
+
+    spin_lock_irqsave(&shrinker_lock, flags);
+    next = prev ? prev->list.next : shrinker_list.next;
+    spin_unlock_irqrestore(&shrinker_lock, flags);
+
+    if (next == &shrinker_list)
         return NULL;
+    return list_entry(next, struct shrinker, list);
+}
+
+/*
+ * Ask every cache to drop unused objects. The scans take the caches'
+ * own locks and put inodes and dentries, so the caller must hold no
+ * lock and have interrupts on; kshrinkd is the one that does.
+ */
+size_t shrink_caches(void) {
+    struct shrinker *shrinker = NULL;
+    size_t freed = 0;
+
+    while ((shrinker = next_shrinker(shrinker)))
+        freed += shrinker->scan(SHRINK_BATCH);
+    return freed;
+}
+
+static struct task_struct *kshrinkd_task;
+static DECLARE_COMPLETION(kshrinkd_wait);
+static volatile int kshrinkd_pending;
+
+/*
+ * Allocations run anywhere, under spinlocks and in slub with interrupts
+ * off, so they only kick kshrinkd once a zone drops below its low mark
+ * and the shrinking happens in its own context.
+ */
+static void wakeup_kshrinkd(void) {
+    if (kshrinkd_task &&
+        __sync_bool_compare_and_swap(&kshrinkd_pending, 0, 1))
+        complete(&kshrinkd_wait);
+}
+
+static void kshrinkd(void) {
+    for (;;) {
+        wait_for_completion(&kshrinkd_wait);
+        /* a kick during the scan runs another round */
+        __sync_lock_release(&kshrinkd_pending);
+        shrink_caches();
     }
-    return pfn_to_page(pfn);
+}
+
+void kshrinkd_init(void) {
+    kshrinkd_task = create_task("kshrinkd", kshrinkd);
+}
+
+/*
+ * The per-cpu list only serves order 0 on the node of the cpu, its pages
+ * may come from any zone and so only allocations that take any zone use it.
+ */
+static struct page *try_alloc_pages(int nid, gfp_t gfp, size_t order,
+                                    int alloc_flags) {
+    unsigned long flags;
+    struct page *page = NULL;
+
+    local_irq_save(flags);
+    if (nid == NUMA_NO_NODE)
+        nid = numa_node_id();
+    if (order == 0 && nid == numa_node_id() &&
+        gfp_zone(gfp) == ZONE_NORMAL) {
+        page = pcp_alloc_page(alloc_flags);
+    } else {
+        long pfn = get_page_from_zonelist(nid, gfp, order, alloc_flags);
+        if (pfn != -1)
+            page = pfn_to_page(pfn);
+    }
+    local_irq_restore(flags);
+    return page;
+}
+
+/*
+ * Stop at the low watermark first. Below it kshrinkd is kicked to shrink
+ * the caches and the zones may be drained down to min, __GFP_HIGH goes
+ * half way into that as well.
+ */
+struct page *__alloc_pages_node(int nid, gfp_t gfp, size_t order) {
+    int alloc_flags = ALLOC_WMARK_MIN;
+    struct page *page = try_alloc_pages(nid, gfp, order, ALLOC_WMARK_LOW);
+
+    if (gfp & __GFP_HIGH)
+        alloc_flags |= ALLOC_HIGH;
+    if (!page) {
+        wakeup_kshrinkd();
+        page = try_alloc_pages(nid, gfp, order, alloc_flags);
+    }
+    if (!page) {
+        return NULL;
+    }
+    set_page_order(page, order);
+    page->slub_cache = NULL;
+    if (gfp & __GFP_ZERO)
+        bzero(__va(page_to_pfn(page) << PAGE_SHIFT), PAGE_SIZE << order);
+    return page;
+}
+
+struct page *__alloc_pages(gfp_t gfp, size_t order) {
+    return __alloc_pages_node(NUMA_NO_NODE, gfp, order);
+}
+
+struct page *alloc_pages_node(int nid, size_t order) {
+    return __alloc_pages_node(nid, GFP_KERNEL, order);
+}
+
+struct page *alloc_pages(size_t order) {
+    return __alloc_pages(GFP_KERNEL, order);
 }
 
 void free_pages(struct page *page) {
-    buddy_free(buddy_base, page_to_pfn(page));
+    unsigned long flags;
+
+    local_irq_save(flags);
+    if (page_order(page) == 0) {
+        pcp_free_page(page);
+    } else {
+        buddy_free_pfn(page_to_pfn(page));
+    }
+    local_irq_restore(flags);
 }
+
 size_t pages_size(struct page *page) {
-    return buddy_size(buddy_base, page_to_pfn(page));
+    return PAGE_SIZE << page_order(page);
+}
+
+// give every cached page of this cpu back to the buddy
+void drain_local_pages(void) {
+    unsigned long flags;
+    local_irq_save(flags);
+    struct per_cpu_pages *pcp = this_cpu_ptr(&pcp_pages);
+    pcp_drain(pcp, pcp->count);
+    local_irq_restore(flags);
+}
+
+void print_pcp_stats(void) {
+    int cpu;
+    for_each_online_cpu(cpu) {
+        struct per_cpu_pages *pcp = &per_cpu(pcp_pages, cpu);
+        printk("pcp %d: count %d, hit %d, miss %d, free %d, drain %d\n", cpu,
+               pcp->count, pcp->alloc_hit, pcp->alloc_miss, pcp->free_hit,
+               pcp->drain);
+    }
 }
@@ -11,7 +11,7 @@
 
 STACK_POOL(memblock_region_pool, INIT_MEMBLOCK_REGIONS, struct memblock_region);
 
-static struct memblock __init_memblock = {
+struct memblock __init_memblock = {
     .memory.regions =
         {
             .list = LIST_HEAD_INIT(__init_memblock.memory.regions.list),
@@ -249,7 +249,6 @@ void memblock_mem_mapping() {
     struct memblock_type *memory = &__init_memblock.memory;
     struct memblock_region *region;
     list_for_each_entry(region, &memory->regions.list, list) {
-        phys_addr_t end = region->base + region->size - 1;
-        init_memory_mapping(region->base, end);
-    }    
+        init_memory_mapping(region->base, region->base + region->size);
+    }
 }
@@ -0,0 +1,87 @@
+#include <asm/page.h>
+#include <asm/sections.h>
+#include <asm/smp.h>
+#include <kernel/printk.h>
+
+#include <my-os/buddy_alloc.h>
+#include <my-os/kernel.h>
+#include <my-os/log2.h>
+#include <my-os/numa.h>
+#include <my-os/percpu.h>
+#include <my-os/spinlock.h>
+#include <my-os/string.h>
+
+/* areas start on their own cache line */
+#define PERCPU_UNIT_ALIGN 64
+
+unsigned long __per_cpu_offset[NR_CPUS];
+
+DEFINE_PER_CPU(unsigned long, this_cpu_off);
+DEFINE_PER_CPU(int, cpu_number);
+
+static bool percpu_ready;
+static size_t percpu_static_size;
+static size_t percpu_unit_size;
+static size_t percpu_dyn_used;
+static DEFINE_SPINLOCK(percpu_alloc_lock);
+
+/*
+ * Give every cpu a copy of the template. The per-cpu init loops walk all
+ * NR_CPUS before the MADT is parsed, so all areas are set up here and an
+ * ap only loads its %gs when it comes up. Until then the boot cpu runs
+ * with a %gs base of 0 and its per-cpu accesses go to the template
+ * itself: whatever it wrote there must be back at its initial value, as
+ * the preempt count is once every lock taken is released. The boot cpu
+ * is cpu 0.
+ */
+void setup_per_cpu_areas(void) {
+    size_t static_size = __per_cpu_end - __per_cpu_start;
+    size_t unit_size =
+        ALIGN(static_size + PERCPU_DYNAMIC_RESERVE, PERCPU_UNIT_ALIGN);
+    int order = get_order(unit_size * NR_CPUS);
+
+    phys_addr_t base = _alloc_pages(order);
+    /* every cpu would share the template */
+    if (!base)
+        panic("percpu: no memory for %d areas\n", NR_CPUS);
+    /* the rounding of the block goes to the dynamic part */
+    unit_size = round_down((PAGE_SIZE << order) / NR_CPUS, PERCPU_UNIT_ALIGN);
+
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        char *area = (char *)__va(base) + cpu * unit_size;
+
+        memcpy(area, __per_cpu_start, static_size);
+        bzero(area + static_size, unit_size - static_size);
+        __per_cpu_offset[cpu] = area - __per_cpu_start;
+        per_cpu(this_cpu_off, cpu) = __per_cpu_offset[cpu];
+        per_cpu(cpu_number, cpu) = cpu;
+        per_cpu(numa_node, cpu) = cpu_to_node(cpu);
+    }
+    percpu_static_size = static_size;
+    percpu_unit_size = unit_size;
+    percpu_ready = true;
+    load_percpu_segment(0);
+
+    printk("percpu: %d areas of %ld bytes, %ld static\n", NR_CPUS, unit_size,
+           static_size);
+}
+
+void *__alloc_percpu(size_t size, size_t align) {
+    unsigned long flags;
+    void *ptr = NULL;
+
+    if (!percpu_ready)
+        return NULL;
+
+    spin_lock_irqsave(&percpu_alloc_lock, flags);
+    size_t off = ALIGN(percpu_static_size + percpu_dyn_used, align);
+    if (off + size <= percpu_unit_size) {
+        percpu_dyn_used = off + size - percpu_static_size;
+        ptr = __per_cpu_start + off;
+    }
+    spin_unlock_irqrestore(&percpu_alloc_lock, flags);
+
+    if (!ptr)
+        printk("percpu: reserve exhausted, %ld bytes wanted\n", size);
+    return ptr;
+}
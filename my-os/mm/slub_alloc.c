@@ -4,9 +4,13 @@
 #include <my-os/kernel.h>
 #include <my-os/log2.h>
 #include <my-os/mm_types.h>
+#include <my-os/mmzone.h>
+#include <my-os/percpu.h>
 #include <my-os/slub_alloc.h>
 #include <my-os/string.h>
+#include <asm/cmpxchg.h>
 #include <asm/irq.h>
+#include <asm/smp.h>
 
 #define ARCH_KMALLOC_MINALIGN __alignof__(unsigned long long)
 #define ARCH_SLUB_MINALIGN __alignof__(unsigned long long)
@@ -23,6 +27,7 @@ enum slab_state {
 };
 enum slab_state slab_state;
 LIST_HEAD(slab_caches);
+static DEFINE_SPINLOCK(slab_caches_lock);
 struct kmem_cache *kmem_cache;
 static unsigned int slub_min_order;
 static unsigned int slub_max_order = PAGE_ALLOC_COSTLY_ORDER;
@@ -100,6 +105,15 @@ static int calculate_sizes(struct kmem_cache *s, int forced_order) {
     size = ALIGN(size, sizeof(void *));
     s->inuse = 0;
 
+    // constructed objects must keep their state while free, so the free
+    // pointer goes behind the object instead of into it
+    if (s->ctor) {
+        s->offset = size;
+        size += sizeof(void *);
+    } else {
+        s->offset = 0;
+    }
+
     size = ALIGN(size, s->align);
     s->size = size;
     if (forced_order >= 0)
@@ -109,19 +123,51 @@ static int calculate_sizes(struct kmem_cache *s, int forced_order) {
 
     if ((int)order < 0)
         return 0;
+    s->order = order;
 
     return size;
 }
 
 static void init_kmem_cache_node(struct kmem_cache_node *n) {
+    spin_lock_init(&n->list_lock);
     n->nr_partial = 0;
     INIT_LIST_HEAD(&n->partial);
 }
 
+/*
+ * The tid of a cpu slot starts at the cpu number and steps by NR_CPUS,
+ * so a fast path that raced with any change of the slot fails its
+ * cmpxchg16b even when the freelist pointer happens to match again.
+ */
+#define TID_STEP NR_CPUS
+
+static inline unsigned long next_tid(unsigned long tid) {
+    return tid + TID_STEP;
+}
+
+static inline unsigned long init_tid(int cpu) { return cpu; }
+
+static int init_kmem_cache_cpus(struct kmem_cache *s) {
+    s->cpu_slab = alloc_percpu(struct kmem_cache_cpu);
+    if (!s->cpu_slab)
+        return -1;
+
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct kmem_cache_cpu *c = per_cpu_ptr(s->cpu_slab, cpu);
+        c->freelist = NULL;
+        c->tid = init_tid(cpu);
+        c->page = NULL;
+    }
+    return 0;
+}
+
 static int kmem_cache_open(struct kmem_cache *s, slub_flags_t flags) {
     if (!calculate_sizes(s, -1))
         goto error;
-    init_kmem_cache_node(&s->node);
+    for (int nid = 0; nid < MAX_NUMNODES; nid++)
+        init_kmem_cache_node(&s->node[nid]);
+    if (init_kmem_cache_cpus(s))
+        goto error;
     return 0;
 error:
     return -1;
@@ -180,18 +226,54 @@ static inline void set_freepointer(struct kmem_cache *s, void *object,
 }
 
 static inline struct page *alloc_slab_page(struct kmem_cache *s, gfp_t flags) {
-    return alloc_pages(s->order);
+    /* slabs are shared by every caller and so not zone bound, kmalloc
+     * sends zone bound requests to the page allocator; the objects are
+     * zeroed on their own */
+    if (flags & GFP_ZONEMASK)
+        printk("slub: %s: zone modifier %#x ignored\n", s->name,
+               flags & GFP_ZONEMASK);
+    return __alloc_pages(flags & __GFP_HIGH, s->order);
 }
 
 void *page_addr(struct page *page) {
     return __va(page_to_pfn(page) << PAGE_SHIFT);
 }
 
+_Static_assert(offsetof(struct page, freelist) % 16 == 0 &&
+                   sizeof(struct page) % 16 == 0,
+               "page freelist/counters must be cmpxchg16b aligned");
+
+static inline struct kmem_cache_cpu *this_cpu_slab(struct kmem_cache *s) {
+    return this_cpu_ptr(s->cpu_slab);
+}
+
+static inline bool cpu_slab_cmpxchg(struct kmem_cache_cpu *c,
+                                    void *freelist_old, unsigned long tid_old,
+                                    void *freelist_new,
+                                    unsigned long tid_new) {
+    return cmpxchg_double(&c->freelist, (unsigned long)freelist_old, tid_old,
+                          (unsigned long)freelist_new, tid_new);
+}
+
+static inline bool page_cmpxchg(struct page *page, void *freelist_old,
+                                unsigned long counters_old,
+                                void *freelist_new,
+                                unsigned long counters_new) {
+    return cmpxchg_double(&page->freelist, (unsigned long)freelist_old,
+                          counters_old, (unsigned long)freelist_new,
+                          counters_new);
+}
+
+// the new slab is frozen for the allocating cpu, all objects counted in use
 static struct page *new_slab(struct kmem_cache *s, gfp_t flags) {
     struct page *page = alloc_slab_page(s, flags);
+    if (!page)
+        return NULL;
+
     void *start = page_addr(page);
     void *p, *next;
     int idx;
+    page->counters = 0;
     page->objects = order_objects(s->order, s->size);
     page->freelist = start;
     for (idx = 0, p = start; idx < page->objects - 1; idx++) {
@@ -200,121 +282,257 @@ static struct page *new_slab(struct kmem_cache *s, gfp_t flags) {
         p = next;
     }
     set_freepointer(s, p, NULL);
-    page->inuse = 0;
+    if (s->ctor) {
+        for (idx = 0, p = start; idx < page->objects; idx++, p += s->size)
+            s->ctor(p);
+    }
+    page->inuse = page->objects;
     page->frozen = 1;
     page->slub_cache = s;
     return page;
 }
 
-static void add_partial(struct kmem_cache *s, gfp_t gfpflags,
-                        struct page *page) {
-    s->node.nr_partial++;
-    list_add(&page->slub_list, &s->node.partial);
+static void discard_slab(struct kmem_cache *s, struct page *page) {
+    free_pages(page);
 }
 
-static void remove_partial(struct kmem_cache *s, gfp_t gfpflags,
-                           struct page *page) {
-    s->node.nr_partial--;
-    list_del(&page->slub_list);
-    free_pages(page);
+/* list_lock held */
+static void add_partial(struct kmem_cache_node *n, struct page *page) {
+    n->nr_partial++;
+    list_add(&page->slub_list, &n->partial);
+}
 
-    struct kmem_cache_cpu *c = &s->cpu_slab;
-    if (c->page == page) {
-        c->page = NULL;
-        c->freelist = NULL;
-    }
-    if (!list_empty(&s->node.partial)) {
-        int min = ((1 << 16) - 1);
-        struct page *p;
-        struct page *min_page;
-        list_for_each_entry(p, &s->node.partial, slub_list) {
-            if (p->inuse < min) {
-                min = p->inuse;
-                min_page = p;
-            }
-        }
-        c->partial = min_page;
-    }
+/* list_lock held */
+static void remove_partial(struct kmem_cache_node *n, struct page *page) {
+    n->nr_partial--;
+    list_del(&page->slub_list);
 }
 
-static struct page *new_slub_objects(struct kmem_cache *s, gfp_t flags) {
-    struct page *page = new_slab(s, flags);
-    if (page) {
-        add_partial(s, flags, page);
-        return page;
-    }
-    return NULL;
+/*
+ * Take the remote-freed objects of the cpu slab. If there are none the
+ * slab is full and is unfrozen; it stays off the partial list until a
+ * free makes room in it again.
+ */
+static void *get_cpu_page_freelist(struct page *page) {
+    void *freelist;
+    unsigned long counters;
+    struct page new;
+
+    do {
+        freelist = page->freelist;
+        counters = page->counters;
+        new.counters = counters;
+        if (freelist)
+            new.inuse = new.objects;
+        else
+            new.frozen = 0;
+    } while (!page_cmpxchg(page, freelist, counters, NULL, new.counters));
+
+    return freelist;
 }
 
-void *_slub_alloc(struct kmem_cache *s, gfp_t gfpflags,
-                  struct kmem_cache_cpu *c) {
+/* list_lock held, page already off the partial list */
+static void *acquire_slab(struct page *page) {
     void *freelist;
-    struct page *page = c->page;
-    if (!page)
-        goto new_slab;
+    unsigned long counters;
+    struct page new;
 
-redo:
+    do {
+        freelist = page->freelist;
+        counters = page->counters;
+        new.counters = counters;
+        new.inuse = new.objects;
+        new.frozen = 1;
+    } while (!page_cmpxchg(page, freelist, counters, NULL, new.counters));
 
-    freelist = page->freelist;
-    page->freelist = NULL;
-    if (!freelist) {
-        c->page = NULL;
-        goto new_slab;
-    }
+    return freelist;
+}
+
+static void *get_partial_node(struct kmem_cache_node *n,
+                              struct kmem_cache_cpu *c) {
+    void *freelist = NULL;
+
+    if (!n->nr_partial)
+        return NULL;
 
-    c->freelist = get_freepointer(s, freelist);
+    spin_lock(&n->list_lock);
+    if (!list_empty(&n->partial)) {
+        struct page *page =
+            list_first_entry(&n->partial, struct page, slub_list);
+        remove_partial(n, page);
+        freelist = acquire_slab(page);
+        c->page = page;
+    }
+    spin_unlock(&n->list_lock);
     return freelist;
+}
 
-new_slab:
-    if (c->partial) {
-        c->page = c->partial;
+/*
+ * Partial slabs of the other nodes, nearest first. Only taken when no
+ * new slab could be had, a remote slab is worse than a fresh local one.
+ */
+static void *get_any_partial(struct kmem_cache *s, struct kmem_cache_cpu *c) {
+    struct pglist_data *pgdat = NODE_DATA(numa_node_id());
+
+    for (int i = 0; i < pgdat->nr_fallback; i++) {
+        int nid = pgdat->node_fallback[i];
+        if (nid == numa_mem_id())
+            continue;
+        void *freelist = get_partial_node(&s->node[nid], c);
+        if (freelist)
+            return freelist;
+    }
+    return NULL;
+}
 
-        c->partial = list_next_entry(c->partial, slub_list);
-        if ((void *)c->partial == &s->node) {
-            c->partial = NULL;
+/*
+ * Install a refilled freelist in the cpu slot. A task that was migrated
+ * in the middle of a fast path free may still have pushed onto this slot,
+ * then the pushed objects are chained behind ours.
+ */
+static void install_cpu_freelist(struct kmem_cache *s,
+                                 struct kmem_cache_cpu *c, void *freelist) {
+    void *tail = NULL;
+    void *old;
+    unsigned long tid;
+
+    for (;;) {
+        tid = c->tid;
+        old = c->freelist;
+        if (old) {
+            if (!tail) {
+                tail = freelist;
+                while (get_freepointer(s, tail))
+                    tail = get_freepointer(s, tail);
+            }
+            set_freepointer(s, tail, old);
         }
+        if (cpu_slab_cmpxchg(c, old, tid, freelist, next_tid(tid)))
+            return;
+    }
+}
 
-        goto redo;
+/* interrupts off, c is the slot of this cpu */
+static void *___slab_alloc(struct kmem_cache *s, gfp_t gfpflags,
+                           struct kmem_cache_cpu *c) {
+    void *freelist;
+    unsigned long tid;
+
+    // claim the slot, so a stale fast path can no longer pop from it
+    do {
+        tid = c->tid;
+        freelist = c->freelist;
+    } while (!cpu_slab_cmpxchg(c, freelist, tid, NULL, next_tid(tid)));
+    if (freelist)
+        goto load_freelist;
+
+    if (c->page) {
+        freelist = get_cpu_page_freelist(c->page);
+        if (freelist)
+            goto load_freelist;
+        c->page = NULL;
     }
 
-    page = new_slub_objects(s, gfpflags);
+    freelist = get_partial_node(&s->node[numa_mem_id()], c);
+    if (freelist)
+        goto load_freelist;
+
+    struct page *page = new_slab(s, gfpflags);
     if (!page) {
+        freelist = get_any_partial(s, c);
+        if (freelist)
+            goto load_freelist;
         // out of memory
         return NULL;
     }
-    c->partial = page;
-    goto new_slab;
+    freelist = page->freelist;
+    page->freelist = NULL;
+    c->page = page;
+
+load_freelist:;
+    void *next = get_freepointer(s, freelist);
+    if (next)
+        install_cpu_freelist(s, c, next);
+    return freelist;
+}
+
+static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags) {
+    unsigned long flags;
+    local_irq_save(flags);
+    void *object = ___slab_alloc(s, gfpflags, this_cpu_slab(s));
+    local_irq_restore(flags);
+    return object;
 }
 
 void *slub_alloc(struct kmem_cache *s, gfp_t gfpflags) {
     if (!s) {
         return NULL;
     }
-    struct kmem_cache_cpu *c = &s->cpu_slab;
-    void *object = c->freelist;
+
+    struct kmem_cache_cpu *c;
+    unsigned long tid;
+    void *object;
+
+redo:
+    c = this_cpu_slab(s);
+    tid = c->tid;
+    barrier();
+    object = c->freelist;
     if (!object) {
-        object = _slub_alloc(s, gfpflags, c);
+        object = __slab_alloc(s, gfpflags);
     } else {
+        // a racing alloc may have reused object already, then the
+        // next pointer read here is garbage and the tid check fails
         void *next_object = get_freepointer(s, object);
-        c->freelist = next_object;
+        if (!cpu_slab_cmpxchg(c, object, tid, next_object, next_tid(tid)))
+            goto redo;
     }
-    if (object) {
-        c->page->inuse++;
-        s->inuse++;
-        bzero(object, s->size);
+    if (object && (gfpflags & __GFP_ZERO)) {
+        bzero(object, s->object_size);
     }
     return object;
 }
 
-void _slub_free(struct kmem_cache *s, struct page *page, void *head) {
-    struct page *p;
-    list_for_each_entry(p, &s->node.partial, slub_list) {
-        if (page == p) {
-            break;
+/*
+ * Free to a slab that is not the cpu slab of this cpu: push onto the
+ * page freelist directly. The node list is only touched when the slab
+ * turns from full to partial or from partial to empty.
+ */
+static void __slab_free(struct kmem_cache *s, struct page *page, void *head) {
+    struct kmem_cache_node *n = &s->node[page_to_nid(page)];
+    bool locked = false;
+    unsigned long flags = 0;
+    void *prior;
+    unsigned long counters;
+    struct page new;
+
+    do {
+        prior = page->freelist;
+        counters = page->counters;
+        set_freepointer(s, head, prior);
+        new.counters = counters;
+        new.inuse--;
+        if (!new.frozen && (!new.inuse || !prior) && !locked) {
+            spin_lock_irqsave(&n->list_lock, flags);
+            locked = true;
         }
+    } while (!page_cmpxchg(page, prior, counters, head, new.counters));
+
+    if (!locked)
+        return;
+
+    if (new.frozen) {
+        // frozen by a cpu after we decided to lock, it owns the slab now
+    } else if (!new.inuse) {
+        if (prior)
+            remove_partial(n, page);
+        spin_unlock_irqrestore(&n->list_lock, flags);
+        discard_slab(s, page);
+        return;
+    } else if (!prior) {
+        add_partial(n, page);
     }
-    set_freepointer(s, head, p->freelist);
-    p->freelist = head;
+    spin_unlock_irqrestore(&n->list_lock, flags);
 }
 
 void slub_free(struct kmem_cache *s, gfp_t flags, struct page *page,
@@ -324,16 +542,20 @@ void slub_free(struct kmem_cache *s, gfp_t flags, struct page *page,
     printk("slub free %s size %#x page %p addr %p\n", s->name, s->size, page,
            head);
 #endif
-    struct kmem_cache_cpu *c = &s->cpu_slab;
-    if (c->page == page) {
-        set_freepointer(s, head, c->freelist);
-        c->freelist = head;
+    struct kmem_cache_cpu *c;
+    unsigned long tid;
+
+redo:
+    c = this_cpu_slab(s);
+    tid = c->tid;
+    barrier();
+    if (page == c->page) {
+        void *freelist = c->freelist;
+        set_freepointer(s, head, freelist);
+        if (!cpu_slab_cmpxchg(c, freelist, tid, head, next_tid(tid)))
+            goto redo;
     } else {
-        _slub_free(s, page, head);
-    }
-    page->inuse--;
-    if (page->inuse == 0) {
-        remove_partial(s, flags, page);
+        __slab_free(s, page, head);
     }
 }
 
@@ -351,11 +573,39 @@ void kfree(void *addr) {
     }
 }
 
+static void slab_caches_add(struct kmem_cache *s) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&slab_caches_lock, flags);
+    list_add(&s->list, &slab_caches);
+    spin_unlock_irqrestore(&slab_caches_lock, flags);
+}
+
 // only for init
 static struct kmem_cache *bootstrap(struct kmem_cache *static_cache) {
     struct kmem_cache *s = slub_alloc(kmem_cache, SLUB_NONE);
     memcpy(s, static_cache, kmem_cache->object_size);
-    list_add(&s->list, &slab_caches);
+
+    // move the slabs of the static cache over to the allocated one
+    for (int nid = 0; nid < MAX_NUMNODES; nid++) {
+        struct kmem_cache_node *n = &static_cache->node[nid];
+
+        INIT_LIST_HEAD(&s->node[nid].partial);
+        while (!list_empty(&n->partial)) {
+            struct page *page =
+                list_first_entry(&n->partial, struct page, slub_list);
+            list_del(&page->slub_list);
+            list_add(&page->slub_list, &s->node[nid].partial);
+            page->slub_cache = s;
+        }
+    }
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct page *page = per_cpu_ptr(s->cpu_slab, cpu)->page;
+        if (page)
+            page->slub_cache = s;
+    }
+
+    slab_caches_add(s);
     return s;
 }
 
@@ -434,7 +684,10 @@ size_t ksize(const void *ptr) {
 
 static void *kmalloc_large(size_t size, gfp_t flags) {
     int order = get_order(size);
-    struct page *page = alloc_pages(order);
+    struct page *page = __alloc_pages(flags, order);
+    if (!page) {
+        return NULL;
+    }
     void *p = page_addr(page);
 #ifdef SLUB_DEBUG
     printk("alloc large size %#x addr %p\n", 1 << order, p);
@@ -444,8 +697,9 @@ static void *kmalloc_large(size_t size, gfp_t flags) {
 
 void *kmalloc(size_t size, gfp_t flags) {
     struct kmem_cache *s;
-    // Consider the case is larger than the cache
-    if (size > KMALLOC_MAX_CACHE_SIZE) {
+    // Consider the case is larger than the cache, or has to come from a
+    // zone, the slabs are shared across zones
+    if (size > KMALLOC_MAX_CACHE_SIZE || (flags & GFP_ZONEMASK)) {
         return kmalloc_large(size, flags);
     }
     s = kmalloc_slub(size, flags);
@@ -472,8 +726,9 @@ void *krealloc(void *p, size_t size, gfp_t flags) {
     }
 
     void *new = kmalloc(size, flags);
-    if (new &&p) {
-        memcpy(new, p, size);
+    if (new && p) {
+        memcpy(new, p, ks);
+        kfree(p);
     }
 
     return new;
@@ -481,7 +736,7 @@ void *krealloc(void *p, size_t size, gfp_t flags) {
 
 struct kmem_cache *create_kmalloc_cache(const char *name, unsigned int size,
                                         slub_flags_t flags) {
-    struct kmem_cache *s = slub_alloc(kmem_cache, flags);
+    struct kmem_cache *s = slub_alloc(kmem_cache, __GFP_ZERO);
     printk("slub alloc %s: %p\n", kmem_cache->name, s);
     if (!s) {
         // panic
@@ -490,10 +745,33 @@ struct kmem_cache *create_kmalloc_cache(const char *name, unsigned int size,
     }
 
     create_boot_cache(s, name, size, flags);
-    list_add(&s->list, &slab_caches);
+    slab_caches_add(s);
     s->refcount = 1;
     return s;
 }
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size,
+                                     unsigned int align, slub_flags_t flags,
+                                     void (*ctor)(void *)) {
+    struct kmem_cache *s = slub_alloc(kmem_cache, __GFP_ZERO);
+    if (!s) {
+        printk("kmem cache %s: out of memory\n", name);
+        return NULL;
+    }
+
+    s->name = name;
+    s->size = s->object_size = size;
+    s->align = calculate_alignment(align);
+    s->ctor = ctor;
+    if (__kmem_cache_create(s, flags)) {
+        printk("kmem cache %s: bad size %d\n", name, size);
+        kfree(s);
+        return NULL;
+    }
+    slab_caches_add(s);
+    s->refcount = 1;
+    return s;
+}
+
 struct kmalloc_info_t {
     const char *name;
     unsigned int size;
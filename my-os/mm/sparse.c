@@ -0,0 +1,156 @@
+#include <asm/page.h>
+
+#include <kernel/mm.h>
+#include <kernel/printk.h>
+
+#include <my-os/buddy_alloc.h>
+#include <my-os/kernel.h>
+#include <my-os/memblock.h>
+#include <my-os/mmzone.h>
+#include <my-os/spinlock.h>
+#include <my-os/string.h>
+
+struct mem_section *mem_section[NR_SECTION_ROOTS];
+
+/* hot-add is rare, one range at a time */
+static DEFINE_SPINLOCK(mem_hotplug_lock);
+
+static int sparse_index_init(unsigned long nr) {
+    unsigned long root = nr / SECTIONS_PER_ROOT;
+
+    if (mem_section[root])
+        return 0;
+
+    phys_addr_t addr = _alloc_pages(0);
+    if (!addr)
+        return -1;
+    bzero(__va(addr), PAGE_SIZE);
+    barrier();
+    mem_section[root] = __va(addr);
+    return 0;
+}
+
+/* a section split between nodes stays with the first one */
+static int memory_present(int nid, unsigned long start_pfn,
+                          unsigned long end_pfn) {
+    for (unsigned long nr = pfn_to_section_nr(start_pfn);
+         nr <= pfn_to_section_nr(end_pfn - 1); nr++) {
+        if (sparse_index_init(nr))
+            return -1;
+        struct mem_section *ms = __nr_to_section(nr);
+        if (!present_section(ms))
+            ms->flags = SECTION_MARKED_PRESENT |
+                        (unsigned long)nid << SECTION_NID_SHIFT;
+    }
+    return 0;
+}
+
+/*
+ * Populate vmemmap for the present sections in [first, last). Runs of
+ * sections are populated together so their inside can use 2M pages.
+ */
+static int sparse_populate(unsigned long first, unsigned long last) {
+    unsigned long nr = first;
+
+    while (nr < last) {
+        struct mem_section *ms = __nr_to_section(nr);
+        if (!present_section(ms) || valid_section(ms)) {
+            nr++;
+            continue;
+        }
+
+        unsigned long end = nr;
+        while (end < last && present_section(__nr_to_section(end)) &&
+               !valid_section(__nr_to_section(end)))
+            end++;
+
+        if (vmemmap_populate_hugepages(
+                (unsigned long)pfn_to_page(section_nr_to_pfn(nr)),
+                (unsigned long)pfn_to_page(section_nr_to_pfn(end)))) {
+            printk("sparse: no memory for sections %ld-%ld\n", nr, end - 1);
+            return -1;
+        }
+        for (; nr < end; nr++)
+            __nr_to_section(nr)->flags |= SECTION_HAS_MEM_MAP;
+    }
+    return 0;
+}
+
+/* needs the buddy allocator, vmemmap and the roots come from it */
+void sparse_init(void) {
+    struct memblock_region *region;
+    unsigned long present = 0;
+    unsigned long last = 0;
+
+    for_each_memblock(memory, region) {
+        phys_addr_t start = region->base;
+        phys_addr_t end = round_up(region->base + region->size, PAGE_SIZE);
+
+        while (start < end) {
+            phys_addr_t node_end;
+            int nid = phys_to_nid(start, &node_end);
+            node_end = min(node_end, end);
+            memory_present(nid, start >> PAGE_SHIFT, node_end >> PAGE_SHIFT);
+            start = node_end;
+        }
+        if (region->size)
+            last = max(last, pfn_to_section_nr((end >> PAGE_SHIFT) - 1) + 1);
+    }
+    sparse_populate(0, last);
+
+    for (unsigned long nr = 0; nr < last; nr++)
+        if (valid_section(__nr_to_section(nr)))
+            present++;
+    printk("sparse: %ld of %ld sections present, %ldM each\n", present, last,
+           PAGES_PER_SECTION >> (20 - PAGE_SHIFT));
+}
+
+int add_memory(int nid, phys_addr_t start, size_t size) {
+    unsigned long start_pfn = start >> PAGE_SHIFT;
+    unsigned long end_pfn = (start + size) >> PAGE_SHIFT;
+    unsigned long first = pfn_to_section_nr(start_pfn);
+    unsigned long last = pfn_to_section_nr(end_pfn);
+    unsigned long flags;
+    int ret = -1;
+
+    if (nid < 0 || nid >= MAX_NUMNODES || !node_online(nid)) {
+        printk("add_memory: node %d not online\n", nid);
+        return -1;
+    }
+    if (!size || (start | size) & ((1UL << SECTION_SIZE_BITS) - 1) ||
+        last > NR_MEM_SECTIONS) {
+        printk("add_memory: [mem %#x-%#x] not section aligned\n", start,
+               start + size - 1);
+        return -1;
+    }
+
+    spin_lock_irqsave(&mem_hotplug_lock, flags);
+    for (unsigned long nr = first; nr < last; nr++) {
+        if (present_section(__nr_to_section(nr))) {
+            printk("add_memory: section %ld already present\n", nr);
+            goto out;
+        }
+    }
+
+    if (init_memory_mapping(start, start + size) < end_pfn)
+        goto out;
+    /* page structs before the buddy, its pages are handed out at once */
+    if (memory_present(nid, start_pfn, end_pfn) ||
+        sparse_populate(first, last) ||
+        buddy_add_range(nid, start, start + size)) {
+        /* the sections go offline again, vmemmap already built is kept */
+        for (unsigned long nr = first; nr < last; nr++) {
+            struct mem_section *ms = __nr_to_section(nr);
+            if (ms)
+                ms->flags = 0;
+        }
+        goto out;
+    }
+    memblock_add(start, size);
+    setup_per_zone_wmarks();
+    printk("add_memory: [mem %#x-%#x] online\n", start, start + size - 1);
+    ret = 0;
+out:
+    spin_unlock_irqrestore(&mem_hotplug_lock, flags);
+    return ret;
+}
@@ -127,6 +127,8 @@ env *new_env(void);
 void free_env(env *e);
 
 void env_add_primitives(env *, parse_data *);
+void env_add_primitive(parse_data *data, env *env, char *name,
+                       primitive_proc_ptr *proc);
 
 #define NHASH 9997
 
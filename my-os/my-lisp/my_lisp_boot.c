@@ -1,5 +1,14 @@
 #include "my_lisp.h"
+#include <asm/tlbflush.h>
 #include <kernel/keyboard.h>
+#include <my-os/buddy_alloc.h>
+#include <my-os/buffer_head.h>
+#include <my-os/compiler.h>
+#include <my-os/fs.h>
+#include <my-os/lockstat.h>
+#include <my-os/smp.h>
+#include <my-os/task.h>
+#include <my-os/tick.h>
 
 ssize_t get_expr_str(char *lineptr, size_t n) {
     char ch;
@@ -39,10 +48,28 @@ ssize_t get_expr_str(char *lineptr, size_t n) {
     }
 }
 
+// (kstats) dumps the kernel counters to the console
+static object *primitive_kstats(env *e __always_unused, object *args,
+                                parse_data *data __always_unused) {
+    unref(args);
+    print_tick_stats();
+    print_sched_stats();
+    print_smp_call_stats();
+    print_tlb_stats();
+    print_pcp_stats();
+    print_lock_stats();
+    print_buffer_stats();
+    print_inode_stats();
+    print_dcache_stats();
+    return NIL;
+}
+
 int my_lisp_boot(void) {
 
     struct lisp_ctx_opt opt = {};
     struct lisp_ctx *ctx = make_lisp_ctx(opt);
+    env_add_primitive(ctx->parse_data, ctx->global_env, "kstats",
+                      primitive_kstats);
 
     char *buf = my_malloc(PTE_SIZE);
     while (true) {
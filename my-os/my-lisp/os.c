@@ -30,16 +30,15 @@ int my_sprintf(char *buf, const char *fmt, ...) {
 void *my_malloc(size_t size) {
 
 #ifdef MY_OS
-    void *ret = kmalloc(size, SLUB_NONE);
+    void *ret = kzalloc(size, SLUB_NONE);
 #else
-    void *ret = malloc(size);
+    void *ret = calloc(1, size);
 #endif // MY_OS
 
     if (!ret) {
         my_printf("malloc error\n");
         /* exit(0); */
     }
-    bzero(ret, size);
     return ret;
 }
 
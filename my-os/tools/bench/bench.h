@@ -0,0 +1,39 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+/* hosted stand-ins for the kernel headers the code under test uses */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint64_t u64;
+typedef unsigned long phys_addr_t;
+typedef _Bool bool;
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1UL << PAGE_SHIFT)
+#define MAX_ORDER 11
+
+#define DEFINE_PER_CPU(type, name) __attribute__((unused)) type name
+
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define ALIGN(x, a) (((x) + (a)-1) & ~((a)-1))
+#define is_power_of_2(n) (((n) & ((n)-1)) == 0)
+#define ilog2(n) (63 - __builtin_clzl(n))
+
+static inline double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif /* _BENCH_H */
@@ -0,0 +1,85 @@
+/*
+ * Random alloc/free churn of orders 0-3 over a 4G buddy with an odd
+ * tail, then checks that no two live blocks overlap and that freeing
+ * everything merges back to the same number of MAX_ORDER blocks.
+ */
+
+#include "bench.h"
+
+/* the buddy's metadata is taken from the range, back it with the heap */
+static char *mem_base;
+static unsigned long mem_start = 0x100000;
+
+#define __va(x) ((void *)(mem_base + ((unsigned long)(x)-mem_start)))
+#define __pa(x) ((unsigned long)((char *)(x)-mem_base) + mem_start)
+#define printk(...) ((void)0)
+
+#include "buddy_core.c"
+
+#define NR_LIVE (1 << 16)
+#define NR_CHURN 1000000
+#define MEM_SIZE ((4UL << 30) + (123UL << PAGE_SHIFT))
+
+static long pfns[NR_LIVE];
+static int orders[NR_LIVE];
+static u8 used[MEM_SIZE >> PAGE_SHIFT];
+
+static long count_max_order(struct buddy_alloc *buddy) {
+    long n = 0;
+    while (buddy_alloc_pfn(buddy, MAX_ORDER) >= 0)
+        n++;
+    return n;
+}
+
+int main(void) {
+    mem_base = malloc(64 << 20);
+    struct buddy_alloc *buddy = buddy_new(mem_start, mem_start + MEM_SIZE);
+    if (!mem_base || !buddy) {
+        printf("buddy_bench: setup failed\n");
+        return 1;
+    }
+    /* fill most of the big blocks so the search has to skip areas */
+    long pinned = 350;
+    for (long i = 0; i < pinned; i++)
+        buddy_alloc_pfn(buddy, MAX_ORDER);
+
+    srand(1);
+    double start = bench_now();
+    for (int i = 0; i < NR_LIVE; i++) {
+        orders[i] = rand() % 4;
+        if ((pfns[i] = buddy_alloc_pfn(buddy, orders[i])) < 0) {
+            printf("buddy_bench: alloc failed\n");
+            return 1;
+        }
+    }
+    for (long k = 0; k < NR_CHURN; k++) {
+        int i = rand() % NR_LIVE;
+        if (buddy_free(buddy, pfns[i]) != orders[i]) {
+            printf("buddy_bench: free of pfn %ld failed\n", pfns[i]);
+            return 1;
+        }
+        orders[i] = rand() % 4;
+        if ((pfns[i] = buddy_alloc_pfn(buddy, orders[i])) < 0) {
+            printf("buddy_bench: alloc failed after %ld ops\n", k);
+            return 1;
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    for (int i = 0; i < NR_LIVE; i++) {
+        for (long p = 0; p < 1L << orders[i]; p++) {
+            long index = pfns[i] - (mem_start >> PAGE_SHIFT) + p;
+            if (used[index]++) {
+                printf("buddy_bench: pfn %ld handed out twice\n", index);
+                return 1;
+            }
+        }
+    }
+    for (int i = 0; i < NR_LIVE; i++)
+        buddy_free(buddy, pfns[i]);
+    long max_order = count_max_order(buddy) + pinned;
+
+    printf("buddy: %.3f s for %d ops, %ld max-order blocks after free-all\n",
+           elapsed, 2 * NR_CHURN + NR_LIVE, max_order);
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Checks lib/string.c against libc on random sizes and alignments,
+ * then compares memcpy/memset throughput with a plain byte loop.
+ */
+
+#include "bench.h"
+
+#include <cpuid.h>
+
+static inline void cpuid(unsigned int op, unsigned int *eax,
+                         unsigned int *ebx, unsigned int *ecx,
+                         unsigned int *edx) {
+    __cpuid(op, *eax, *ebx, *ecx, *edx);
+}
+
+static inline void cpuid_count(unsigned int op, int count, unsigned int *eax,
+                               unsigned int *ebx, unsigned int *ecx,
+                               unsigned int *edx) {
+    __cpuid_count(op, count, *eax, *ebx, *ecx, *edx);
+}
+
+static inline unsigned int cpuid_eax(unsigned int op) {
+    unsigned int eax, ebx, ecx, edx;
+    __cpuid(op, eax, ebx, ecx, edx);
+    return eax;
+}
+
+#define printk printf
+#define kmalloc(size, flags) malloc(size)
+
+/* keep the kernel's versions apart from libc's */
+#define strlen k_strlen
+#define memset k_memset
+#define bzero k_bzero
+#define memcpy k_memcpy
+#define memmove k_memmove
+#define memcmp k_memcmp
+#define strcmp k_strcmp
+#define strcat k_strcat
+#define strchr k_strchr
+#define strdup k_strdup
+
+#include "string_core.c"
+
+#undef strlen
+#undef memset
+#undef bzero
+#undef memcpy
+#undef memmove
+#undef memcmp
+#undef strcmp
+#undef strcat
+#undef strchr
+#undef strdup
+
+#define BUF_SIZE (4 << 20)
+#define NR_CHECK 20000
+
+static char a[BUF_SIZE], b[BUF_SIZE], c[BUF_SIZE];
+
+static void *byte_memcpy(void *dest, const void *src, size_t n) {
+    char *d = dest;
+    const char *s = src;
+    while (n--)
+        *d++ = *s++;
+    return dest;
+}
+
+static void *byte_memset(void *dest, int v, size_t n) {
+    char *d = dest;
+    while (n--)
+        *d++ = v;
+    return dest;
+}
+
+static int sign(int v) { return (v > 0) - (v < 0); }
+
+static int check(void) {
+    srand(1);
+    for (int it = 0; it < NR_CHECK; it++) {
+        /* mostly small sizes, the tail crosses the non-temporal cutoff */
+        size_t n = rand() % (it < NR_CHECK - 1000 ? 300 : 600000);
+        size_t ao = rand() % 64, bo = rand() % 64, d = rand() % 40;
+
+        for (size_t i = 0; i < n + 64; i++)
+            a[i] = rand();
+
+        memset(b, 0x5a, n + 128);
+        memset(c, 0x5a, n + 128);
+        k_memcpy(b + bo, a + ao, n);
+        memcpy(c + bo, a + ao, n);
+        if (memcmp(b, c, n + 128))
+            return printf("memcpy differs at %zu bytes\n", n), 1;
+
+        int v = rand();
+        k_memset(b + bo, v, n);
+        memset(c + bo, v, n);
+        if (memcmp(b, c, n + 128))
+            return printf("memset differs at %zu bytes\n", n), 1;
+
+        memcpy(b, a, n + 64);
+        memcpy(c, a, n + 64);
+        k_memmove(b + d, b, n);
+        memmove(c + d, c, n);
+        if (memcmp(b, c, n + 64))
+            return printf("memmove forward differs at %zu bytes\n", n), 1;
+        k_memmove(b, b + d, n);
+        memmove(c, c + d, n);
+        if (memcmp(b, c, n + 64))
+            return printf("memmove backward differs at %zu bytes\n", n), 1;
+
+        memcpy(b, a, n + 64);
+        if (n)
+            b[rand() % n] ^= 1 + rand() % 255;
+        if (sign(k_memcmp(a, b, n)) != sign(memcmp(a, b, n)))
+            return printf("memcmp differs at %zu bytes\n", n), 1;
+
+        for (size_t i = ao; i < ao + n; i++)
+            a[i] = a[i] ? a[i] : 1;
+        a[ao + n] = 0;
+        if (k_strlen(a + ao) != strlen(a + ao))
+            return printf("strlen differs at %zu bytes\n", n), 1;
+    }
+    return 0;
+}
+
+static double rate(void *(*fn)(void *, const void *, size_t), char *dest,
+                   const char *src, size_t n) {
+    long reps = (64L << 20) / n + 1;
+    double start = bench_now();
+    for (long r = 0; r < reps; r++) {
+        fn(dest, src, n);
+        asm volatile("" : : "r"(dest) : "memory");
+    }
+    return reps * n / (bench_now() - start) / 1e9;
+}
+
+/* memset through the memcpy shape, src carries the byte */
+static void *byte_memset_fn(void *d, const void *s, size_t n) {
+    return byte_memset(d, (long)s, n);
+}
+
+static void *k_memset_fn(void *d, const void *s, size_t n) {
+    return k_memset(d, (long)s, n);
+}
+
+int main(void) {
+    string_init();
+    if (check())
+        return 1;
+    printf("string: matches libc on %d random cases\n", NR_CHECK);
+
+    static const size_t sizes[] = {8, 64, 512, 4096, 65536, 2 << 20};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        for (int unaligned = 0; unaligned < 2; unaligned++) {
+            size_t n = sizes[i];
+            char *dest = b + unaligned * 3, *src = a + unaligned * 5;
+            printf("%8zu %s memcpy %.2f -> %.2f GB/s  memset %.2f -> %.2f "
+                   "GB/s\n",
+                   n, unaligned ? "unaligned" : "aligned  ",
+                   rate(byte_memcpy, dest, src, n),
+                   rate(k_memcpy, dest, src, n),
+                   rate(byte_memset_fn, dest, (void *)1, n),
+                   rate(k_memset_fn, dest, (void *)1, n));
+        }
+    }
+    return 0;
+}